@@ -0,0 +1,558 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include <messenger.h>
+#include <plane_types.h>
+#include <utils.h>
+
+#include "../client/network.h"
+
+/*
+ * Headless bots for load testing the server. Every bot is a client
+ * connection made with the client's network code, flying a plane with
+ * scripted controls, so thousands of them can run in one process without
+ * any rendering. Bots acknowledge snapshots like the client does, so the
+ * server sends them delta snapshots, but they never decode them.
+ *
+ * Each bot measures its round trip time with empty packets the server
+ * echoes, and how many snapshot ticks never arrived. At the end the spread
+ * of those over the bots is reported.
+ */
+
+// players in a room of a server started without -s, bots are spread over
+// enough rooms to fit unless told how many to use
+#define BOT_ROOM_SIZE 64
+// bot ticks per second, the rate the client sends input at
+#define BOT_TICK_RATE 60
+// groups the bots send their input in, spread over each tick. Real clients
+// do not all send at once, and a burst of every bot overflows the receive
+// buffer of the server's socket, losing the inputs and probes at its end
+#define BOT_SEND_GROUPS 8
+// ticks between latency probes
+#define BOT_PING_INTERVAL 6
+// probes that can be waiting for their echo
+#define BOT_PINGS_IN_FLIGHT 64
+// round trip times kept per bot, the newest replace the oldest
+#define BOT_LATENCY_SAMPLES 1024
+// sockets reported ready by one wait
+#define BOT_EVENTS 256
+// ticks after connecting before a bot starts firing, so the bots have
+// spread out from where every plane starts
+#define BOT_WARMUP_TICKS (3 * BOT_TICK_RATE)
+
+typedef struct Bot
+{
+    Connection connection;
+    uid_t id; // 0 while not connected
+    u32 seed;
+    u32 room; // match on the server the bot joins
+
+    // scripted controls
+    struct InputPacket input;
+    u32 ticks_flown;
+    u32 next_turn_change;
+    f32 throttle_phase;
+
+    // snapshot ticks, to count the ones lost
+    u32 newest_tick;
+    u64 newest_parts; // parts of the newest tick received
+    u64 ticks_expected;
+    u64 ticks_received;
+
+    // round trip times in microseconds
+    u32 ping_sequence;
+    u32 ping_sequences[BOT_PINGS_IN_FLIGHT];
+    time_t ping_times[BOT_PINGS_IN_FLIGHT];
+    u32 latencies[BOT_LATENCY_SAMPLES];
+    size_t latency_count;
+    u64 pings_sent;
+    u64 pings_received;
+
+    // of the connections closed so far, the current one counts its own
+    u64 datagrams_received;
+    u64 kernel_drops;
+
+    u32 deaths;
+} Bot;
+
+// per bot results, to find their spread over the bots
+typedef struct BotResult
+{
+    f64 latency_p50; // ms
+    f64 latency_p99; // ms
+    f64 latency_max; // ms
+    f64 snapshot_loss; // percent of snapshot ticks never received
+    f64 ping_loss;     // percent of probes never echoed
+    f64 kernel_loss;   // percent of datagrams dropped by the bot's kernel
+} BotResult;
+
+static u32 bot_random(Bot *b)
+{
+    // xorshift, so each bot flies the same way every run
+    b->seed ^= b->seed << 13;
+    b->seed ^= b->seed >> 17;
+    b->seed ^= b->seed << 5;
+    return b->seed;
+}
+
+// connect a bot and watch its socket, so echoes are timed when they arrive
+// instead of on the next tick. A receive buffer of 0 keeps the default
+static Result
+bot_connect(Bot *b, int epoll_fd, const char *ip, int receive_buffer)
+{
+    // a mix of every plane, like a real match
+    PlaneType type = b->seed % PLANE_TYPE_MAX;
+    uid_t id       = create_connection(&b->connection, ip, type, b->room);
+    if (id == 0)
+        return RS_FAILURE;
+    connection_set_buffers(&b->connection, receive_buffer, 0);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = b};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, b->connection.client_socket, &event))
+    {
+        close_connection(&b->connection, id);
+        return RS_FAILURE;
+    }
+
+    // probes sent on the last connection can not be echoed any more
+    for (size_t i = 0; i < BOT_PINGS_IN_FLIGHT; i++)
+    {
+        if (b->ping_sequences[i] != 0)
+            b->pings_sent--;
+        b->ping_sequences[i] = 0;
+    }
+
+    b->id               = id;
+    b->ticks_flown      = 0;
+    b->next_turn_change = 0;
+    b->newest_tick      = 0;
+    b->newest_parts     = 0;
+    b->input            = (struct InputPacket){.throttle = 1.f};
+    return RS_SUCCESS;
+}
+
+// disconnect a bot, keeping the counts of its connection
+static void bot_close(Bot *b)
+{
+    b->datagrams_received += b->connection.datagrams_received;
+    b->kernel_drops += b->connection.kernel_drops;
+    close_connection(&b->connection, b->id);
+    b->id = 0;
+}
+
+// the controls of a bot for its current tick
+static void bot_script(Bot *b, u32 fire_percent)
+{
+    u32 tick = b->ticks_flown++;
+    if (tick >= b->next_turn_change)
+    {
+        // fly straight or turn for one to four seconds
+        b->input.turn = (i8)(bot_random(b) % 3) - 1;
+        b->next_turn_change =
+            tick + BOT_TICK_RATE + bot_random(b) % (3 * BOT_TICK_RATE);
+    }
+
+    f32 t             = (f32)tick / BOT_TICK_RATE;
+    b->input.throttle = 0.5f + 0.5f * sinf(t * 0.8f + b->throttle_phase);
+
+    // fire in bursts of half a second
+    u32 burst     = BOT_TICK_RATE / 2;
+    b->input.fire = tick >= BOT_WARMUP_TICKS &&
+                    (tick / burst + b->seed) % 100 < fire_percent;
+}
+
+static void bot_send(Bot *b)
+{
+    Connection *c = &b->connection;
+    connection_send_client_input(c, b->id, &b->input);
+
+    if (b->ticks_flown % BOT_PING_INTERVAL != 0)
+        return;
+    u32 sequence                                      = ++b->ping_sequence;
+    b->ping_sequences[sequence % BOT_PINGS_IN_FLIGHT] = sequence;
+    b->ping_times[sequence % BOT_PINGS_IN_FLIGHT]     = get_time();
+    b->pings_sent++;
+
+    struct EmptyPacket ping = {
+        .type = PACKET_TYPE_EMPTY,
+        .id   = sequence,
+    };
+    sendto(
+        c->client_socket,
+        &ping,
+        sizeof(ping),
+        MSG_DONTWAIT,
+        (struct sockaddr *)&c->server_addr,
+        c->server_addr_len);
+}
+
+static void bot_receive_snapshot(Bot *b, const struct SnapshotPacket *s)
+{
+    if (s->tick > b->newest_tick)
+    {
+        // every tick in between was lost, or is out of order and too late
+        b->ticks_expected += b->newest_tick ? s->tick - b->newest_tick : 1;
+        b->ticks_received++;
+        b->newest_tick  = s->tick;
+        b->newest_parts = 0;
+    }
+    else if (s->tick < b->newest_tick)
+    {
+        return;
+    }
+
+    if (s->part < 64)
+        b->newest_parts |= (u64)1 << s->part;
+    u64 all_parts = s->part_count >= 64 ? UINT64_MAX
+                                        : ((u64)1 << s->part_count) - 1;
+    // acknowledged like the client does, so the server sends deltas
+    if (b->newest_parts == all_parts)
+        b->connection.acked_tick = s->tick;
+}
+
+static void bot_receive_echo(Bot *b, const struct EmptyPacket *echo)
+{
+    u32 slot = echo->id % BOT_PINGS_IN_FLIGHT;
+    if (b->ping_sequences[slot] != (u32)echo->id)
+        return; // a duplicate, or so late it was replaced
+    b->ping_sequences[slot] = 0;
+    b->pings_received++;
+
+    time_t rtt = get_time() - b->ping_times[slot];
+    b->latencies[b->latency_count++ % BOT_LATENCY_SAMPLES] = rtt;
+}
+
+// read every datagram waiting for a bot, returns false if its plane is gone
+static bool bot_receive(Bot *b)
+{
+    Packet packet;
+    for (;;)
+    {
+        ssize_t length = connection_receive(&b->connection, &packet);
+        if (length == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_warning("Bot %i failed to receive", b->id);
+            return true;
+        }
+        if (packet_complete(&packet, length) == false)
+            continue;
+
+        switch (packet.type)
+        {
+        case PACKET_TYPE_SNAPSHOT:
+            bot_receive_snapshot(b, &packet.snapshot_packet);
+            break;
+        case PACKET_TYPE_EMPTY:
+            bot_receive_echo(b, &packet.empty_packet);
+            break;
+        case PACKET_TYPE_KILL:
+            if (packet.kill_packet.victim == b->id)
+                return false;
+            break;
+        case PACKET_TYPE_DISCONNECTION:
+            if (packet.disconnect_packet.id == b->id)
+                return false;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *)a;
+    u32 y = *(const u32 *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_f64(const void *a, const void *b)
+{
+    f64 x = *(const f64 *)a;
+    f64 y = *(const f64 *)b;
+    return (x > y) - (x < y);
+}
+
+// value at fraction of the way through sorted values
+static f64 percentile(const f64 *sorted, size_t count, f64 fraction)
+{
+    if (count == 0)
+        return 0;
+    size_t i = fraction * (count - 1) + 0.5;
+    return sorted[i];
+}
+
+static BotResult bot_result(Bot *b)
+{
+    size_t count = b->latency_count < BOT_LATENCY_SAMPLES
+                       ? b->latency_count
+                       : BOT_LATENCY_SAMPLES;
+    qsort(b->latencies, count, sizeof(u32), compare_u32);
+
+    BotResult r = {0};
+    if (count > 0)
+    {
+        r.latency_p50 = b->latencies[(count - 1) / 2] / 1000.;
+        r.latency_p99 = b->latencies[(count - 1) * 99 / 100] / 1000.;
+        r.latency_max = b->latencies[count - 1] / 1000.;
+    }
+    if (b->ticks_expected > 0)
+        r.snapshot_loss =
+            100. * (b->ticks_expected - b->ticks_received) / b->ticks_expected;
+    if (b->pings_sent > 0)
+        r.ping_loss =
+            100. * (b->pings_sent - b->pings_received) / b->pings_sent;
+    u64 datagrams = b->datagrams_received + b->kernel_drops;
+    if (datagrams > 0)
+        r.kernel_loss = 100. * b->kernel_drops / datagrams;
+    return r;
+}
+
+// print how one result is spread over the bots
+static void print_spread(const char *name, f64 *values, size_t count)
+{
+    qsort(values, count, sizeof(f64), compare_f64);
+    printf(
+        "%-16s %10.3f %10.3f %10.3f %10.3f\n",
+        name,
+        percentile(values, count, 0.5),
+        percentile(values, count, 0.9),
+        percentile(values, count, 0.99),
+        percentile(values, count, 1.0));
+}
+
+static void report(Bot *bots, size_t bot_count, FILE *csv)
+{
+    BotResult *results = malloc(bot_count * sizeof(BotResult));
+    f64 *values        = malloc(bot_count * sizeof(f64));
+    u64 deaths         = 0;
+    for (size_t i = 0; i < bot_count; i++)
+    {
+        results[i] = bot_result(&bots[i]);
+        deaths += bots[i].deaths;
+        if (csv != NULL)
+            fprintf(
+                csv,
+                "%zu,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f,%u\n",
+                i,
+                results[i].latency_p50,
+                results[i].latency_p99,
+                results[i].latency_max,
+                results[i].snapshot_loss,
+                results[i].ping_loss,
+                results[i].kernel_loss,
+                bots[i].deaths);
+    }
+
+    printf("%zu bots, %lu shot down\n", bot_count, deaths);
+    printf(
+        "%-16s %10s %10s %10s %10s\n", "per bot", "p50", "p90", "p99", "max");
+
+#define SPREAD(name, field)                    \
+    do                                         \
+    {                                          \
+        for (size_t i = 0; i < bot_count; i++) \
+            values[i] = results[i].field;      \
+        print_spread(name, values, bot_count); \
+    } while (0)
+
+    SPREAD("latency p50 ms", latency_p50);
+    SPREAD("latency p99 ms", latency_p99);
+    SPREAD("latency max ms", latency_max);
+    SPREAD("snapshot loss %", snapshot_loss);
+    SPREAD("ping loss %", ping_loss);
+    SPREAD("kernel drop %", kernel_loss);
+#undef SPREAD
+
+    free(results);
+    free(values);
+}
+
+// nanoseconds left until time, negative once it has passed
+static i64 ns_until(const struct timespec *time)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (time->tv_sec - now.tv_sec) * 1000000000L +
+           (time->tv_nsec - now.tv_nsec);
+}
+
+// milliseconds left until time, rounded up so waits do not end early. -1 if
+// time has passed
+static int ms_until(const struct timespec *time)
+{
+    i64 ns = ns_until(time);
+    return ns < 0 ? -1 : (int)((ns + 999999) / 1000000);
+}
+
+// allow a socket per bot
+static void raise_file_limit(size_t bot_count)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return;
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < bot_count + 16)
+        log_warning("Only %lu sockets can be open", limit.rlim_cur);
+}
+
+int main(int argc, char **argv)
+{
+    size_t bot_count   = 100;
+    u32 seconds        = 30;
+    u32 fire_percent   = 20;
+    u32 rooms          = 0;
+    const char *ip     = "127.0.0.1";
+    const char *path   = NULL;
+    int receive_buffer = 0;
+
+    // -n bots, -d seconds to fly for, -f percent of bursts spent firing,
+    // -a server address, -o a csv file for the results of every bot, -r
+    // rooms the bots are spread over, by default as many as the bots fill,
+    // and -b the bytes of kernel receive buffer for each bot
+    int option;
+    while ((option = getopt(argc, argv, "n:d:f:a:o:r:b:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            bot_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            seconds = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            fire_percent = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            ip = optarg;
+            break;
+        case 'o':
+            path = optarg;
+            break;
+        case 'r':
+            rooms = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            receive_buffer = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(
+                stderr,
+                "usage: %s [-n bots] [-d seconds] [-f fire percent] "
+                "[-a address] [-o results.csv] [-r rooms] "
+                "[-b receive buffer]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+    if (rooms == 0)
+        rooms = (bot_count + BOT_ROOM_SIZE - 1) / BOT_ROOM_SIZE;
+    if (bot_count == 0 || rooms == 0)
+    {
+        log_error("At least one bot and one room are needed");
+        return 1;
+    }
+
+    raise_file_limit(bot_count);
+    int epoll_fd = epoll_create1(0);
+    Bot *bots    = calloc(bot_count, sizeof(Bot));
+    if (epoll_fd == -1 || bots == NULL)
+    {
+        log_error("Failed to allocate %zu bots", bot_count);
+        return 1;
+    }
+    for (size_t i = 0; i < bot_count; i++)
+    {
+        bots[i].seed           = 2654435761u * (i + 1);
+        bots[i].throttle_phase = (f32)i;
+        bots[i].room           = i % rooms;
+        if (bot_connect(&bots[i], epoll_fd, ip, receive_buffer) !=
+            RS_SUCCESS)
+        {
+            log_error("Bot %zu could not connect to %s", i, ip);
+            bot_count = i;
+            break;
+        }
+    }
+    log_info("%zu bots connected", bot_count);
+
+    // tick on absolute times, so slow ticks do not slow the bots down
+    struct epoll_event events[BOT_EVENTS];
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    u32 groups = seconds * BOT_TICK_RATE * BOT_SEND_GROUPS;
+    for (u32 group = 0; group < groups; group++)
+    {
+        size_t first = bot_count * (group % BOT_SEND_GROUPS) / BOT_SEND_GROUPS;
+        size_t end =
+            bot_count * (group % BOT_SEND_GROUPS + 1) / BOT_SEND_GROUPS;
+        for (size_t i = first; i < end; i++)
+        {
+            Bot *b = &bots[i];
+            if (b->id == 0)
+            {
+                // shot down, fly again like a player would
+                if (bot_connect(b, epoll_fd, ip, receive_buffer) !=
+                    RS_SUCCESS)
+                    continue;
+            }
+            bot_script(b, fire_percent);
+            bot_send(b);
+        }
+
+        next.tv_nsec += 1000000000L / (BOT_TICK_RATE * BOT_SEND_GROUPS);
+        if (next.tv_nsec >= 1000000000L)
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        // a reconnect waits for the server's reply, up to half a second if
+        // it was lost. Skip the groups missed instead of sending them all
+        // at once, which would overflow the server's socket and lose more
+        if (ns_until(&next) < -1000000000L / BOT_TICK_RATE)
+            clock_gettime(CLOCK_MONOTONIC, &next);
+        int wait;
+        while ((wait = ms_until(&next)) >= 0)
+        {
+            int ready = epoll_wait(epoll_fd, events, BOT_EVENTS, wait);
+            for (int i = 0; i < ready; i++)
+            {
+                Bot *b = events[i].data.ptr;
+                if (b->id != 0 && bot_receive(b) == false)
+                {
+                    b->deaths++;
+                    bot_close(b);
+                }
+            }
+            if (wait == 0 && ready < BOT_EVENTS)
+                break;
+        }
+    }
+
+    for (size_t i = 0; i < bot_count; i++)
+        if (bots[i].id != 0)
+            bot_close(&bots[i]);
+
+    FILE *csv = path != NULL ? fopen(path, "w") : NULL;
+    if (csv != NULL)
+        fprintf(
+            csv,
+            "bot,latency_p50_ms,latency_p99_ms,latency_max_ms,"
+            "snapshot_loss_percent,ping_loss_percent,kernel_drop_percent,"
+            "deaths\n");
+    report(bots, bot_count, csv);
+    if (csv != NULL)
+        fclose(csv);
+    close(epoll_fd);
+    free(bots);
+    return 0;
+}
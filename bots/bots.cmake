@@ -0,0 +1,13 @@
+set(BOTS_NAME ${PROJECT_NAME}_bots)
+
+# the client's networking without anything that needs SDL
+add_executable(${BOTS_NAME}
+  ${CMAKE_CURRENT_LIST_DIR}/bots.c
+  ${CMAKE_SOURCE_DIR}/client/network.c
+)
+
+target_link_libraries(${BOTS_NAME} PRIVATE
+  ${SHARED_NAME}
+  cutils
+  m # standard math library
+)
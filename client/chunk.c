@@ -178,11 +178,8 @@ SDL_Surface *create_raw_chunk(ivec2 grid_coordinate)
 
 void destroy_chunk(Chunk *c) { render_destroy_texture(c->texture); }
 
-static inline i32 signof(f64 x) { return (x > 0) - (x < 0); }
-
 // find which grid coordinate point is in, stores it in dest
 void chunk_containing(vec2 point, ivec2 dest)
 {
-    dest[0] = (point[0] + signof(point[0]) * CHUNK_SIZE / 2) / CHUNK_SIZE;
-    dest[1] = (point[1] + signof(point[1]) * CHUNK_SIZE / 2) / CHUNK_SIZE;
+    grid_cell_containing(point, dest);
 }
@@ -3,9 +3,10 @@
 #include "render/render.h"
 #include <SDL2/SDL.h>
 #include <types.h>
+#include <grid.h>
 
 #define CHUNK_RESOLUTION (64)
-#define CHUNK_SIZE (0.5)
+#define CHUNK_SIZE (GRID_CELL_SIZE)
 
 #define CHUNK_COLOUR_COUNT (512)
 
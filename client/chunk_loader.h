@@ -11,7 +11,7 @@
 #include <SDL2/SDL_thread.h>
 #include <SDL2/SDL_mutex.h>
 
-#define CHUNK_RADIUS (1)
+#define CHUNK_RADIUS (GRID_VIEW_RADIUS)
 #define _SQR(x) ((x) * (x))
 #define CHUNK_COUNT (_SQR(CHUNK_RADIUS * 2 + 1))
 static_assert(CHUNK_COUNT == 9);
@@ -28,9 +28,13 @@ void clean_server_planes(GameData *game);
 Result update_client_plane(GameData *g, f32 delta);
 
 // moves all the planes in the list received from the server
-// so that they do not stutter as much.
-Result update_server_planes(
-    const Connection *connection, struct PlaneList *plane_list);
+// so that they do not stutter as much. Their bullets are simulated here
+// from the fire events the server sends
+Result update_server_planes(GameData *game, f32 delta);
+
+// the server owns the client's plane, so if the local prediction drifts too
+// far from the server's copy the local plane is moved back
+void reconcile_client_plane(Plane *local, const PlaneState *server);
 
 // attempts to retrieve the entity list from the server
 // if it cannot it just leaves the planes at their predicted positions
@@ -50,12 +54,20 @@ int game_update(GameData *game, f32 delta)
     // read input and move client plane
     update_client_plane(game, delta);
 
-    // inform server of movement
-    connection_send_client_plane(
-        &game->multiplayer.connection, game->multiplayer.id, &client_plane);
+    // inform server of the controls used to move
+    connection_send_client_input(
+        &game->multiplayer.connection,
+        game->multiplayer.id,
+        &game->multiplayer.input);
+
+    update_server_planes(game, delta);
 
-    update_server_planes(
-        &game->multiplayer.connection, &game->multiplayer.plane_list);
+    // the server decides hits, and tells every client about them
+    if (game->multiplayer.shot_down)
+    {
+        log_info("Plane hit!");
+        return 1;
+    }
 
     chunk_list_lock(&game->chunk_list);
 
@@ -86,27 +98,6 @@ int game_update(GameData *game, f32 delta)
             plane->p = client_plane; // update plane
         }
 
-        // check if planes bullets hit
-        for (size_t i = 0;
-             plane->player_id != game->multiplayer.id && i < MAX_BULLET_COUNT;
-             i++)
-        {
-            if (plane->p.active_bullets[i].used)
-            {
-                vec2 diff;
-                glm_vec2_sub(
-                    plane->p.active_bullets[i].p, client_plane.position, diff);
-
-                f32 magnitude = glm_vec2_distance(GLM_VEC2_ZERO, diff);
-
-                if (magnitude < 0.03)
-                {
-                    log_info("Plane hit!");
-                    return 1;
-                }
-            }
-        }
-
         draw_plane(&game->plane_render, &client_plane, &plane->p);
     }
 
@@ -157,14 +148,19 @@ Result game_loop()
             if (render_button_clicked(
                     game.render, game.main_menu_buttons.connect))
             {
-                // get text input for server ip
-                const char *txt = input_get_input_text(game.render);
-                if (strlen(txt) > 7)
+                // get text input for server ip, an ip ending in /n joins
+                // room n of the server
+                const char *txt  = input_get_input_text(game.render);
+                const char *room = strchr(txt, '/');
+                size_t ip_length = room != NULL ? (size_t)(room - txt)
+                                                : strlen(txt);
+                game.multiplayer.room =
+                    room != NULL ? strtoul(room + 1, NULL, 10) : 0;
+                if (ip_length > 7 &&
+                    ip_length < array_length(game.multiplayer.server_ip))
                 {
-                    strncpy(
-                        game.multiplayer.server_ip,
-                        txt,
-                        array_length(game.multiplayer.server_ip) - 1);
+                    memcpy(game.multiplayer.server_ip, txt, ip_length);
+                    game.multiplayer.server_ip[ip_length] = '\0';
                 }
 
                 log_info(
@@ -185,7 +181,10 @@ Result game_loop()
             for (size_t i = 0; i < 1; i++)
             {
                 uid_t id = create_connection(
-                    &game.multiplayer.connection, game.multiplayer.server_ip);
+                    &game.multiplayer.connection,
+                    game.multiplayer.server_ip,
+                    game.client_plane.plane_type,
+                    game.multiplayer.room);
                 if (id == 0)
                 {
                     log_warning(
@@ -220,7 +219,8 @@ Result game_loop()
             break;
         case GAME_STATE_DIED:
             // return to main menu to replay
-            game.game_state = GAME_STATE_MAIN_MENU;
+            game.multiplayer.shot_down = false;
+            game.game_state            = GAME_STATE_MAIN_MENU;
             break;
         case GAME_STATE_IN_MENU:
             // somehow handle drawing menu over game
@@ -357,16 +357,23 @@ void destroy_game(GameData *game)
 //
 Result update_client_plane(GameData *game, f32 delta)
 {
-    if (input_is_key_pressed(game->render, SDL_SCANCODE_SPACE))
+    // record controls so the server can apply the same ones
+    struct InputPacket *controls = &game->multiplayer.input;
+    controls->fire = input_is_key_pressed(game->render, SDL_SCANCODE_SPACE);
+    controls->turn = 0;
+
+    if (controls->fire)
     {
         plane_fire_bullet(&game->client_plane);
     }
     // move client plane
     plane_update(&game->client_plane, delta);
     if (input_is_key_pressed(game->render, SDL_SCANCODE_LEFT))
-        plane_turn(&game->client_plane, delta, LEFT, 1.f);
+        controls->turn = LEFT;
     else if (input_is_key_pressed(game->render, SDL_SCANCODE_RIGHT))
-        plane_turn(&game->client_plane, delta, RIGHT, 1.f);
+        controls->turn = RIGHT;
+    if (controls->turn != 0)
+        plane_turn(&game->client_plane, delta, controls->turn, 1.f);
 
     if (input_is_key_pressed(game->render, SDL_SCANCODE_G))
     {
@@ -386,13 +393,39 @@ Result update_client_plane(GameData *game, f32 delta)
         game->client_plane.throttle = 1.f;
     if (game->client_plane.throttle < 0.f)
         game->client_plane.throttle = 0.f;
+    controls->throttle = game->client_plane.throttle;
 
     return RS_SUCCESS;
 }
 
-Result
-update_server_planes(const Connection *connection, struct PlaneList *plane_list)
+void reconcile_client_plane(Plane *local, const PlaneState *server)
+{
+    // how far the client may be from the server before being corrected
+    const f32 SNAP_DISTANCE = 0.1f;
+    if (glm_vec2_distance(local->position, server->position) < SNAP_DISTANCE)
+        return;
+
+    local->position[0] = server->position[0];
+    local->position[1] = server->position[1];
+    local->heading     = server->heading;
+    local->speed       = server->velocity;
+}
+
+// move a plane to the state the server sent, leaving its bullets
+static void set_plane_state(SimplePlane *plane, const PlaneState *state)
 {
+    plane->plane_type  = state->plane_type;
+    plane->position[0] = state->position[0];
+    plane->position[1] = state->position[1];
+    plane->heading     = state->heading;
+    plane->velocity    = state->velocity;
+}
+
+Result update_server_planes(GameData *game, f32 delta)
+{
+    Connection *connection       = &game->multiplayer.connection;
+    struct PlaneList *plane_list = &game->multiplayer.plane_list;
+
     ConnectionUpdate update = connection_pump_updates(connection);
     struct PlaneNode *node;
     while (update.type != CONNECTION_NO_UPDATE)
@@ -400,6 +433,10 @@ update_server_planes(const Connection *connection, struct PlaneList *plane_list)
         switch (update.type)
         {
         case CONNECTION_UPDATE_PLANE:
+            if (update.plane_update.id == game->multiplayer.id)
+                reconcile_client_plane(
+                    &game->client_plane, &update.plane_update.plane);
+
             // find the plane updated and assign data if it is newer
             LIST_FOREACH(node, plane_list, data)
             {
@@ -407,8 +444,10 @@ update_server_planes(const Connection *connection, struct PlaneList *plane_list)
                 {
                     if (node->last_updated < update.plane_update.update_time)
                     {
-                        node->p            = update.plane_update.plane;
+                        // snapshots have no bullets, keep the simulated ones
+                        set_plane_state(&node->p, &update.plane_update.plane);
                         node->last_updated = update.plane_update.update_time;
+                        node->extrapolated = 0;
                     }
                     goto exit_update;
                 }
@@ -418,11 +457,51 @@ update_server_planes(const Connection *connection, struct PlaneList *plane_list)
             assert(node);
             node->player_id    = update.plane_update.id;
             node->last_updated = update.plane_update.update_time;
-            node->p            = update.plane_update.plane;
+            node->extrapolated = 0;
+            node->p            = (SimplePlane){0};
+            set_plane_state(&node->p, &update.plane_update.plane);
             LIST_INSERT_HEAD(plane_list, node, data);
         exit_update:
             break;
+        case CONNECTION_UPDATE_FIRE:
+            // the client's own bullets are already fired locally
+            if (update.fire_update.id == game->multiplayer.id)
+                break;
+            LIST_FOREACH(node, plane_list, data)
+            {
+                if (node->player_id == update.fire_update.id)
+                {
+                    node->p.active_bullets[update.fire_update.slot] =
+                        update.fire_update.bullet;
+                    break;
+                }
+            }
+            break;
+        case CONNECTION_UPDATE_KILL:
+            if (update.kill_update.victim == game->multiplayer.id)
+                game->multiplayer.shot_down = true;
+            // the bullet that hit is gone
+            if (update.kill_update.shooter == game->multiplayer.id)
+            {
+                game->client_plane.active_bullets[update.kill_update.slot]
+                    .used = false;
+                break;
+            }
+            LIST_FOREACH(node, plane_list, data)
+            {
+                if (node->player_id == update.kill_update.shooter)
+                {
+                    node->p.active_bullets[update.kill_update.slot].used =
+                        false;
+                    break;
+                }
+            }
+            break;
         case CONNECTION_UPDATE_DISCONNECT:
+            // the server drops a plane that was shot down even if the kill
+            // was lost
+            if (update.disconnect_update.id == game->multiplayer.id)
+                game->multiplayer.shot_down = true;
             // find plane that is disconencting and remove it from the draw list
             LIST_FOREACH(node, plane_list, data)
             {
@@ -447,6 +526,27 @@ update_server_planes(const Connection *connection, struct PlaneList *plane_list)
         update = connection_pump_updates(connection);
     }
 
+    // planes keep flying straight until the next update, for a while, so
+    // the ones sent less often do not jump. Bullets move the same way they
+    // do on the server
+    const f32 EXTRAPOLATE_LIMIT =
+        (f32)SNAPSHOT_EXTRAPOLATE_INTERVALS / SNAPSHOT_MIN_RATE;
+    LIST_FOREACH(node, plane_list, data)
+    {
+        if (node->player_id == game->multiplayer.id)
+            continue;
+        if (node->extrapolated < EXTRAPOLATE_LIMIT)
+        {
+            vec2 offset = {0, node->p.velocity * delta};
+            glm_vec2_rotate(offset, -node->p.heading, offset);
+            glm_vec2_add(node->p.position, offset, node->p.position);
+            node->extrapolated += delta;
+        }
+        for (size_t i = 0; i < MAX_BULLET_COUNT; i++)
+            if (node->p.active_bullets[i].used)
+                update_bullet(&node->p.active_bullets[i], delta);
+    }
+
     return RS_SUCCESS;
 }
 
@@ -14,6 +14,9 @@ struct PlaneNode
     uid_t player_id;
     SimplePlane p;
     time_t last_updated;
+    // seconds the plane was moved along its heading since the last update,
+    // the server sends distant planes only a few times a second
+    f32 extrapolated;
 
     LIST_ENTRY(PlaneNode) data;
 };
@@ -53,8 +56,11 @@ typedef struct GameData
     struct
     {
         char server_ip[17];
+        u32 room; // match on the server to join
         Connection connection;
         uid_t id; // this client's id, recieved from server
+        bool shot_down; // the server decided the client's plane was hit
+        struct InputPacket input; // controls held this frame
         size_t player_count;
         int seed; // world seed
         LIST_HEAD(PlaneList, PlaneNode) plane_list;
@@ -7,9 +7,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <messenger.h>
+#include <udp_socket.h>
 #include <utils.h>
+#include <stdlib.h>
 
-uid_t create_connection(Connection *c, const char *ip)
+uid_t create_connection(
+    Connection *c, const char *ip, int plane_type, u32 room)
 {
     int client_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
@@ -19,6 +22,8 @@ uid_t create_connection(Connection *c, const char *ip)
         .tv_usec = 500000,
     };
     setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (udp_socket_count_drops(client_socket) != RS_SUCCESS)
+        log_warning("Datagrams dropped by the kernel will not be counted");
 
     struct sockaddr_in server_addr = {
         .sin_family      = AF_INET,
@@ -30,6 +35,8 @@ uid_t create_connection(Connection *c, const char *ip)
     struct ConnectionPacket packet = {
         .type       = PACKET_TYPE_CONNECITON,
         .return_uid = 0,
+        .plane_type = plane_type,
+        .room       = room,
     };
 
     if (sendto(
@@ -55,9 +62,21 @@ uid_t create_connection(Connection *c, const char *ip)
 
     assert(packet.type == PACKET_TYPE_CONNECITON);
 
-    c->server_addr     = server_addr;
-    c->server_addr_len = sizeof(server_addr);
-    c->client_socket   = client_socket;
+    c->server_addr          = server_addr;
+    c->server_addr_len      = sizeof(server_addr);
+    c->client_socket        = client_socket;
+    c->input_sequence       = 0;
+    c->datagrams_received   = 0;
+    c->kernel_drops         = 0;
+    c->acked_tick           = 0;
+    c->server_time          = 0;
+    c->server_time_received = 0;
+    c->pending_frame        = NULL;
+    c->pending_next         = 0;
+    c->pending_end          = 0;
+    c->fire_next            = 0;
+    c->fire_count           = 0;
+    c->frames               = NULL;
 
     assert(packet.return_uid != 0);
 
@@ -83,20 +102,62 @@ Result close_connection(Connection *c, uid_t id)
         return RS_FAILURE;
 
     close(c->client_socket);
+    free(c->frames);
+    c->frames = NULL;
     return RS_SUCCESS;
 }
 
-Result connection_send_client_plane(
-    const Connection *c, uid_t id, const SimplePlane *p)
+Result connection_set_buffers(Connection *c, int receive, int send)
 {
-    struct PlanePacket packet = {
-        .type        = PACKET_TYPE_PLANE,
-        .id          = id,
-        .update_time = get_time(),
-        .plane       = *p,
+    if (udp_socket_set_buffers(c->client_socket, receive, send) != RS_SUCCESS)
+    {
+        log_warning("Failed to set the connection's socket buffers");
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+ssize_t connection_receive(Connection *c, Packet *packet)
+{
+    union
+    {
+        char buffer[UDP_SOCKET_CONTROL_SIZE];
+        size_t align; // of a cmsghdr
+    } control;
+    struct iovec iovec = {
+        .iov_base = packet,
+        .iov_len  = sizeof(*packet),
     };
+    struct msghdr msg = {
+        .msg_iov        = &iovec,
+        .msg_iovlen     = 1,
+        .msg_control    = &control,
+        .msg_controllen = sizeof(control),
+    };
+    ssize_t length = recvmsg(c->client_socket, &msg, MSG_DONTWAIT);
+    if (length == -1)
+        return -1;
+    c->datagrams_received++;
+    udp_socket_drops(&msg, &c->kernel_drops);
+    return length;
+}
 
-    assert(memcmp(&packet.plane, p, sizeof(SimplePlane)) == 0);
+Result connection_send_client_input(
+    Connection *c, uid_t id, const struct InputPacket *input)
+{
+    struct InputPacket packet = {
+        .type         = PACKET_TYPE_INPUT,
+        .id           = id,
+        .sequence     = ++c->input_sequence,
+        .turn         = input->turn,
+        .fire         = input->fire,
+        .throttle     = input->throttle,
+        .snapshot_ack = c->acked_tick,
+    };
+    // the planes on screen are moved on from the newest snapshot
+    if (c->server_time != 0)
+        packet.view_time =
+            c->server_time + (get_time() - c->server_time_received);
 
     if (sendto(
             c->client_socket,
@@ -106,24 +167,138 @@ Result connection_send_client_plane(
             (struct sockaddr *)&c->server_addr,
             c->server_addr_len) == -1)
     {
-        log_warning("Client side error sending plane packet");
+        log_warning("Client side error sending input packet");
         return RS_FAILURE;
     }
 
     return RS_SUCCESS;
 }
 
-ConnectionUpdate connection_pump_updates(const Connection *c)
+// decode the planes of a snapshot packet into the frame of its tick, and
+// queue them and the bullets fired to be reported by connection_pump_updates
+static void receive_snapshot(Connection *c, const struct SnapshotPacket *s)
+{
+    // bots read snapshots without decoding them, and never need frames
+    if (c->frames == NULL)
+    {
+        c->frames = calloc(SNAPSHOT_HISTORY, sizeof(SnapshotFrame));
+        if (c->frames == NULL)
+        {
+            log_error("Failed to allocate snapshot frames");
+            return;
+        }
+    }
+
+    SnapshotFrame *frame = &c->frames[s->tick % SNAPSHOT_HISTORY];
+    if (frame->tick > s->tick)
+        return; // older than the tick stored in its place, ignore it
+    if (frame->tick != s->tick)
+        snapshot_frame_reset(frame, s);
+
+    // a duplicate part would add its planes to the frame twice
+    u64 part_bit = s->part < 64 ? (u64)1 << s->part : 0;
+    if (frame->parts_received & part_bit)
+        return;
+    frame->parts_received |= part_bit;
+
+    if (s->update_time > c->server_time)
+    {
+        c->server_time          = s->update_time;
+        c->server_time_received = get_time();
+    }
+
+    const SnapshotFrame *baseline = NULL;
+    if (s->baseline_tick != 0)
+    {
+        baseline = &c->frames[s->baseline_tick % SNAPSHOT_HISTORY];
+        if (baseline->tick != s->baseline_tick ||
+            snapshot_frame_complete(baseline) == false)
+            baseline = NULL;
+    }
+
+    c->pending_frame = frame;
+    c->pending_next  = frame->plane_count;
+    c->fire_next     = 0;
+    c->fire_count    = 0;
+
+    size_t offset = 0;
+    SnapshotEntry entry;
+    SnapshotRead result;
+    while ((result = snapshot_read_entry(s, &offset, baseline, &entry)) !=
+           SNAPSHOT_READ_END)
+    {
+        // the frame can not be a baseline if it is missing planes
+        if (result == SNAPSHOT_READ_MALFORMED)
+            log_warning("Malformed snapshot from server");
+        if (result == SNAPSHOT_READ_MALFORMED ||
+            result == SNAPSHOT_READ_NO_BASELINE)
+        {
+            frame->failed = true;
+            break;
+        }
+
+        if (result == SNAPSHOT_READ_PLANE)
+        {
+            if (snapshot_frame_add(frame, entry.id, &entry.plane) == false)
+                frame->failed = true;
+            continue;
+        }
+
+        // catch the bullet up to the snapshot's tick
+        Bullet bullet =
+            fire_event_bullet(&entry.fire, s->tick, 1.f / SERVER_TICK_RATE);
+        if (bullet.used == false || c->fire_count == CONNECTION_MAX_FIRES)
+            continue;
+        c->pending_fires[c->fire_count].id     = entry.id;
+        c->pending_fires[c->fire_count].slot   = entry.fire.slot;
+        c->pending_fires[c->fire_count].bullet = bullet;
+        c->fire_count++;
+    }
+    c->pending_end = frame->plane_count;
+
+    if (snapshot_frame_complete(frame) && frame->tick > c->acked_tick)
+        c->acked_tick = frame->tick;
+}
+
+// the state of a plane sent in full, its bullets come from fire updates
+static PlaneState plane_state(const SimplePlane *p)
+{
+    return (PlaneState){
+        .plane_type = p->plane_type,
+        .position   = {p->position[0], p->position[1]},
+        .heading    = p->heading,
+        .velocity   = p->velocity,
+    };
+}
+
+ConnectionUpdate connection_pump_updates(Connection *c)
 {
+    ConnectionUpdate update;
+
+    // report the planes of the last snapshot one at a time
+    if (c->pending_next < c->pending_end)
+    {
+        const SnapshotFrame *frame      = c->pending_frame;
+        update.plane_update.type        = CONNECTION_UPDATE_PLANE;
+        update.plane_update.id          = frame->ids[c->pending_next];
+        update.plane_update.plane       = frame->planes[c->pending_next];
+        update.plane_update.update_time = frame->update_time;
+        c->pending_next++;
+        return update;
+    }
+    if (c->fire_next < c->fire_count)
+    {
+        update.fire_update.type   = CONNECTION_UPDATE_FIRE;
+        update.fire_update.id     = c->pending_fires[c->fire_next].id;
+        update.fire_update.slot   = c->pending_fires[c->fire_next].slot;
+        update.fire_update.bullet = c->pending_fires[c->fire_next].bullet;
+        c->fire_next++;
+        return update;
+    }
+
     Packet inc_packet;
-    int err = recvfrom(
-        c->client_socket,
-        &inc_packet,
-        sizeof(inc_packet),
-        MSG_DONTWAIT,
-        NULL,
-        NULL);
-    if (err == -1)
+    ssize_t length = connection_receive(c, &inc_packet);
+    if (length == -1)
     {
         // if error is indicating no packets, ignore, otherwise report error
         if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -135,13 +310,26 @@ ConnectionUpdate connection_pump_updates(const Connection *c)
         }
     }
 
-    ConnectionUpdate update;
+    // a truncated or forged datagram would be read past its end
+    if (packet_complete(&inc_packet, length) == false)
+    {
+        log_warning("Dropped an incomplete packet from the server");
+        return (ConnectionUpdate){.type = CONNECTION_NO_UPDATE};
+    }
+
     switch (inc_packet.type)
     {
     case PACKET_TYPE_EMPTY:
         // ignore empty packets
         // NOTE: maybe not a good idea
         return (ConnectionUpdate){.type = CONNECTION_NO_UPDATE};
+    case PACKET_TYPE_SNAPSHOT:
+        receive_snapshot(c, &inc_packet.snapshot_packet);
+        // start reporting the planes, or look for the next packet
+        return connection_pump_updates(c);
+    case PACKET_TYPE_INPUT:
+        // only the server consumes input
+        return (ConnectionUpdate){.type = CONNECTION_NO_UPDATE};
     case PACKET_TYPE_CONNECITON:
         // ignore, probably not meant to recieve now
         log_warning("Recieved connection packet unexpectedly");
@@ -155,15 +343,16 @@ ConnectionUpdate connection_pump_updates(const Connection *c)
         // fill out and return plane update
         update.plane_update.type        = CONNECTION_UPDATE_PLANE;
         update.plane_update.id          = inc_packet.data_packet.id;
-        update.plane_update.plane       = inc_packet.data_packet.plane;
         update.plane_update.update_time = inc_packet.data_packet.update_time;
-
-        assert(
-            memcmp(
-                update.plane_update.plane.active_bullets,
-                inc_packet.data_packet.plane.active_bullets,
-                sizeof(update.plane_update.plane.active_bullets)) == 0);
-
+        update.plane_update.plane = plane_state(&inc_packet.data_packet.plane);
+        return update;
+    case PACKET_TYPE_KILL:
+        update.kill_update.type    = CONNECTION_UPDATE_KILL;
+        update.kill_update.victim  = inc_packet.kill_packet.victim;
+        update.kill_update.shooter = inc_packet.kill_packet.shooter;
+        update.kill_update.slot    = inc_packet.kill_packet.slot;
+        if (update.kill_update.slot >= MAX_BULLET_COUNT)
+            return (ConnectionUpdate){.type = CONNECTION_UPDATE_ERROR};
         return update;
     default:
         log_error("Invalid packet type");
@@ -13,21 +13,57 @@
 #include <sys/socket.h>
 
 #include <packets.h>
+#include <snapshot.h>
 
 #define SERVER_PORT 8080
+// most fire events kept from one snapshot packet, each takes more than 16
+// bytes so a packet can not hold more
+#define CONNECTION_MAX_FIRES (MAX_SNAPSHOT_DATA / 16)
 
 typedef struct Connection
 {
     int client_socket;
     struct sockaddr_in server_addr;
     socklen_t server_addr_len;
+    u32 input_sequence; // sequence number of the last input sent
+
+    // datagrams read from the socket, and the ones the kernel dropped for a
+    // full receive buffer, to tell them from datagrams lost on the way
+    u64 datagrams_received;
+    u32 kernel_drops;
+
+    // planes of the last SNAPSHOT_HISTORY ticks, to decode delta snapshots.
+    // NULL until the first snapshot is decoded
+    SnapshotFrame *frames;
+    u32 acked_tick; // newest tick received in full, sent with input
+
+    // update_time of the newest snapshot and the local time it arrived, to
+    // tell the server how old the planes on screen are
+    time_t server_time;
+    time_t server_time_received;
+
+    // planes of the last snapshot packet still to be reported by
+    // connection_pump_updates
+    const SnapshotFrame *pending_frame;
+    size_t pending_next, pending_end;
+
+    // bullets fired in the last snapshot packet, reported after its planes
+    struct
+    {
+        uid_t id;
+        u8 slot;
+        Bullet bullet;
+    } pending_fires[CONNECTION_MAX_FIRES];
+    size_t fire_next, fire_count;
 } Connection;
 
 typedef enum ConnectionUpdateType
 {
     CONNECTION_NO_UPDATE,
     CONNECTION_UPDATE_PLANE,
+    CONNECTION_UPDATE_FIRE,
     CONNECTION_UPDATE_DISCONNECT,
+    CONNECTION_UPDATE_KILL,
     CONNECTION_UPDATE_ERROR,
 } ConnectionUpdateType;
 
@@ -44,20 +80,51 @@ typedef union ConnectionUpdate
         ConnectionUpdateType type;
         uid_t id;
         time_t update_time;
-        SimplePlane plane;
+        PlaneState plane; // bullets come from fire updates
     } plane_update;
+    // a bullet a plane fired, moved to where it is on the server
+    struct
+    {
+        ConnectionUpdateType type;
+        uid_t id;
+        u8 slot;
+        Bullet bullet;
+    } fire_update;
+    // the server decided a bullet hit a plane, which is gone
+    struct
+    {
+        ConnectionUpdateType type;
+        uid_t victim;
+        uid_t shooter;
+        u32 slot; // the bullet that hit, which is gone too
+    } kill_update;
 } ConnectionUpdate;
 
-uid_t create_connection(Connection *c, const char *ip);
+// join room of the server at ip, flying a plane of plane_type. Returns the
+// plane's uid, or 0 if the server did not answer or turned the client away
+uid_t create_connection(
+    Connection *c, const char *ip, int plane_type, u32 room);
 
 // must be retried if fails, otherwise socket will leak
 Result close_connection(Connection *, uid_t);
 
+// set the bytes the kernel buffers for the connection's socket in each
+// direction, 0 leaves a direction at the system default
+Result connection_set_buffers(Connection *c, int receive, int send);
+
+// read a datagram from the server without waiting, counting it and the
+// datagrams the kernel dropped before it. Returns its length, or -1 with
+// errno set, to EAGAIN if nothing is waiting
+ssize_t connection_receive(Connection *c, Packet *packet);
+
+// send the controls the client is holding, the server keeps applying them to
+// the client's plane until the next input arrives.
 // a successful result is no garuntee that the packet reached the server,
 // only that it was sent properly
-Result connection_send_client_plane(
-    const Connection *c, uid_t id, const SimplePlane *p);
+Result connection_send_client_input(
+    Connection *c, uid_t id, const struct InputPacket *input);
 
 // check if packets are in queue, if so read them and report the data
-// should be called until there are no incoming packets
-ConnectionUpdate connection_pump_updates(const Connection *c);
+// should be called until there are no incoming packets. Snapshots contain
+// many planes, which are reported one per call
+ConnectionUpdate connection_pump_updates(Connection *c);
@@ -0,0 +1,629 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <messenger.h>
+#include <packets.h>
+
+/*
+ * Raw packet load generator, for finding how much traffic the server keeps
+ * up with. Unlike the bots nothing is simulated: datagrams are serialized
+ * once and then sent at a fixed rate from many sockets, each with its own
+ * source port the way separate clients would be. Most are plane packets,
+ * which the server reads and drops, and some are empty packets, which it
+ * echoes, so their round trip time measures how long the server takes to
+ * get to a datagram under that load.
+ *
+ * Every combination of a list of client counts and a list of send rates is
+ * run for a few seconds. The server's own packet counters, read from a
+ * stats packet before and after, show how many datagrams actually reached
+ * it, so the rate at which it stops keeping up is the one where drops
+ * start. The datagrams the server's kernel dropped because its socket
+ * buffers were full are in the stats packet too, which tells a server that
+ * reads too slowly from one that never got the datagrams.
+ */
+
+#define SERVER_PORT 8080
+// most values in the client count and rate lists
+#define MAX_RUNS 16
+// datagrams sent or received per system call
+#define LOADGEN_BATCH 64
+// send times kept to time echoes, a power of 2
+#define LOADGEN_ECHO_SLOTS 65536
+// echo round trip times kept per run
+#define LOADGEN_LATENCY_SAMPLES (1 << 20)
+// length of a send slot in nanoseconds, the sending rate is kept up per slot
+#define LOADGEN_SLOT_NS 1000000L
+// runs with fewer datagrams lost than this, in percent, count as sustained
+#define LOADGEN_SUSTAINED_LOSS 0.1
+
+typedef struct LoadgenConfig
+{
+    struct sockaddr_in server_addr;
+    size_t clients[MAX_RUNS];
+    size_t client_runs;
+    u64 rates[MAX_RUNS]; // datagrams per second from all clients together
+    size_t rate_runs;
+    u32 seconds;      // length of each run
+    u32 echo_percent; // share of datagrams that are echoed empty packets
+    bool join;        // connect every client, so the server sends snapshots
+} LoadgenConfig;
+
+typedef struct Loadgen
+{
+    const LoadgenConfig *config;
+    struct pollfd *sockets; // watched for echoes between sends
+    uid_t *ids; // of joined clients
+    size_t socket_count;
+    size_t next_socket; // the socket the next datagrams are sent from
+
+    // serialized once, only the id of empty packets changes
+    struct PlanePacket plane;
+    struct EmptyPacket empties[LOADGEN_BATCH];
+    struct iovec iovecs[LOADGEN_BATCH];
+    struct mmsghdr messages[LOADGEN_BATCH];
+
+    u32 sequence; // of the next empty packet
+    u32 echo_sequences[LOADGEN_ECHO_SLOTS];
+    u64 echo_times[LOADGEN_ECHO_SLOTS];
+
+    Packet *received; // LOADGEN_BATCH datagrams
+    struct iovec receive_iovecs[LOADGEN_BATCH];
+    struct mmsghdr receive_messages[LOADGEN_BATCH];
+
+    u32 *latencies; // ns
+    size_t latency_count;
+} Loadgen;
+
+// the results of one client count and rate
+typedef struct LoadgenRun
+{
+    size_t clients;
+    u64 rate;
+    u64 sent;
+    u64 unsent; // the local socket buffers were full
+    u64 echoes_sent;
+    u64 echoes_received;
+    u64 bytes_received;  // echoes and anything else the server sent
+    i64 server_received; // -1 if the server could not be asked
+    i64 kernel_dropped;  // by the server's kernel, -1 if it could not be asked
+    f64 seconds;
+    f64 latency_p50; // microseconds
+    f64 latency_p99;
+    f64 latency_max;
+} LoadgenRun;
+
+static u64 now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (u64)t.tv_sec * 1000000000ul + t.tv_nsec;
+}
+
+// parse a comma separated list of numbers, returns how many were read
+static size_t parse_list(const char *text, u64 *dest)
+{
+    size_t count = 0;
+    while (*text != '\0' && count < MAX_RUNS)
+    {
+        char *end;
+        u64 value = strtoull(text, &end, 10);
+        if (end == text || value == 0)
+            return 0;
+        dest[count++] = value;
+        text          = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+// total of every datagram the server counted as received, -1 if the server
+// did not answer. Only servers on the same machine answer. The datagrams its
+// kernel dropped are written to kernel_drops when it answers
+static i64
+server_packets_in(const struct sockaddr_in *server, u64 *kernel_drops)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd == -1)
+        return -1;
+
+    Packet packet = {.type = PACKET_TYPE_STATS};
+    i64 total     = -1;
+    if (sendto(
+            fd,
+            &packet,
+            sizeof(struct StatsPacket),
+            0,
+            (const struct sockaddr *)server,
+            sizeof(*server)) != -1)
+    {
+        struct pollfd p = {.fd = fd, .events = POLLIN};
+        if (poll(&p, 1, 500) == 1 &&
+            recv(fd, &packet, sizeof(packet), 0) >=
+                (ssize_t)sizeof(struct StatsPacket) &&
+            packet.type == PACKET_TYPE_STATS)
+        {
+            total = 0;
+            for (size_t i = 0; i <= PACKET_TYPE_COUNT; i++)
+                total += packet.stats_packet.packets_in[i];
+            *kernel_drops = packet.stats_packet.kernel_drops;
+        }
+    }
+    close(fd);
+    return total;
+}
+
+// ask the server for a plane, returns its id or 0
+static uid_t join(int fd)
+{
+    struct ConnectionPacket packet = {.type = PACKET_TYPE_CONNECITON};
+    if (send(fd, &packet, sizeof(packet), 0) == -1)
+        return 0;
+
+    // snapshots for other clients never arrive before the reply
+    struct pollfd p = {.fd = fd, .events = POLLIN};
+    if (poll(&p, 1, 500) != 1 ||
+        recv(fd, &packet, sizeof(packet), 0) != sizeof(packet) ||
+        packet.type != PACKET_TYPE_CONNECITON)
+        return 0;
+    return packet.return_uid;
+}
+
+static Result open_sockets(Loadgen *l, size_t count)
+{
+    const LoadgenConfig *config = l->config;
+    l->sockets                  = malloc(count * sizeof(struct pollfd));
+    l->ids                      = calloc(count, sizeof(uid_t));
+    if (l->sockets == NULL || l->ids == NULL)
+        return RS_FAILURE;
+
+    for (l->socket_count = 0; l->socket_count < count; l->socket_count++)
+    {
+        // connected, so only the server's datagrams arrive and sends need
+        // no address
+        int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (fd == -1)
+            return RS_FAILURE;
+        l->sockets[l->socket_count] = (struct pollfd){
+            .fd     = fd,
+            .events = POLLIN,
+        };
+        if (connect(
+                fd,
+                (const struct sockaddr *)&config->server_addr,
+                sizeof(config->server_addr)) == -1)
+        {
+            close(fd);
+            return RS_FAILURE;
+        }
+        if (config->join)
+        {
+            l->ids[l->socket_count] = join(fd);
+            if (l->ids[l->socket_count] == 0)
+            {
+                log_error("Client %zu could not join", l->socket_count);
+                close(fd);
+                return RS_FAILURE;
+            }
+        }
+    }
+    return RS_SUCCESS;
+}
+
+static void close_sockets(Loadgen *l)
+{
+    for (size_t i = 0; i < l->socket_count; i++)
+    {
+        if (l->ids[i] != 0)
+        {
+            struct DisconnectPacket packet = {
+                .type = PACKET_TYPE_DISCONNECTION,
+                .id   = l->ids[i],
+            };
+            send(l->sockets[i].fd, &packet, sizeof(packet), 0);
+        }
+        close(l->sockets[i].fd);
+    }
+    free(l->sockets);
+    free(l->ids);
+    l->sockets      = NULL;
+    l->ids          = NULL;
+    l->socket_count = 0;
+}
+
+// send count datagrams from the next socket
+static void send_batch(Loadgen *l, LoadgenRun *r, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        // spread the echoed packets evenly through the stream
+        u64 n = r->sent + i;
+        if (n * l->config->echo_percent / 100 !=
+            (n + 1) * l->config->echo_percent / 100)
+        {
+            u32 sequence     = ++l->sequence;
+            u32 slot         = sequence & (LOADGEN_ECHO_SLOTS - 1);
+            l->empties[i].id = sequence;
+            l->echo_sequences[slot] = sequence;
+            l->iovecs[i]            = (struct iovec){
+                .iov_base = &l->empties[i],
+                .iov_len  = sizeof(struct EmptyPacket),
+            };
+        }
+        else
+        {
+            l->iovecs[i] = (struct iovec){
+                .iov_base = &l->plane,
+                .iov_len  = sizeof(l->plane),
+            };
+        }
+    }
+
+    int fd         = l->sockets[l->next_socket].fd;
+    l->next_socket = (l->next_socket + 1) % l->socket_count;
+    int sent       = sendmmsg(fd, l->messages, count, MSG_DONTWAIT);
+    u64 time       = now_ns();
+    if (sent < 0)
+        sent = 0;
+
+    for (int i = 0; i < sent; i++)
+    {
+        if (l->iovecs[i].iov_base == &l->plane)
+            continue;
+        u32 slot            = l->empties[i].id & (LOADGEN_ECHO_SLOTS - 1);
+        l->echo_times[slot] = time;
+        r->echoes_sent++;
+    }
+    // echoes that were never sent can not come back
+    for (size_t i = sent; i < count; i++)
+        if (l->iovecs[i].iov_base != &l->plane)
+            l->echo_sequences[l->empties[i].id & (LOADGEN_ECHO_SLOTS - 1)] = 0;
+
+    r->sent += sent;
+    r->unsent += count - sent;
+}
+
+// read everything the server sent to one socket
+static void receive_all(Loadgen *l, LoadgenRun *r, int fd)
+{
+    int count;
+    while ((count = recvmmsg(
+                fd, l->receive_messages, LOADGEN_BATCH, MSG_DONTWAIT, NULL)) >
+           0)
+    {
+        u64 time = now_ns();
+        for (int i = 0; i < count; i++)
+        {
+            r->bytes_received += l->receive_messages[i].msg_len;
+            const Packet *p = &l->received[i];
+            if (p->type != PACKET_TYPE_EMPTY)
+                continue;
+            u32 slot = p->empty_packet.id & (LOADGEN_ECHO_SLOTS - 1);
+            if (l->echo_sequences[slot] != (u32)p->empty_packet.id)
+                continue; // a duplicate, or so late it was replaced
+            l->echo_sequences[slot] = 0;
+            r->echoes_received++;
+            if (l->latency_count < LOADGEN_LATENCY_SAMPLES)
+                l->latencies[l->latency_count++] =
+                    time - l->echo_times[slot];
+        }
+    }
+}
+
+// take echoes as they arrive until time, so they are timed precisely. Every
+// socket is read at least once, even when time has passed
+static void receive_until(Loadgen *l, LoadgenRun *r, u64 time)
+{
+    u64 now = now_ns();
+    do
+    {
+        u64 left             = time > now ? time - now : 0;
+        struct timespec wait = {
+            .tv_sec  = left / 1000000000ul,
+            .tv_nsec = left % 1000000000ul,
+        };
+        if (ppoll(l->sockets, l->socket_count, &wait, NULL) <= 0)
+            continue;
+        for (size_t i = 0; i < l->socket_count; i++)
+            if (l->sockets[i].revents & POLLIN)
+                receive_all(l, r, l->sockets[i].fd);
+    } while ((now = now_ns()) < time);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *)a;
+    u32 y = *(const u32 *)b;
+    return (x > y) - (x < y);
+}
+
+static Result run(Loadgen *l, size_t clients, u64 rate, LoadgenRun *r)
+{
+    *r = (LoadgenRun){.clients = clients, .rate = rate};
+    if (open_sockets(l, clients) != RS_SUCCESS)
+    {
+        log_error("Failed to open %zu client sockets", clients);
+        close_sockets(l);
+        return RS_FAILURE;
+    }
+    memset(l->echo_sequences, 0, sizeof(l->echo_sequences));
+    l->latency_count = 0;
+
+    const struct sockaddr_in *server = &l->config->server_addr;
+    u64 drops_before                 = 0;
+
+    i64 server_before = server_packets_in(server, &drops_before);
+    u64 start         = now_ns();
+    u64 end           = start + l->config->seconds * 1000000000ul;
+    u64 slot_end      = start;
+    while (slot_end < end)
+    {
+        // send what should have been sent by the end of this slot, so slow
+        // slots are caught up on
+        slot_end += LOADGEN_SLOT_NS;
+        u64 due = (slot_end - start) * rate / 1000000000ul;
+        while (r->sent + r->unsent < due)
+        {
+            // a share of the slot from each client, in batches
+            u64 left  = due - r->sent - r->unsent;
+            u64 share = (left + clients - 1) / clients;
+            send_batch(l, r, share < LOADGEN_BATCH ? share : LOADGEN_BATCH);
+        }
+
+        receive_until(l, r, slot_end);
+    }
+    r->seconds = (now_ns() - start) / 1e9;
+
+    // late echoes still count, the server was just slow
+    receive_until(l, r, now_ns() + 200000000ul);
+
+    // the server counts a stats packet before answering it, so the second
+    // one is in the difference
+    u64 drops_after    = 0;
+    i64 server_after   = server_packets_in(server, &drops_after);
+    bool answered      = server_before >= 0 && server_after >= 0;
+    r->server_received = answered ? server_after - server_before - 1 : -1;
+    r->kernel_dropped  = answered ? (i64)(drops_after - drops_before) : -1;
+    close_sockets(l);
+
+    qsort(l->latencies, l->latency_count, sizeof(u32), compare_u32);
+    if (l->latency_count > 0)
+    {
+        size_t last    = l->latency_count - 1;
+        r->latency_p50 = l->latencies[last / 2] / 1000.;
+        r->latency_p99 = l->latencies[last * 99 / 100] / 1000.;
+        r->latency_max = l->latencies[last] / 1000.;
+    }
+    return RS_SUCCESS;
+}
+
+// percent of the datagrams sent that the server never received, -1 if it
+// could not be asked
+static f64 server_loss(const LoadgenRun *r)
+{
+    if (r->server_received < 0 || r->sent == 0)
+        return -1;
+    // joined clients sent connection and disconnection packets too
+    u64 received = r->server_received;
+    if (received > r->sent)
+        received = r->sent;
+    return 100. * (r->sent - received) / r->sent;
+}
+
+static void print_run(const LoadgenRun *r, FILE *csv)
+{
+    f64 loss        = server_loss(r);
+    f64 kernel_loss = r->kernel_dropped >= 0 && r->sent > 0
+                          ? 100. * r->kernel_dropped / r->sent
+                          : -1;
+    f64 echo_loss   = r->echoes_sent > 0
+                        ? 100. * (r->echoes_sent - r->echoes_received) /
+                              r->echoes_sent
+                        : 0;
+    printf(
+        "%7zu %10lu %10.0f %10.0f %8.3f %8.3f %8.3f %9.1f %9.1f %9.1f\n",
+        r->clients,
+        r->rate,
+        r->sent / r->seconds,
+        r->server_received >= 0 ? r->server_received / r->seconds : -1.,
+        loss,
+        kernel_loss,
+        echo_loss,
+        r->latency_p50,
+        r->latency_p99,
+        r->latency_max);
+    if (csv != NULL)
+        fprintf(
+            csv,
+            "%zu,%lu,%lu,%lu,%ld,%.3f,%ld,%lu,%lu,%lu,%.3f,%.3f,%.3f,"
+            "%.3f\n",
+            r->clients,
+            r->rate,
+            r->sent,
+            r->unsent,
+            r->server_received,
+            loss,
+            r->kernel_dropped,
+            r->echoes_sent,
+            r->echoes_received,
+            r->bytes_received,
+            r->seconds,
+            r->latency_p50,
+            r->latency_p99,
+            r->latency_max);
+    fflush(stdout);
+}
+
+static void create_loadgen(Loadgen *l, const LoadgenConfig *config)
+{
+    *l = (Loadgen){
+        .config    = config,
+        .received  = calloc(LOADGEN_BATCH, sizeof(Packet)),
+        .latencies = malloc(LOADGEN_LATENCY_SAMPLES * sizeof(u32)),
+        .plane     = {.type = PACKET_TYPE_PLANE},
+    };
+    for (size_t i = 0; i < LOADGEN_BATCH; i++)
+    {
+        l->empties[i]  = (struct EmptyPacket){.type = PACKET_TYPE_EMPTY};
+        l->messages[i] = (struct mmsghdr){
+            .msg_hdr = {.msg_iov = &l->iovecs[i], .msg_iovlen = 1},
+        };
+        l->receive_iovecs[i] = (struct iovec){
+            .iov_base = &l->received[i],
+            .iov_len  = sizeof(Packet),
+        };
+        l->receive_messages[i] = (struct mmsghdr){
+            .msg_hdr = {.msg_iov = &l->receive_iovecs[i], .msg_iovlen = 1},
+        };
+    }
+}
+
+int main(int argc, char **argv)
+{
+    LoadgenConfig config = {
+        .server_addr =
+            {
+                .sin_family      = AF_INET,
+                .sin_port        = htons(SERVER_PORT),
+                .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+            },
+        .clients      = {1, 16, 64, 256},
+        .client_runs  = 4,
+        .rates        = {10000, 50000, 100000, 200000},
+        .rate_runs    = 4,
+        .seconds      = 3,
+        .echo_percent = 10,
+    };
+    const char *path = NULL;
+
+    // -c client counts and -r datagrams per second, both comma separated
+    // lists that every combination of is run, -d seconds per run, -e percent
+    // of datagrams that are echoed, -j to connect every client first, -a
+    // server address and -o a csv file for the results
+    u64 values[MAX_RUNS];
+    int option;
+    while ((option = getopt(argc, argv, "c:r:d:e:ja:o:")) != -1)
+    {
+        switch (option)
+        {
+        case 'c':
+            config.client_runs = parse_list(optarg, values);
+            for (size_t i = 0; i < config.client_runs; i++)
+                config.clients[i] = values[i];
+            break;
+        case 'r':
+            config.rate_runs = parse_list(optarg, config.rates);
+            break;
+        case 'd':
+            config.seconds = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            config.echo_percent = strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            config.join = true;
+            break;
+        case 'a':
+            config.server_addr.sin_addr.s_addr = inet_addr(optarg);
+            break;
+        case 'o':
+            path = optarg;
+            break;
+        default:
+            fprintf(
+                stderr,
+                "usage: %s [-c clients,...] [-r rates,...] [-d seconds] "
+                "[-e echo percent] [-j] [-a address] [-o results.csv]\n",
+                argv[0]);
+            return 1;
+        }
+    }
+    if (config.client_runs == 0 || config.rate_runs == 0 ||
+        config.seconds == 0 || config.echo_percent > 100)
+    {
+        log_error("Client counts, rates and seconds must be above 0");
+        return 1;
+    }
+
+    // a socket per client
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    Loadgen loadgen;
+    create_loadgen(&loadgen, &config);
+    if (loadgen.received == NULL || loadgen.latencies == NULL)
+    {
+        log_error("Failed to allocate load generator");
+        return 1;
+    }
+    u64 kernel_drops = 0;
+    if (server_packets_in(&config.server_addr, &kernel_drops) < 0)
+        log_warning("Server did not answer a stats packet, drops are unknown");
+
+    FILE *csv = path != NULL ? fopen(path, "w") : NULL;
+    if (csv != NULL)
+        fprintf(
+            csv,
+            "clients,rate,sent,unsent,server_received,loss_percent,"
+            "kernel_dropped,echoes_sent,echoes_received,bytes_received,seconds,"
+            "latency_p50_us,latency_p99_us,latency_max_us\n");
+    printf(
+        "%7s %10s %10s %10s %8s %8s %8s %9s %9s %9s\n",
+        "clients",
+        "rate",
+        "sent/s",
+        "server/s",
+        "loss %",
+        "kernel %",
+        "echo %",
+        "p50 us",
+        "p99 us",
+        "max us");
+
+    // the highest rate each client count was sustained at
+    u64 sustained[MAX_RUNS] = {0};
+    for (size_t c = 0; c < config.client_runs; c++)
+    {
+        for (size_t r = 0; r < config.rate_runs; r++)
+        {
+            LoadgenRun result;
+            if (run(&loadgen,
+                    config.clients[c],
+                    config.rates[r],
+                    &result) != RS_SUCCESS)
+                continue;
+            print_run(&result, csv);
+
+            f64 loss = server_loss(&result);
+            if (loss >= 0 && loss < LOADGEN_SUSTAINED_LOSS &&
+                result.sent / result.seconds > sustained[c])
+                sustained[c] = result.sent / result.seconds;
+
+            // let the server empty its queues before the next run
+            sleep(1);
+        }
+    }
+
+    for (size_t c = 0; c < config.client_runs; c++)
+        printf(
+            "%zu clients sustained %lu datagrams/s\n",
+            config.clients[c],
+            sustained[c]);
+
+    if (csv != NULL)
+        fclose(csv);
+    free(loadgen.received);
+    free(loadgen.latencies);
+    return 0;
+}
@@ -0,0 +1,5 @@
+set(LOADGEN_NAME ${PROJECT_NAME}_loadgen)
+
+add_executable(${LOADGEN_NAME} ${CMAKE_CURRENT_LIST_DIR}/loadgen.c)
+
+target_link_libraries(${LOADGEN_NAME} PRIVATE ${SHARED_NAME} cutils)
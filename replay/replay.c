@@ -0,0 +1,195 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <messenger.h>
+#include <utils.h>
+
+#include "../server/capture.h"
+#include "../server/shard.h"
+
+/*
+ * Replays a capture recorded by the server with -r into the server's own
+ * packet handling and simulation, with no sockets and no threads. Every
+ * datagram is handled, and the world stepped, in the order and at the
+ * server time they were recorded at, so two builds of the server can be
+ * profiled and compared on the same traffic. Replies are built but dropped
+ * instead of sent.
+ *
+ * By default the capture is replayed as fast as possible, which gives how
+ * long the server spends on it. A speed replays it in real time, or faster.
+ * The server is set up with the workers and limits it was recorded with.
+ */
+
+// print the largest value of each part of a histogram, in microseconds
+static void print_percentiles(const char *name, const u64 *counts)
+{
+    printf("%-16s", name);
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+        printf(
+            " %9.1f",
+            histogram_percentile(counts, METRICS_PERCENTILES[i]) / 1000.);
+    printf("\n");
+}
+
+// wait until time microseconds after start on the monotonic clock
+static void sleep_until(const struct timespec *start, time_t time)
+{
+    struct timespec t = {
+        .tv_sec  = start->tv_sec + time / SEC_TO_MICROSEC,
+        .tv_nsec = start->tv_nsec + time % SEC_TO_MICROSEC * 1000,
+    };
+    if (t.tv_nsec >= 1000000000L)
+    {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000L;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+}
+
+int main(int argc, char **argv)
+{
+    f64 speed = 0;
+
+    // -s replays at a multiple of the recorded speed instead of as fast as
+    // possible
+    int option;
+    while ((option = getopt(argc, argv, "s:")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            speed = strtod(optarg, NULL);
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1 || speed < 0)
+    {
+        fprintf(stderr, "usage: %s [-s speed] capture\n", argv[0]);
+        return 1;
+    }
+
+    Capture capture;
+    if (load_capture(&capture, argv[optind]) != RS_SUCCESS)
+        return 1;
+    if (capture.header.tick_rate != SERVER_TICK_RATE)
+        log_warning(
+            "Capture was recorded at %u ticks per second, not %i",
+            capture.header.tick_rate,
+            SERVER_TICK_RATE);
+
+    // the same workers as the recording server, so every client is on the
+    // same worker as it was
+    ShardConfig config = {
+        .workers      = capture.header.workers,
+        .max_clients  = capture.header.max_clients,
+        .max_rooms    = capture.header.max_rooms,
+        .room_size    = capture.header.room_size,
+        .idle_timeout = capture.header.idle_timeout,
+        .rate_limit   = capture.header.rate_limit,
+        .tiers        = capture.header.tiers,
+        .offline      = true,
+    };
+    ShardGroup server;
+    Histogram *handling = calloc(1, sizeof(Histogram));
+    if (handling == NULL || config.workers == 0 || config.max_clients == 0 ||
+        create_shard_group(&server, &config) != RS_SUCCESS)
+    {
+        log_error("Failed to create the server to replay into");
+        free(handling);
+        destroy_capture(&capture);
+        return 1;
+    }
+
+    // time spent on each datagram is recorded in handling, the ticks are in
+    // the worker metrics
+    u64 datagrams = 0, ticks = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    u64 replay_start = metrics_now();
+    for (size_t i = 0; i < capture.event_count; i++)
+    {
+        const CaptureEvent *e  = &capture.events[i];
+        const CaptureRecord *r = e->record;
+        Shard *s               = &server.shards[r->worker % server.shard_count];
+        time_t now             = capture.header.start + e->time;
+        if (speed > 0)
+            sleep_until(&start, e->time / speed);
+
+        if (r->type == CAPTURE_TICK)
+        {
+            shard_advance(s, now, r->tick.first, r->tick.count);
+            ticks += r->tick.count;
+            continue;
+        }
+
+        // handling can write replies into the packet, so each gets a copy,
+        // zeroed past the datagram so leftover bytes never change a replay
+        Packet packet = {0};
+        memcpy(&packet, r + 1, r->datagram.length);
+        struct sockaddr_in addr = {
+            .sin_family      = AF_INET,
+            .sin_port        = r->datagram.port,
+            .sin_addr.s_addr = r->datagram.address,
+        };
+
+        u64 begin = metrics_now();
+        shard_feed(
+            s,
+            now,
+            &packet,
+            r->datagram.length,
+            (const struct sockaddr *)&addr,
+            sizeof(addr));
+        histogram_record(handling, metrics_now() - begin);
+        datagrams++;
+    }
+    f64 seconds = (metrics_now() - replay_start) / 1e9;
+
+    MetricsTotals totals = {0};
+    shard_group_metrics(&server, &totals);
+    u64 packets_out = 0;
+    for (size_t i = 0; i <= PACKET_TYPE_COUNT; i++)
+        packets_out += totals.packets_out[i];
+    u64 handling_counts[HISTOGRAM_BUCKETS];
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        handling_counts[i] = handling->counts[i];
+
+    f64 recorded = capture.event_count > 0
+                       ? capture.events[capture.event_count - 1].time /
+                             (f64)SEC_TO_MICROSEC
+                       : 0;
+    printf(
+        "%lu datagrams and %lu ticks on %zu workers, %.2f s recorded\n",
+        datagrams,
+        ticks,
+        server.shard_count,
+        recorded);
+    printf(
+        "replayed in %.3f s, %.0f datagrams/s, %lu datagrams sent\n",
+        seconds,
+        datagrams / seconds,
+        packets_out);
+    printf(
+        "%-16s %9s %9s %9s %9s %9s\n",
+        "us",
+        "p50",
+        "p90",
+        "p99",
+        "p99.9",
+        "max");
+    print_percentiles("datagram", handling_counts);
+    print_percentiles("tick", totals.tick_duration);
+
+    free(handling);
+    destroy_shard_group(&server);
+    destroy_capture(&capture);
+    return 0;
+}
@@ -0,0 +1,18 @@
+set(REPLAY_NAME ${PROJECT_NAME}_replay)
+
+# the server without its main, fed from a capture instead of sockets
+file(GLOB REPLAY_SOURCES ${CMAKE_SOURCE_DIR}/server/*.c)
+list(REMOVE_ITEM REPLAY_SOURCES ${CMAKE_SOURCE_DIR}/server/server.c)
+
+add_executable(${REPLAY_NAME}
+  ${CMAKE_CURRENT_LIST_DIR}/replay.c
+  ${REPLAY_SOURCES}
+)
+
+find_package(Threads REQUIRED)
+
+target_link_libraries(${REPLAY_NAME} PRIVATE
+  ${SHARED_NAME}
+  cutils
+  Threads::Threads
+)
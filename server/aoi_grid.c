@@ -0,0 +1,119 @@
+#include "aoi_grid.h"
+#include <stdlib.h>
+#include <messenger.h>
+
+static inline u32 hash_cell(const ivec2 c)
+{
+    return ((u32)c[0] * 73856093u) ^ ((u32)c[1] * 19349663u);
+}
+
+Result create_aoi_grid(AoiGrid *g, size_t max_planes)
+{
+    // every plane and bullet could be in its own cell, keep the table at
+    // most half full
+    size_t max_cells     = max_planes * (MAX_BULLET_COUNT + 1);
+    size_t cell_capacity = 1;
+    while (cell_capacity < max_cells * 2)
+        cell_capacity <<= 1;
+
+    size_t max_bullets = max_planes * MAX_BULLET_COUNT;
+
+    *g = (AoiGrid){
+        .cells           = calloc(cell_capacity, sizeof(AoiCell)),
+        .cell_mask       = cell_capacity - 1,
+        .next_plane      = calloc(max_planes, sizeof(u32)),
+        .plane_cells     = calloc(max_planes, sizeof(ivec2)),
+        .bullets         = calloc(max_bullets, sizeof(AoiBullet)),
+        .bullet_capacity = max_bullets,
+    };
+    if (!g->cells || !g->next_plane || !g->plane_cells || !g->bullets)
+    {
+        log_error("Failed to allocate area of interest grid");
+        destroy_aoi_grid(g);
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+void destroy_aoi_grid(AoiGrid *g)
+{
+    free(g->cells);
+    free(g->next_plane);
+    free(g->plane_cells);
+    free(g->bullets);
+    *g = (AoiGrid){0};
+}
+
+// find a cell, adding it if it is not in use yet
+static AoiCell *insert_cell(AoiGrid *g, const ivec2 coordinate)
+{
+    for (size_t i = hash_cell(coordinate);; i++)
+    {
+        AoiCell *c = &g->cells[i & g->cell_mask];
+        if (c->generation != g->generation)
+        {
+            *c = (AoiCell){
+                .coordinate   = {coordinate[0], coordinate[1]},
+                .generation   = g->generation,
+                .first_plane  = AOI_NONE,
+                .first_bullet = AOI_NONE,
+            };
+            return c;
+        }
+        if (c->coordinate[0] == coordinate[0] &&
+            c->coordinate[1] == coordinate[1])
+            return c;
+    }
+}
+
+const AoiCell *aoi_grid_find(const AoiGrid *g, const ivec2 coordinate)
+{
+    for (size_t i = hash_cell(coordinate);; i++)
+    {
+        const AoiCell *c = &g->cells[i & g->cell_mask];
+        if (c->generation != g->generation)
+            return NULL;
+        if (c->coordinate[0] == coordinate[0] &&
+            c->coordinate[1] == coordinate[1])
+            return c;
+    }
+}
+
+void aoi_grid_build(AoiGrid *g, const World *w)
+{
+    // bumping the generation empties every cell without touching them,
+    // generation 0 is skipped as it is the state of a new cell
+    if (++g->generation == 0)
+        g->generation = 1;
+    g->bullet_count = 0;
+
+    for (u32 p = 0; p < w->plane_count; p++)
+    {
+        const Plane *plane = &w->planes[p].plane;
+
+        grid_cell_containing(plane->position, g->plane_cells[p]);
+        AoiCell *cell     = insert_cell(g, g->plane_cells[p]);
+        g->next_plane[p]  = cell->first_plane;
+        cell->first_plane = p;
+
+        for (u32 i = 0; i < MAX_BULLET_COUNT; i++)
+        {
+            const Bullet *b = &plane->active_bullets[i];
+            if (b->used == false)
+                continue;
+
+            ivec2 coordinate;
+            grid_cell_containing(b->p, coordinate);
+            cell = insert_cell(g, coordinate);
+
+            u32 index = g->bullet_count++;
+
+            g->bullets[index] = (AoiBullet){
+                .plane = p,
+                .slot  = i,
+                .next  = cell->first_bullet,
+            };
+            cell->first_bullet = index;
+        }
+    }
+}
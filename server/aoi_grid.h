@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+ * Area of interest grid. Every tick the planes and bullets of the world
+ * are sorted into the shared grid cells, so the planes and bullets around
+ * a client can be found by looking at the cells in its view instead of
+ * checking the whole world.
+ *
+ * Occupied cells are stored in an open addressing hash table, and the
+ * planes and bullets in each cell form singly linked lists through index
+ * arrays, so rebuilding the grid does not allocate.
+ */
+
+#include "world.h"
+#include <grid.h>
+
+// end of a list of planes or bullets
+#define AOI_NONE UINT32_MAX
+
+typedef struct AoiBullet
+{
+    u32 plane; // index of the owning plane in the world
+    u32 slot;  // index in the plane's active_bullets
+    u32 next;  // next bullet in the same cell
+} AoiBullet;
+
+typedef struct AoiCell
+{
+    ivec2 coordinate;
+    u32 generation; // cell is only in use if this matches the grid
+    u32 first_plane;
+    u32 first_bullet;
+} AoiCell;
+
+typedef struct AoiGrid
+{
+    AoiCell *cells;
+    size_t cell_mask; // cell capacity - 1, capacity is a power of 2
+    u32 generation;
+
+    u32 *next_plane; // next plane in the same cell, per world plane index
+    ivec2 *plane_cells;
+
+    AoiBullet *bullets;
+    size_t bullet_count;
+    size_t bullet_capacity;
+} AoiGrid;
+
+Result create_aoi_grid(AoiGrid *g, size_t max_planes);
+void destroy_aoi_grid(AoiGrid *g);
+
+// sort every plane and bullet of the world into the grid, replacing the
+// previous contents
+void aoi_grid_build(AoiGrid *g, const World *w);
+
+// find a cell, returns NULL if nothing is in it
+const AoiCell *aoi_grid_find(const AoiGrid *g, const ivec2 coordinate);
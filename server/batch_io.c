@@ -0,0 +1,623 @@
+#define _GNU_SOURCE // recvmmsg and sendmmsg
+#include "batch_io.h"
+#include "uring_io.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/udp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <messenger.h>
+#include <udp_socket.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // older headers lack it, the kernel may not
+#endif
+
+struct BatchIO
+{
+    int socket;
+    int epoll_fd;
+    UringIO *uring; // NULL when using the socket backend
+
+    // datagrams of the last wait when using io_uring, in its buffers
+    UringDatagram uring_received[BATCH_IO_RECV_COUNT];
+    int send_results[BATCH_IO_SEND_COUNT];
+
+    // other fds that were readable during the last wait
+    int ready_fds[BATCH_IO_WATCH_COUNT];
+    size_t ready_count;
+    size_t watch_count;
+
+    // receive vectors, each message points at its own packet, address and
+    // space for the kernel's drop count
+    struct mmsghdr recv_msgs[BATCH_IO_RECV_COUNT];
+    struct iovec recv_iovecs[BATCH_IO_RECV_COUNT];
+    struct sockaddr recv_addrs[BATCH_IO_RECV_COUNT];
+    union
+    {
+        char buffer[UDP_SOCKET_CONTROL_SIZE];
+        size_t align; // of a cmsghdr
+    } recv_controls[BATCH_IO_RECV_COUNT];
+    Packet recv_packets[BATCH_IO_RECV_COUNT];
+    size_t recv_count;
+    u32 drop_count; // the kernel's count of drops when last read
+
+    // send vectors, filled by batch_io_send
+    struct mmsghdr send_msgs[BATCH_IO_SEND_COUNT];
+    struct iovec send_iovecs[BATCH_IO_SEND_COUNT];
+    struct sockaddr send_addrs[BATCH_IO_SEND_COUNT];
+    BroadcastBuffer *send_buffers[BATCH_IO_SEND_COUNT]; // NULL if not shared
+    size_t send_count;
+
+    // messages of a segmented flush, each covering a run of the send vectors
+    // and carrying the segment size as a control message
+    bool segmenting;
+    bool segmenting_supported;
+    struct mmsghdr segmented_msgs[BATCH_IO_SEND_COUNT];
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(u16))];
+        size_t align; // of a cmsghdr
+    } segment_controls[BATCH_IO_SEND_COUNT];
+
+    BatchIOStats stats;
+    BatchIOStats last_logged; // stats at the last batch_io_log_stats
+    bool send_error_logged;   // since the last batch_io_log_stats
+};
+
+BatchIO *create_batch_io(int socket, BatchIOBackend backend)
+{
+    BatchIO *io = calloc(1, sizeof(BatchIO));
+    if (io == NULL)
+    {
+        log_error("Failed to allocate batch io");
+        return NULL;
+    }
+    io->socket = socket;
+
+    // the receive vectors never change, so they are only set up once
+    for (size_t i = 0; i < BATCH_IO_RECV_COUNT; i++)
+    {
+        io->recv_iovecs[i] = (struct iovec){
+            .iov_base = &io->recv_packets[i],
+            .iov_len  = sizeof(io->recv_packets[i]),
+        };
+        io->recv_msgs[i].msg_hdr = (struct msghdr){
+            .msg_iov        = &io->recv_iovecs[i],
+            .msg_iovlen     = 1,
+            .msg_name       = &io->recv_addrs[i],
+            .msg_namelen    = sizeof(io->recv_addrs[i]),
+            .msg_control    = &io->recv_controls[i],
+            .msg_controllen = sizeof(io->recv_controls[i]),
+        };
+    }
+    for (size_t i = 0; i < BATCH_IO_SEND_COUNT; i++)
+    {
+        io->send_msgs[i].msg_hdr = (struct msghdr){
+            .msg_iov    = &io->send_iovecs[i],
+            .msg_iovlen = 1,
+            .msg_name   = &io->send_addrs[i],
+        };
+    }
+
+    io->epoll_fd = epoll_create1(0);
+    if (io->epoll_fd == -1)
+    {
+        log_error("Failed to create epoll instance");
+        free(io);
+        return NULL;
+    }
+    if (socket == -1)
+        return io;
+
+    // recvmmsg is used with MSG_DONTWAIT, but the socket is also made non
+    // blocking so a spurious wakeup can never stall the server
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags == -1 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        log_error("Failed to make server socket non blocking");
+        close(io->epoll_fd);
+        free(io);
+        return NULL;
+    }
+    if (backend == BATCH_IO_URING)
+    {
+        io->uring = create_uring_io(socket, sizeof(Packet));
+        if (io->uring == NULL)
+            log_warning("Falling back to the socket loop");
+    }
+    struct epoll_event event = {
+        .events  = EPOLLIN,
+        .data.fd = socket,
+    };
+    if (io->uring == NULL &&
+        epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, socket, &event) == -1)
+    {
+        log_error("Failed to add server socket to epoll");
+        close(io->epoll_fd);
+        free(io);
+        return NULL;
+    }
+
+    // the option is only read from each send's control message, setting it
+    // on the socket is just to learn if the kernel knows it
+    int segment = 0;
+    io->segmenting_supported =
+        setsockopt(socket, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) ==
+        0;
+    io->segmenting = io->segmenting_supported;
+
+    return io;
+}
+
+void destroy_batch_io(BatchIO *io)
+{
+    if (io == NULL)
+        return;
+    batch_io_flush(io);
+    destroy_uring_io(io->uring);
+    close(io->epoll_fd);
+    free(io);
+}
+
+Result batch_io_watch(BatchIO *io, int fd)
+{
+    if (io->watch_count == BATCH_IO_WATCH_COUNT)
+    {
+        log_error("Too many fds watched by batch io");
+        return RS_FAILURE;
+    }
+    if (io->uring != NULL)
+    {
+        io->watch_count++;
+        return uring_io_watch(io->uring, fd);
+    }
+    struct epoll_event event = {
+        .events  = EPOLLIN,
+        .data.fd = fd,
+    };
+    if (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+    {
+        log_error("Failed to add fd %i to epoll", fd);
+        return RS_FAILURE;
+    }
+    io->watch_count++;
+    return RS_SUCCESS;
+}
+
+bool batch_io_ready(const BatchIO *io, int fd)
+{
+    if (io->uring != NULL)
+        return uring_io_ready(io->uring, fd);
+    for (size_t i = 0; i < io->ready_count; i++)
+        if (io->ready_fds[i] == fd)
+            return true;
+    return false;
+}
+
+// add the drops the kernel counted since the last received datagram. The
+// count is the kernel's u32, which can wrap
+static void count_kernel_drops(BatchIO *io, const struct msghdr *msg)
+{
+    u32 drops = io->drop_count;
+    if (udp_socket_drops(msg, &drops) == false)
+        return;
+    io->stats.kernel_drops += (u32)(drops - io->drop_count);
+    io->drop_count = drops;
+}
+
+int batch_io_wait(BatchIO *io, int timeout_ms)
+{
+    io->recv_count  = 0;
+    io->ready_count = 0;
+
+    if (io->uring != NULL)
+    {
+        int count = uring_io_wait(
+            io->uring, timeout_ms, io->uring_received, BATCH_IO_RECV_COUNT);
+        if (count <= 0)
+            return count;
+        for (int i = 0; i < count; i++)
+        {
+            struct msghdr msg = {
+                .msg_control    = io->uring_received[i].control,
+                .msg_controllen = io->uring_received[i].control_len,
+            };
+            count_kernel_drops(io, &msg);
+        }
+        io->recv_count = count;
+        io->stats.wakeups++;
+        io->stats.datagrams_in += count;
+        io->stats.batch_sizes[count]++;
+        return count;
+    }
+
+    struct epoll_event events[BATCH_IO_WATCH_COUNT + 1];
+    int ready =
+        epoll_wait(io->epoll_fd, events, array_length(events), timeout_ms);
+    if (ready == -1)
+    {
+        if (errno == EINTR)
+            return 0;
+        log_error("Error waiting for server socket");
+        return -1;
+    }
+
+    bool socket_ready = false;
+    for (int i = 0; i < ready; i++)
+    {
+        if (events[i].data.fd == io->socket)
+            socket_ready = true;
+        else
+            io->ready_fds[io->ready_count++] = events[i].data.fd;
+    }
+    if (socket_ready == false)
+        return 0;
+
+    // recvmmsg overwrites the address and control lengths, so they must be
+    // reset
+    for (size_t i = 0; i < BATCH_IO_RECV_COUNT; i++)
+    {
+        struct msghdr *msg = &io->recv_msgs[i].msg_hdr;
+        msg->msg_namelen    = sizeof(io->recv_addrs[i]);
+        msg->msg_controllen = sizeof(io->recv_controls[i]);
+    }
+
+    int count = recvmmsg(
+        io->socket, io->recv_msgs, BATCH_IO_RECV_COUNT, MSG_DONTWAIT, NULL);
+    if (count == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+        log_warning("Error recieving packets");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+        count_kernel_drops(io, &io->recv_msgs[i].msg_hdr);
+    io->recv_count = count;
+    io->stats.wakeups++;
+    io->stats.datagrams_in += count;
+    io->stats.batch_sizes[count]++;
+    return count;
+}
+
+Packet *batch_io_received(
+    BatchIO *io,
+    size_t index,
+    size_t *length,
+    const struct sockaddr **addr,
+    socklen_t *addr_len)
+{
+    assert(index < io->recv_count);
+    if (io->uring != NULL)
+    {
+        const UringDatagram *d = &io->uring_received[index];
+        if (length)
+            *length = d->length;
+        if (addr)
+            *addr = d->addr;
+        if (addr_len)
+            *addr_len = d->addr_len;
+        return d->data;
+    }
+    if (length)
+        *length = io->recv_msgs[index].msg_len;
+    if (addr)
+        *addr = &io->recv_addrs[index];
+    if (addr_len)
+        *addr_len = io->recv_msgs[index].msg_hdr.msg_namelen;
+    return &io->recv_packets[index];
+}
+
+void batch_io_send(
+    BatchIO *io,
+    const void *data,
+    size_t length,
+    const struct sockaddr *addr,
+    socklen_t addr_len)
+{
+    if (io->send_count == BATCH_IO_SEND_COUNT)
+        batch_io_flush(io);
+
+    assert(addr_len <= sizeof(struct sockaddr));
+
+    size_t i           = io->send_count++;
+    io->send_iovecs[i] = (struct iovec){
+        .iov_base = (void *)data,
+        .iov_len  = length,
+    };
+    memcpy(&io->send_addrs[i], addr, addr_len);
+    io->send_msgs[i].msg_hdr.msg_namelen = addr_len;
+    io->send_buffers[i]                  = NULL;
+}
+
+void batch_io_send_buffer(
+    BatchIO *io,
+    BroadcastBuffer *buffer,
+    const struct sockaddr *addr,
+    socklen_t addr_len)
+{
+    batch_io_send(io, &buffer->packet, buffer->length, addr, addr_len);
+    io->send_buffers[io->send_count - 1] = buffer;
+    broadcast_retain(buffer);
+}
+
+// count datagrams that failed to send with error. Returns true if the
+// socket's buffer is full, which the rest of the batch would find too. Only
+// the first error between stats reports is logged, the rest are counted, so
+// an overloaded server does not also flood its log
+static bool send_failed(BatchIO *io, int error, size_t datagrams)
+{
+    io->stats.send_errors += datagrams;
+    bool full = error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS;
+    if (full == false && io->send_error_logged == false)
+    {
+        log_error("Local error sending packet batch: %s", strerror(error));
+        io->send_error_logged = true;
+    }
+    return full;
+}
+
+// send the queued datagrams from first on, one message each, skipping any
+// that fail. Stops if the socket's buffer fills up, dropping the rest.
+// Returns the number sent
+static size_t send_datagrams(BatchIO *io, size_t first)
+{
+    size_t sent = 0;
+    size_t at   = first;
+    while (at < io->send_count)
+    {
+        int count = sendmmsg(
+            io->socket, io->send_msgs + at, io->send_count - at, MSG_DONTWAIT);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (send_failed(io, errno, 1))
+            {
+                io->stats.send_errors += io->send_count - at - 1;
+                break;
+            }
+            // skip the datagram that failed and keep sending the rest
+            at++;
+            continue;
+        }
+        at += count;
+        sent += count;
+        io->stats.datagrams_out += count;
+    }
+    return sent;
+}
+
+static inline bool same_destination(const BatchIO *io, size_t a, size_t b)
+{
+    socklen_t length = io->send_msgs[a].msg_hdr.msg_namelen;
+    return length == io->send_msgs[b].msg_hdr.msg_namelen &&
+           memcmp(&io->send_addrs[a], &io->send_addrs[b], length) == 0;
+}
+
+// build a message for each run of queued datagrams that can be sent as one,
+// returns the number of messages
+static size_t build_segmented(BatchIO *io)
+{
+    size_t count = 0;
+    for (size_t start = 0; start < io->send_count; count++)
+    {
+        size_t segment = io->send_iovecs[start].iov_len;
+        size_t bytes   = segment;
+        size_t end     = start + 1;
+        while (end < io->send_count && end - start < BATCH_IO_MAX_SEGMENTS &&
+               io->send_iovecs[end].iov_len <= segment &&
+               bytes + io->send_iovecs[end].iov_len <=
+                   BATCH_IO_MAX_SEGMENTED_BYTES &&
+               same_destination(io, start, end))
+        {
+            bytes += io->send_iovecs[end].iov_len;
+            // only the last datagram of a run can be shorter
+            if (io->send_iovecs[end++].iov_len < segment)
+                break;
+        }
+
+        // the message points into the send vectors, nothing is copied
+        struct msghdr *h = &io->segmented_msgs[count].msg_hdr;
+        *h               = io->send_msgs[start].msg_hdr;
+        h->msg_iovlen    = end - start;
+        if (end - start > 1)
+        {
+            h->msg_control    = io->segment_controls[count].buffer;
+            h->msg_controllen = sizeof(io->segment_controls[count].buffer);
+            struct cmsghdr *c = CMSG_FIRSTHDR(h);
+            c->cmsg_level     = SOL_UDP;
+            c->cmsg_type      = UDP_SEGMENT;
+            c->cmsg_len       = CMSG_LEN(sizeof(u16));
+            u16 size          = segment;
+            memcpy(CMSG_DATA(c), &size, sizeof(size));
+        }
+        start = end;
+    }
+    return count;
+}
+
+// check if a segmented send failed because the kernel or the route cannot
+// segment, in which case segmenting is turned off for good
+static bool segmenting_failed(BatchIO *io, int error)
+{
+    if (error != EIO && error != EINVAL && error != EOPNOTSUPP &&
+        error != ENOPROTOOPT)
+        return false;
+    log_warning(
+        "UDP segmentation offload failed, sending datagrams one at a time");
+    io->segmenting           = false;
+    io->segmenting_supported = false;
+    return true;
+}
+
+// send the queued datagrams as runs, falling back to one at a time if the
+// kernel or the route turns out not to support segmentation. Stops like
+// send_datagrams when the socket's buffer fills up
+static size_t send_segmented(BatchIO *io)
+{
+    size_t count = build_segmented(io);
+    size_t sent  = 0;
+    size_t first = 0; // first datagram of the message at
+    size_t at    = 0;
+    while (at < count)
+    {
+        int sent_msgs = sendmmsg(
+            io->socket, io->segmented_msgs + at, count - at, MSG_DONTWAIT);
+        if (sent_msgs == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            size_t segments = io->segmented_msgs[at].msg_hdr.msg_iovlen;
+            if (segments > 1 && segmenting_failed(io, errno))
+                return sent + send_datagrams(io, first);
+            if (send_failed(io, errno, segments))
+            {
+                io->stats.send_errors += io->send_count - first - segments;
+                break;
+            }
+            first += segments;
+            at++;
+            continue;
+        }
+        for (int i = 0; i < sent_msgs; i++, at++)
+        {
+            size_t segments = io->segmented_msgs[at].msg_hdr.msg_iovlen;
+            if (segments > 1)
+                io->stats.segmented_out += segments;
+            io->stats.datagrams_out += segments;
+            sent += segments;
+            first += segments;
+        }
+    }
+    return sent;
+}
+
+// count the datagrams of a message sent by io_uring
+static size_t count_uring_send(BatchIO *io, const struct msghdr *h, int result)
+{
+    size_t segments = h->msg_iovlen;
+    if (result < 0)
+    {
+        send_failed(io, -result, segments);
+        return 0;
+    }
+    if (segments > 1)
+        io->stats.segmented_out += segments;
+    io->stats.datagrams_out += segments;
+    return segments;
+}
+
+// send the queued datagrams with io_uring, as runs when segmenting
+static size_t send_uring(BatchIO *io)
+{
+    struct mmsghdr *msgs = io->send_msgs;
+    size_t count         = io->send_count;
+    if (io->segmenting)
+    {
+        msgs  = io->segmented_msgs;
+        count = build_segmented(io);
+    }
+    uring_io_send(io->uring, msgs, count, io->send_results);
+
+    size_t sent  = 0;
+    size_t first = 0; // first datagram of message i
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct msghdr *h = &msgs[i].msg_hdr;
+        int result             = io->send_results[i];
+        if (h->msg_iovlen > 1 && result < 0 &&
+            segmenting_failed(io, -result))
+        {
+            // the run goes again a datagram at a time
+            int results[BATCH_IO_MAX_SEGMENTS];
+            uring_io_send(
+                io->uring, &io->send_msgs[first], h->msg_iovlen, results);
+            for (size_t j = 0; j < h->msg_iovlen; j++)
+                sent += count_uring_send(
+                    io, &io->send_msgs[first + j].msg_hdr, results[j]);
+        }
+        else
+        {
+            sent += count_uring_send(io, h, result);
+        }
+        first += h->msg_iovlen;
+    }
+    return sent;
+}
+
+size_t batch_io_flush(BatchIO *io)
+{
+    size_t sent;
+    if (io->socket == -1)
+    {
+        // replaying, every datagram counts as sent
+        sent = io->send_count;
+        io->stats.datagrams_out += sent;
+    }
+    else if (io->uring != NULL)
+        sent = send_uring(io);
+    else if (io->segmenting)
+        sent = send_segmented(io);
+    else
+        sent = send_datagrams(io, 0);
+
+    // the kernel has copied the datagrams, so shared buffers can be reused
+    for (size_t i = 0; i < io->send_count; i++)
+        if (io->send_buffers[i] != NULL)
+            broadcast_release(io->send_buffers[i]);
+    io->send_count = 0;
+    return sent;
+}
+
+BatchIOBackend batch_io_backend(const BatchIO *io)
+{
+    return io->uring != NULL ? BATCH_IO_URING : BATCH_IO_SOCKET;
+}
+
+bool batch_io_segmenting(const BatchIO *io) { return io->segmenting; }
+
+void batch_io_set_segmenting(BatchIO *io, bool enabled)
+{
+    io->segmenting = enabled && io->segmenting_supported;
+}
+
+const BatchIOStats *batch_io_stats(const BatchIO *io) { return &io->stats; }
+
+void batch_io_log_stats(BatchIO *io)
+{
+    const BatchIOStats *now  = &io->stats;
+    const BatchIOStats *last = &io->last_logged;
+
+    u64 wakeups   = now->wakeups - last->wakeups;
+    u64 datagrams = now->datagrams_in - last->datagrams_in;
+    if (wakeups == 0)
+        return; // nothing to report, prevent spam
+
+    // find the largest batch seen since the last report
+    size_t largest = 0;
+    for (size_t i = 0; i <= BATCH_IO_RECV_COUNT; i++)
+        if (now->batch_sizes[i] != last->batch_sizes[i])
+            largest = i;
+
+    log_info(
+        "Handled %lu datagrams in %lu wakeups (%.2f per wakeup, max %zu), "
+        "sent %lu (%lu segmented), %lu send errors, %lu dropped by the "
+        "kernel",
+        datagrams,
+        wakeups,
+        (f64)datagrams / wakeups,
+        largest,
+        now->datagrams_out - last->datagrams_out,
+        now->segmented_out - last->segmented_out,
+        now->send_errors - last->send_errors,
+        now->kernel_drops - last->kernel_drops);
+
+    io->last_logged       = *now;
+    io->send_error_logged = false;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+/*
+ * Batched socket io for the server. Incoming datagrams are drained from the
+ * socket with recvmmsg after epoll reports it readable, and outgoing
+ * datagrams are queued into a preallocated message vector which is sent
+ * with sendmmsg when flushed (or when the vector fills up).
+ *
+ * Where the kernel supports UDP segmentation offload, queued datagrams to the
+ * same address are handed to the kernel as a single message with the
+ * UDP_SEGMENT option, which splits them up again as late as possible, so
+ * most of the per datagram cost of the send path is paid once per run. A run
+ * is datagrams of one length, except the last which may be shorter. If a
+ * segmented send fails the offload is turned off for good and the datagrams
+ * are sent one by one.
+ *
+ * The socket loop above is the default. The server can instead be started
+ * with an io_uring backend, see uring_io.h, which is used the same way and
+ * falls back to the socket loop where io_uring is unavailable.
+ */
+
+#include "broadcast_pool.h"
+#include "packets.h"
+#include <sys/socket.h>
+
+// maximum number of datagrams read by a single wakeup
+#define BATCH_IO_RECV_COUNT 64
+// maximum number of datagrams queued before the send vector is flushed
+#define BATCH_IO_SEND_COUNT 1024
+// maximum number of other file descriptors which can wake the server
+#define BATCH_IO_WATCH_COUNT 4
+// most datagrams and bytes the kernel accepts in one segmented send
+#define BATCH_IO_MAX_SEGMENTS 64
+#define BATCH_IO_MAX_SEGMENTED_BYTES (UINT16_MAX - 20 - 8)
+
+typedef struct BatchIOStats
+{
+    u64 wakeups;
+    u64 datagrams_in;
+    u64 datagrams_out;
+    // datagrams that failed to send, including those dropped for a full
+    // send buffer
+    u64 send_errors;
+    // datagrams the kernel dropped for a full receive buffer, as counted
+    // when the last datagram was received
+    u64 kernel_drops;
+    u64 segmented_out; // datagrams sent in a segmented send with others
+    // number of wakeups which handled exactly n datagrams
+    u64 batch_sizes[BATCH_IO_RECV_COUNT + 1];
+} BatchIOStats;
+
+typedef enum BatchIOBackend
+{
+    BATCH_IO_SOCKET = 0, // epoll, recvmmsg and sendmmsg
+    BATCH_IO_URING,
+} BatchIOBackend;
+
+typedef struct BatchIO BatchIO;
+
+// create an io batch for a bound udp socket, the socket is made non blocking.
+// A socket of -1 gives an io that never receives and whose flushes drop the
+// queued datagrams, for replaying captures without the network
+BatchIO *create_batch_io(int socket, BatchIOBackend backend);
+void destroy_batch_io(BatchIO *io);
+
+// also wake batch_io_wait when fd becomes readable, such as a timer
+Result batch_io_watch(BatchIO *io, int fd);
+
+// wait up to timeout_ms for the socket or a watched fd to become readable,
+// then read as many datagrams as possible. Returns the number read, 0 on
+// timeout or when only a watched fd woke the server and -1 on error.
+// Received datagrams are valid until the next call
+int batch_io_wait(BatchIO *io, int timeout_ms);
+
+// check if a watched fd was readable during the last batch_io_wait
+bool batch_io_ready(const BatchIO *io, int fd);
+
+// get the datagram at index, and the address it was sent from
+NONULL(1)
+Packet *batch_io_received(
+    BatchIO *io,
+    size_t index,
+    size_t *length,
+    const struct sockaddr **addr,
+    socklen_t *addr_len);
+
+// queue a datagram to be sent. The data is not copied, so it must stay valid
+// until the queue is flushed. Received packets may be queued directly as they
+// are only invalidated by the next batch_io_wait
+NONULL(1, 2, 4)
+void batch_io_send(
+    BatchIO *io,
+    const void *data,
+    size_t length,
+    const struct sockaddr *addr,
+    socklen_t addr_len);
+
+// queue the packet of a broadcast buffer to be sent to one client. The
+// buffer is held until the queue is flushed, so the writer can release it
+// as soon as every client's send is queued
+NONULL(1, 2, 3)
+void batch_io_send_buffer(
+    BatchIO *io,
+    BroadcastBuffer *buffer,
+    const struct sockaddr *addr,
+    socklen_t addr_len);
+
+// send all queued datagrams, returns the number of datagrams sent. Once the
+// socket's send buffer is full the rest are dropped
+size_t batch_io_flush(BatchIO *io);
+
+// the backend in use, which is the socket loop if io_uring was asked for but
+// is unavailable
+BatchIOBackend batch_io_backend(const BatchIO *io);
+
+// check if queued datagrams to the same address are sent with segmentation
+// offload
+bool batch_io_segmenting(const BatchIO *io);
+// turn segmentation offload on or off, it stays off if the socket does not
+// support it. It is on by default when supported
+void batch_io_set_segmenting(BatchIO *io, bool enabled);
+
+const BatchIOStats *batch_io_stats(const BatchIO *io);
+
+// log the number of datagrams handled per wakeup since the last call
+void batch_io_log_stats(BatchIO *io);
@@ -0,0 +1,58 @@
+#include "broadcast_pool.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <messenger.h>
+
+Result create_broadcast_pool(BroadcastPool *p, size_t capacity)
+{
+    *p = (BroadcastPool){
+        .buffers    = malloc(capacity * sizeof(BroadcastBuffer)),
+        .free       = malloc(capacity * sizeof(BroadcastBuffer *)),
+        .free_count = capacity,
+        .capacity   = capacity,
+    };
+    if (p->buffers == NULL || p->free == NULL)
+    {
+        log_error("Failed to allocate broadcast buffers");
+        destroy_broadcast_pool(p);
+        return RS_FAILURE;
+    }
+    // handed out from the end, so the first buffers are used first
+    for (size_t i = 0; i < capacity; i++)
+        p->free[i] = &p->buffers[capacity - 1 - i];
+    return RS_SUCCESS;
+}
+
+void destroy_broadcast_pool(BroadcastPool *p)
+{
+    free(p->buffers);
+    free(p->free);
+    *p = (BroadcastPool){0};
+}
+
+BroadcastBuffer *
+broadcast_encode(BroadcastPool *p, const void *data, size_t length)
+{
+    assert(length <= sizeof(Packet));
+    if (p->free_count == 0)
+    {
+        p->exhausted++;
+        return NULL;
+    }
+    BroadcastBuffer *b = p->free[--p->free_count];
+    b->pool            = p;
+    b->refs            = 1;
+    b->length          = length;
+    memcpy(&b->packet, data, length);
+    return b;
+}
+
+void broadcast_release(BroadcastBuffer *b)
+{
+    assert(b->refs > 0);
+    if (--b->refs > 0)
+        return;
+    BroadcastPool *p         = b->pool;
+    p->free[p->free_count++] = b;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * Preallocated buffers for packets sent to many clients. A packet meant for
+ * every client in a room is written into a buffer once, and every send
+ * queued on the batch io points at that buffer instead of a copy, so
+ * telling a room about a kill costs one packet and a message slot per
+ * client. The buffer counts the sends still queued from it, and goes back
+ * to the pool when the last one is flushed.
+ *
+ * A pool belongs to one worker, so the counts are not atomic.
+ */
+
+#include "packets.h"
+
+typedef struct BroadcastPool BroadcastPool;
+
+typedef struct BroadcastBuffer
+{
+    BroadcastPool *pool;
+    u32 refs; // queued sends, and the writer's until it releases it
+    u32 length;
+    Packet packet;
+} BroadcastBuffer;
+
+struct BroadcastPool
+{
+    BroadcastBuffer *buffers;
+    BroadcastBuffer **free; // stack of the buffers not in use
+    size_t free_count;
+    size_t capacity;
+    u64 exhausted; // broadcasts that found every buffer in use
+};
+
+Result create_broadcast_pool(BroadcastPool *p, size_t capacity);
+void destroy_broadcast_pool(BroadcastPool *p);
+
+// take a buffer and write length bytes of data into it, holding the only
+// reference. Returns NULL if every buffer is in use
+NONULL(1, 2)
+BroadcastBuffer *
+broadcast_encode(BroadcastPool *p, const void *data, size_t length);
+
+static inline void broadcast_retain(BroadcastBuffer *b) { b->refs++; }
+
+// drop a reference, the buffer goes back to its pool with the last one
+NONULL(1) void broadcast_release(BroadcastBuffer *b);
@@ -0,0 +1,245 @@
+#include "capture.h"
+#include "packets.h"
+#include <assert.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <messenger.h>
+#include <utils.h>
+
+// most time a record waits in a buffer before it is written, in microseconds
+#define CAPTURE_FLUSH_INTERVAL SEC_TO_MICROSEC
+
+static_assert(sizeof(CaptureRecord) == 16);
+
+// bytes a record takes in a capture, with its datagram and padding
+static inline size_t record_size(const CaptureRecord *r)
+{
+    size_t size = sizeof(CaptureRecord);
+    if (r->type == CAPTURE_DATAGRAM)
+        size += (r->datagram.length + 3) & ~(size_t)3;
+    return size;
+}
+
+Result create_capture_file(
+    CaptureFile *f, const char *path, const CaptureHeader *header)
+{
+    // a capture only makes sense from the start of a server, so an old one
+    // in the same file is replaced rather than appended to
+    *f = (CaptureFile){
+        .file  = fopen(path, "w"),
+        .start = get_time(),
+    };
+    if (f->file == NULL)
+    {
+        log_error("Failed to open capture file %s", path);
+        return RS_FAILURE;
+    }
+    pthread_mutex_init(&f->lock, NULL);
+
+    CaptureHeader h = *header;
+    h.version       = CAPTURE_VERSION;
+    h.tick_rate     = SERVER_TICK_RATE;
+    h.start         = f->start;
+    memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+    if (fwrite(&h, sizeof(h), 1, f->file) != 1)
+    {
+        log_error("Failed to write capture file %s", path);
+        destroy_capture_file(f);
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+void destroy_capture_file(CaptureFile *f)
+{
+    if (f->file == NULL)
+        return;
+    fclose(f->file);
+    pthread_mutex_destroy(&f->lock);
+    *f = (CaptureFile){0};
+}
+
+Result create_capture_buffer(CaptureBuffer *b, CaptureFile *f, u8 worker)
+{
+    *b = (CaptureBuffer){
+        .file      = f,
+        .data      = malloc(CAPTURE_BUFFER_SIZE),
+        .worker    = worker,
+        .last_time = f->start,
+    };
+    if (b->data == NULL)
+    {
+        log_error("Failed to allocate capture buffer");
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+static void capture_flush(CaptureBuffer *b)
+{
+    if (b->used == 0)
+        return;
+    pthread_mutex_lock(&b->file->lock);
+    if (fwrite(b->data, b->used, 1, b->file->file) != 1)
+        log_warning("Failed to write capture, records are lost");
+    fflush(b->file->file);
+    pthread_mutex_unlock(&b->file->lock);
+    b->used = 0;
+}
+
+void destroy_capture_buffer(CaptureBuffer *b)
+{
+    if (b->data == NULL)
+        return;
+    capture_flush(b);
+    free(b->data);
+    *b = (CaptureBuffer){0};
+}
+
+// start a record at time, making room for it and its datagram
+static CaptureRecord *capture_begin(
+    CaptureBuffer *b, time_t time, CaptureRecordType type, size_t length)
+{
+    CaptureRecord header = {.type = type, .datagram.length = length};
+    size_t size          = record_size(&header);
+    if (b->used + size > CAPTURE_BUFFER_SIZE)
+        capture_flush(b);
+    if (b->used == 0)
+        b->first_time = time;
+
+    // time only goes backwards if the clock does, and stalls longer than the
+    // largest gap are not worth keeping
+    time_t gap = time > b->last_time ? time - b->last_time : 0;
+    if (gap > UINT32_MAX)
+        gap = UINT32_MAX;
+    b->last_time += gap;
+
+    CaptureRecord *r = (CaptureRecord *)&b->data[b->used];
+    memset(r, 0, size); // the padding too, so captures of equal input match
+    r->time   = gap;
+    r->type   = type;
+    r->worker = b->worker;
+    b->used += size;
+    return r;
+}
+
+void capture_datagram(
+    CaptureBuffer *b,
+    time_t time,
+    const struct sockaddr *addr,
+    socklen_t addr_len,
+    const void *data,
+    size_t length)
+{
+    if (addr->sa_family != AF_INET || addr_len < sizeof(struct sockaddr_in))
+        return;
+    assert(length <= sizeof(Packet));
+
+    const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+    CaptureRecord *r = capture_begin(b, time, CAPTURE_DATAGRAM, length);
+    r->datagram.address = in->sin_addr.s_addr;
+    r->datagram.port    = in->sin_port;
+    r->datagram.length  = length;
+    memcpy(r + 1, data, length);
+}
+
+void capture_tick(CaptureBuffer *b, time_t time, u64 first, u64 count)
+{
+    CaptureRecord *r = capture_begin(b, time, CAPTURE_TICK, 0);
+    r->tick.first    = first;
+    r->tick.count    = count;
+}
+
+void capture_maybe_flush(CaptureBuffer *b, time_t time)
+{
+    if (b->used > 0 && time - b->first_time >= CAPTURE_FLUSH_INTERVAL)
+        capture_flush(b);
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    // records of one worker are in order in the file and their times never
+    // go backwards, so ties keep their order in the file
+    const CaptureEvent *x = a;
+    const CaptureEvent *y = b;
+    if (x->time != y->time)
+        return (x->time > y->time) - (x->time < y->time);
+    return (x->record > y->record) - (x->record < y->record);
+}
+
+Result load_capture(Capture *c, const char *path)
+{
+    *c         = (Capture){0};
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        log_error("Failed to open capture %s", path);
+        return RS_FAILURE;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    const CaptureHeader *h = &c->header;
+    if (size < (long)sizeof(CaptureHeader) ||
+        fread(&c->header, sizeof(c->header), 1, file) != 1 ||
+        memcmp(h->magic, CAPTURE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CAPTURE_VERSION)
+    {
+        log_error("%s is not a capture this server can read", path);
+        fclose(file);
+        return RS_FAILURE;
+    }
+
+    size_t data_size = size - sizeof(CaptureHeader);
+    c->data          = malloc(data_size);
+    if (c->data == NULL || fread(c->data, data_size, 1, file) != 1)
+    {
+        log_error("Failed to read capture %s", path);
+        fclose(file);
+        destroy_capture(c);
+        return RS_FAILURE;
+    }
+    fclose(file);
+
+    // the file may end in the middle of a record if the server was killed
+    size_t count = 0;
+    for (size_t at = 0; at + sizeof(CaptureRecord) <= data_size; count++)
+    {
+        size_t next = at + record_size((const CaptureRecord *)&c->data[at]);
+        if (next > data_size)
+            break;
+        at = next;
+    }
+
+    c->events = malloc(count * sizeof(CaptureEvent));
+    if (c->events == NULL)
+    {
+        log_error("Failed to allocate capture %s", path);
+        destroy_capture(c);
+        return RS_FAILURE;
+    }
+    time_t worker_times[UINT8_MAX + 1] = {0};
+    size_t at                          = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const CaptureRecord *r = (const CaptureRecord *)&c->data[at];
+        worker_times[r->worker] += r->time;
+        c->events[i] = (CaptureEvent){
+            .time   = worker_times[r->worker],
+            .record = r,
+        };
+        at += record_size(r);
+    }
+    c->event_count = count;
+    qsort(c->events, count, sizeof(CaptureEvent), compare_events);
+    return RS_SUCCESS;
+}
+
+void destroy_capture(Capture *c)
+{
+    free(c->data);
+    free(c->events);
+    *c = (Capture){0};
+}
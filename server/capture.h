@@ -0,0 +1,144 @@
+#pragma once
+
+/*
+ * Recording of everything the server receives, so real match traffic can be
+ * replayed into the server without sockets for profiling and comparing
+ * builds on identical input. Besides every datagram, each tick is recorded,
+ * so a replay steps the world between the same datagrams as the original.
+ *
+ * A capture file is a CaptureHeader followed by records, each a
+ * CaptureRecord followed by the datagram for datagram records, padded so
+ * the next record is aligned. Every worker collects its records in its own
+ * buffer, which is appended to the file under a lock when it fills up or
+ * has waited a second, so workers never wait on the disk for a single
+ * datagram. Buffers of different workers are written in whatever order they
+ * fill, so record times count from the previous record of the same worker,
+ * and a capture is sorted by time when it is loaded.
+ */
+
+#include "snapshot_builder.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <types.h>
+
+#define CAPTURE_MAGIC "TPCAPTUR"
+#define CAPTURE_VERSION 4
+// bytes of records a worker collects before writing them to the file
+#define CAPTURE_BUFFER_SIZE (1 << 16)
+
+typedef enum CaptureRecordType
+{
+    CAPTURE_DATAGRAM = 0,
+    CAPTURE_TICK,
+} CaptureRecordType;
+
+typedef struct CaptureHeader
+{
+    char magic[8]; // CAPTURE_MAGIC, without a terminator
+    u32 version;
+    u32 tick_rate; // SERVER_TICK_RATE of the server that recorded it
+    // the config of the server that recorded it, which a replay must match
+    // to turn clients away and time them out the same
+    u32 workers;
+    u32 max_clients;
+    u32 max_rooms;
+    u32 room_size;
+    u32 idle_timeout;
+    u32 rate_limit;
+    SnapshotTiers tiers;
+    time_t start; // get_time() when the capture started
+} CaptureHeader;
+
+typedef struct CaptureRecord
+{
+    u32 time;  // microseconds since the worker's previous record
+    u8 type;   // CaptureRecordType
+    u8 worker; // worker that received the datagram or stepped
+    u16 reserved;
+    union
+    {
+        // followed by length bytes of the datagram
+        struct
+        {
+            u32 address; // sender's IPv4 address, in network byte order
+            u16 port;    // sender's port, in network byte order
+            u16 length;
+        } datagram;
+        struct
+        {
+            u32 first; // world tick of the first step
+            u32 count; // steps taken
+        } tick;
+    };
+} CaptureRecord;
+
+// a capture being written, shared by every worker
+typedef struct CaptureFile
+{
+    FILE *file;
+    pthread_mutex_t lock;
+    time_t start;
+} CaptureFile;
+
+// records of one worker waiting to be written
+typedef struct CaptureBuffer
+{
+    CaptureFile *file;
+    u8 *data; // CAPTURE_BUFFER_SIZE bytes
+    size_t used;
+    u8 worker;
+    time_t last_time;  // of the newest record
+    time_t first_time; // of the oldest record not yet written
+} CaptureBuffer;
+
+// a record of a loaded capture
+typedef struct CaptureEvent
+{
+    time_t time; // microseconds since the capture started
+    const CaptureRecord *record;
+} CaptureEvent;
+
+// a capture loaded for replay
+typedef struct Capture
+{
+    CaptureHeader header;
+    u8 *data;
+    CaptureEvent *events; // in the order they happened
+    size_t event_count;
+} Capture;
+
+// start a capture of a server with the config in header, replacing what is
+// in the file at path
+NONULL(1, 2, 3)
+Result create_capture_file(
+    CaptureFile *f, const char *path, const CaptureHeader *header);
+void destroy_capture_file(CaptureFile *f);
+
+Result create_capture_buffer(CaptureBuffer *b, CaptureFile *f, u8 worker);
+// write the remaining records and free the buffer
+void destroy_capture_buffer(CaptureBuffer *b);
+
+// record a datagram received at time. Senders that are not IPv4 are not
+// recorded, the server only listens on IPv4
+NONULL(1, 3, 5)
+void capture_datagram(
+    CaptureBuffer *b,
+    time_t time,
+    const struct sockaddr *addr,
+    socklen_t addr_len,
+    const void *data,
+    size_t length);
+
+// record that the world was stepped count ticks, starting with tick first
+NONULL(1)
+void capture_tick(CaptureBuffer *b, time_t time, u64 first, u64 count);
+
+// write the buffer to the file if it is full enough or old enough. Called
+// every tick, so records are written even when traffic stops
+NONULL(1) void capture_maybe_flush(CaptureBuffer *b, time_t time);
+
+// read a whole capture, so replaying it does not wait on the disk
+Result load_capture(Capture *c, const char *path);
+void destroy_capture(Capture *c);
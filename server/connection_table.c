@@ -0,0 +1,160 @@
+#include "connection_table.h"
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <messenger.h>
+
+// key of an address in the index. Udp over ipv4 addresses fit exactly,
+// anything else is hashed and has to be compared in full
+static u64 address_key(const struct sockaddr *addr, socklen_t addr_len)
+{
+    if (addr->sa_family == AF_INET && addr_len >= sizeof(struct sockaddr_in))
+    {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        return (u64)in->sin_addr.s_addr << 16 | in->sin_port;
+    }
+
+    // fnv-1a
+    u64 hash       = 0xcbf29ce484222325ull;
+    const u8 *byte = (const u8 *)addr;
+    for (socklen_t i = 0; i < addr_len; i++)
+        hash = (hash ^ byte[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+Result create_connection_table(
+    ConnectionTable *t, size_t capacity, u32 idle_timeout, size_t view_planes)
+{
+    *t = (ConnectionTable){
+        .connections  = malloc(capacity * sizeof(struct Connection)),
+        .snapshots    = malloc(capacity * sizeof(SnapshotClient)),
+        .view_planes  = view_planes,
+        .capacity     = capacity,
+        .idle_timeout = idle_timeout,
+    };
+    if (t->connections == NULL || t->snapshots == NULL ||
+        create_slot_index(&t->by_id, capacity) != RS_SUCCESS ||
+        create_slot_index(&t->by_addr, capacity) != RS_SUCCESS ||
+        create_timer_wheel(&t->idle, capacity, idle_timeout) != RS_SUCCESS)
+    {
+        log_error("Failed to allocate connection table");
+        destroy_connection_table(t);
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+void destroy_connection_table(ConnectionTable *t)
+{
+    for (size_t i = 0; i < t->count; i++)
+        free(t->snapshots[i].priorities);
+    free(t->connections);
+    free(t->snapshots);
+    destroy_slot_index(&t->by_id);
+    destroy_slot_index(&t->by_addr);
+    destroy_timer_wheel(&t->idle);
+    *t = (ConnectionTable){0};
+}
+
+struct Connection *connection_table_add(
+    ConnectionTable *t,
+    uid_t id,
+    const struct sockaddr *addr,
+    socklen_t addr_len,
+    u32 tick)
+{
+    if (t->count == t->capacity || addr_len > sizeof(struct sockaddr))
+        return NULL;
+
+    // only connected clients get priorities, a full table of them would be
+    // capacity times the planes of a whole room
+    SnapshotPriority *priorities =
+        calloc(t->view_planes, sizeof(SnapshotPriority));
+    if (priorities == NULL)
+    {
+        log_error("Failed to allocate snapshot priorities");
+        return NULL;
+    }
+
+    u32 i = t->count++;
+
+    t->connections[i] = (struct Connection){
+        .id              = id,
+        .client_addr_len = addr_len,
+        .last_seen       = tick,
+    };
+    struct Connection *c = &t->connections[i];
+    memcpy(&c->client_addr, addr, addr_len);
+    t->snapshots[i] = (SnapshotClient){.priorities = priorities};
+
+    slot_index_insert(&t->by_id, (u32)id, i);
+    slot_index_insert(&t->by_addr, address_key(addr, addr_len), i);
+    timer_wheel_add(&t->idle, i, tick + t->idle_timeout);
+    return c;
+}
+
+void connection_table_remove(ConnectionTable *t, uid_t id)
+{
+    struct Connection *c = connection_table_find(t, id);
+    if (c == NULL)
+        return;
+    u32 i = c - t->connections;
+    slot_index_remove(&t->by_id, (u32)id, i);
+    slot_index_remove(
+        &t->by_addr, address_key(&c->client_addr, c->client_addr_len), i);
+    timer_wheel_remove(&t->idle, i);
+    free(t->snapshots[i].priorities);
+
+    // keep the array dense by moving the last connection into the gap
+    u32 last = --t->count;
+    if (i == last)
+        return;
+    timer_wheel_move(&t->idle, last, i);
+    struct Connection *moved = &t->connections[last];
+    u64 addr_key = address_key(&moved->client_addr, moved->client_addr_len);
+    slot_index_move(&t->by_id, (u32)moved->id, last, i);
+    slot_index_move(&t->by_addr, addr_key, last, i);
+
+    *c              = *moved;
+    t->snapshots[i] = t->snapshots[last];
+}
+
+struct Connection *connection_table_find(ConnectionTable *t, uid_t id)
+{
+    u32 i = slot_index_find(&t->by_id, (u32)id);
+    return i == SLOT_NONE ? NULL : &t->connections[i];
+}
+
+struct Connection *connection_table_find_addr(
+    ConnectionTable *t, const struct sockaddr *addr, socklen_t addr_len)
+{
+    u64 key     = address_key(addr, addr_len);
+    size_t slot = slot_index_home(&t->by_addr, key);
+    for (; t->by_addr.values[slot] != SLOT_NONE;
+         slot = (slot + 1) & t->by_addr.mask)
+    {
+        if (t->by_addr.keys[slot] != key)
+            continue;
+        // hashed keys can collide
+        struct Connection *c = &t->connections[t->by_addr.values[slot]];
+        if (c->client_addr_len == addr_len &&
+            memcmp(&c->client_addr, addr, addr_len) == 0)
+            return c;
+    }
+    return NULL;
+}
+
+struct Connection *connection_table_next_idle(ConnectionTable *t, u32 tick)
+{
+    u32 i;
+    while (timer_wheel_pop(&t->idle, tick, &i))
+    {
+        // the client may have been heard from since the timer was set
+        struct Connection *c = &t->connections[i];
+        u32 deadline         = c->last_seen + t->idle_timeout;
+        if ((i32)(tick - deadline) >= 0)
+            return c;
+        timer_wheel_add(&t->idle, i, deadline);
+    }
+    return NULL;
+}
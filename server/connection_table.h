@@ -0,0 +1,92 @@
+#pragma once
+
+/*
+ * The clients connected to one server worker. Connections are stored in a
+ * dense array, so sending to every client walks contiguous memory, and are
+ * found in constant time by their uid or by the address their datagrams come
+ * from, through two open addressing indexes into the array. Removing a
+ * connection moves the last one into its place.
+ *
+ * The snapshot state of each client is large and only used while building
+ * its view, so it is kept in a parallel array instead of in the connection.
+ * The snapshot priorities of a client, one per plane it can be sent, are
+ * allocated when it connects and freed when it is removed.
+ *
+ * Clients that stop sending datagrams are found with a timer wheel. Hearing
+ * from a client only updates when it was last seen, and the timer of a
+ * client is only checked, and pushed back if it was heard from, once per
+ * idle timeout.
+ */
+
+#include "slot_index.h"
+#include "snapshot_builder.h"
+#include "timer_wheel.h"
+#include "token_bucket.h"
+#include <sys/socket.h>
+
+struct Connection
+{
+    uid_t id;
+    u32 room; // id of the room the client joined
+    struct sockaddr client_addr;
+    socklen_t client_addr_len;
+    u32 last_seen; // tick the last datagram from the client arrived
+    TokenBucket datagrams; // datagrams the client may still send now
+
+    SnapshotView view; // parts packed for this client on the last tick
+    u32 egress_next;   // parts of view sent, the rest wait to be paced out
+};
+
+typedef struct ConnectionTable
+{
+    struct Connection *connections;
+    SnapshotClient *snapshots; // snapshot state of each connection
+    size_t view_planes; // priorities allocated for each connection
+    size_t count;
+    size_t capacity;
+
+    SlotIndex by_id;   // uid to index in connections
+    SlotIndex by_addr; // address key to index, keys can collide
+
+    u32 idle_timeout; // ticks without a datagram before a client is idle
+    TimerWheel idle;  // one timer per connection, numbered by array index
+} ConnectionTable;
+
+// create a table of up to capacity connections, each of which can be sent
+// up to view_planes planes in its snapshots
+Result create_connection_table(
+    ConnectionTable *t, size_t capacity, u32 idle_timeout, size_t view_planes);
+void destroy_connection_table(ConnectionTable *t);
+
+// add a connection with a zeroed snapshot state, seen on tick. Returns NULL
+// if the table is full or its priorities can not be allocated. Pointers to
+// connections are invalidated by add and remove
+NONULL(1, 3)
+struct Connection *connection_table_add(
+    ConnectionTable *t,
+    uid_t id,
+    const struct sockaddr *addr,
+    socklen_t addr_len,
+    u32 tick);
+
+NONULL(1) void connection_table_remove(ConnectionTable *t, uid_t id);
+
+NONULL(1)
+struct Connection *connection_table_find(ConnectionTable *t, uid_t id);
+
+// find the connection datagrams from addr belong to
+NONULL(1, 2)
+struct Connection *connection_table_find_addr(
+    ConnectionTable *t, const struct sockaddr *addr, socklen_t addr_len);
+
+// find a connection that has not been seen for the idle timeout by tick,
+// returns NULL if there are none. The connection is no longer timed, so it
+// should be removed
+NONULL(1)
+struct Connection *connection_table_next_idle(ConnectionTable *t, u32 tick);
+
+static inline SnapshotClient *
+connection_snapshot(const ConnectionTable *t, const struct Connection *c)
+{
+    return &t->snapshots[c - t->connections];
+}
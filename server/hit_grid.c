@@ -0,0 +1,201 @@
+#include "hit_grid.h"
+#include <math.h>
+#include <stdlib.h>
+#include <messenger.h>
+
+static inline u32 hash_cell(const ivec2 c)
+{
+    return ((u32)c[0] * 73856093u) ^ ((u32)c[1] * 19349663u);
+}
+
+static inline void hit_cell_containing(const vec2 point, ivec2 dest)
+{
+    dest[0] = (i32)floorf(point[0] / HIT_CELL_SIZE);
+    dest[1] = (i32)floorf(point[1] / HIT_CELL_SIZE);
+}
+
+Result create_hit_grid(HitGrid *g, size_t max_planes)
+{
+    // every plane could be in its own cell, keep the table at most half full
+    size_t cell_capacity = 1;
+    while (cell_capacity < max_planes * 2)
+        cell_capacity <<= 1;
+
+    *g = (HitGrid){
+        .cells      = calloc(cell_capacity, sizeof(HitCell)),
+        .cell_mask  = cell_capacity - 1,
+        .next_plane = calloc(max_planes, sizeof(u32)),
+        .hit        = calloc(max_planes, sizeof(bool)),
+        .hits       = calloc(max_planes, sizeof(Hit)),
+    };
+    if (!g->cells || !g->next_plane || !g->hit || !g->hits)
+    {
+        log_error("Failed to allocate hit grid");
+        destroy_hit_grid(g);
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+void destroy_hit_grid(HitGrid *g)
+{
+    free(g->cells);
+    free(g->next_plane);
+    free(g->hit);
+    free(g->hits);
+    *g = (HitGrid){0};
+}
+
+// find a cell, adding it if it is not in use yet
+static HitCell *insert_cell(HitGrid *g, const ivec2 coordinate)
+{
+    for (size_t i = hash_cell(coordinate);; i++)
+    {
+        HitCell *c = &g->cells[i & g->cell_mask];
+        if (c->generation != g->generation)
+        {
+            *c = (HitCell){
+                .coordinate  = {coordinate[0], coordinate[1]},
+                .generation  = g->generation,
+                .first_plane = HIT_NONE,
+            };
+            return c;
+        }
+        if (c->coordinate[0] == coordinate[0] &&
+            c->coordinate[1] == coordinate[1])
+            return c;
+    }
+}
+
+// first plane in a cell, HIT_NONE if the cell is empty
+static u32 first_plane(const HitGrid *g, const ivec2 coordinate)
+{
+    for (size_t i = hash_cell(coordinate);; i++)
+    {
+        const HitCell *c = &g->cells[i & g->cell_mask];
+        if (c->generation != g->generation)
+            return HIT_NONE;
+        if (c->coordinate[0] == coordinate[0] &&
+            c->coordinate[1] == coordinate[1])
+            return c->first_plane;
+    }
+}
+
+// sort the planes this worker simulates into cells
+static void build_cells(HitGrid *g, const World *w)
+{
+    if (++g->generation == 0)
+        g->generation = 1;
+
+    g->local_count = 0;
+    for (u32 p = 0; p < w->plane_count; p++)
+    {
+        g->hit[p] = false;
+        if (w->planes[p].remote)
+            continue;
+
+        ivec2 coordinate;
+        hit_cell_containing(w->planes[p].plane.position, coordinate);
+        HitCell *cell     = insert_cell(g, coordinate);
+        g->next_plane[p]  = cell->first_plane;
+        cell->first_plane = p;
+        g->local_count++;
+    }
+}
+
+// where a plane was at time, or where it is now if it has no history
+static inline void
+plane_position_at(const World *w, u32 plane, time_t time, vec2 dest)
+{
+    if (plane_history_rewind(&w->history, plane, time, dest) == false)
+        glm_vec2_copy((f32 *)w->planes[plane].plane.position, dest);
+}
+
+// check if a bullet was near enough to a plane at time to hit it
+static inline bool can_hit(
+    const HitGrid *g,
+    const World *w,
+    const Bullet *b,
+    u32 shooter,
+    time_t time,
+    u32 plane)
+{
+    if (plane == shooter || g->hit[plane])
+        return false;
+    vec2 position;
+    plane_position_at(w, plane, time, position);
+    return glm_vec2_distance((f32 *)b->p, position) < BULLET_HIT_RADIUS;
+}
+
+// find a plane near enough to a bullet at time to be hit, HIT_NONE if there
+// is none. reach is how many cells away from the bullet's cell a plane that
+// was in range at time can be now
+static u32 find_victim(
+    const HitGrid *g,
+    const World *w,
+    const Bullet *b,
+    u32 shooter,
+    time_t time,
+    i32 reach)
+{
+    size_t cell_count = (size_t)(2 * reach + 1) * (2 * reach + 1);
+    if (cell_count > g->local_count)
+    {
+        for (u32 p = 0; p < w->plane_count; p++)
+            if (w->planes[p].remote == false &&
+                can_hit(g, w, b, shooter, time, p))
+                return p;
+        return HIT_NONE;
+    }
+
+    ivec2 center;
+    hit_cell_containing(b->p, center);
+    for (i32 dy = -reach; dy <= reach; dy++)
+    {
+        for (i32 dx = -reach; dx <= reach; dx++)
+        {
+            ivec2 coordinate = {center[0] + dx, center[1] + dy};
+            for (u32 p = first_plane(g, coordinate); p != HIT_NONE;
+                 p     = g->next_plane[p])
+            {
+                if (can_hit(g, w, b, shooter, time, p))
+                    return p;
+            }
+        }
+    }
+    return HIT_NONE;
+}
+
+void hit_grid_resolve(HitGrid *g, const World *w, time_t now)
+{
+    g->hit_count = 0;
+    build_cells(g, w);
+    if (g->local_count == 0)
+        return;
+
+    // every hit is on a different plane, so hits can not overflow
+    for (u32 shooter = 0; shooter < w->plane_count; shooter++)
+    {
+        const WorldPlane *p = &w->planes[shooter];
+        time_t time         = now - p->view_delay;
+        f32 travel          = plane_history_max_travel(&w->history, time);
+        i32 reach = (i32)ceilf((BULLET_HIT_RADIUS + travel) / HIT_CELL_SIZE);
+
+        for (u32 slot = 0; slot < MAX_BULLET_COUNT; slot++)
+        {
+            const Bullet *b = &p->plane.active_bullets[slot];
+            if (b->used == false)
+                continue;
+            u32 victim = find_victim(g, w, b, shooter, time, reach);
+            if (victim == HIT_NONE)
+                continue;
+
+            g->hit[victim]          = true;
+            g->hits[g->hit_count++] = (Hit){
+                .victim  = victim,
+                .shooter = shooter,
+                .slot    = slot,
+            };
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+/*
+ * Spatial hash for deciding which bullets hit which planes. Every tick the
+ * planes simulated by this worker are sorted into cells no smaller than the
+ * hit radius, then each bullet in the world only has to be checked against
+ * the planes in the cells around it, so the cost of a bullet depends on how
+ * many planes are near it instead of how many there are in total.
+ *
+ * Bullets are checked against where planes were when the shooter's client
+ * saw them, taken from the world's plane history. The cells hold where the
+ * planes are now, so the cells searched around a bullet grow by how far any
+ * plane could have moved since then. When that would search more cells
+ * than there are planes, every plane is checked instead.
+ *
+ * Like the area of interest grid, occupied cells live in an open addressing
+ * table that is emptied by bumping a generation, and the planes of a cell
+ * are linked through an index array, so resolving hits does not allocate.
+ */
+
+#include "world.h"
+
+// width and height of a cell, at least the hit radius so any plane a bullet
+// can hit is in the bullet's cell or one next to it
+#define HIT_CELL_SIZE (BULLET_HIT_RADIUS * 2)
+
+// end of a list of planes
+#define HIT_NONE UINT32_MAX
+
+typedef struct HitCell
+{
+    ivec2 coordinate;
+    u32 generation; // cell is only in use if this matches the grid
+    u32 first_plane;
+} HitCell;
+
+// a bullet that hit a plane, both given by their index in the world
+typedef struct Hit
+{
+    u32 victim;
+    u32 shooter;
+    u32 slot; // index in the shooter's active_bullets
+} Hit;
+
+typedef struct HitGrid
+{
+    HitCell *cells;
+    size_t cell_mask; // cell capacity - 1, capacity is a power of 2
+    u32 generation;
+
+    u32 *next_plane;    // next plane in the same cell, per world plane index
+    bool *hit;          // planes already hit this tick, per world plane index
+    size_t local_count; // planes in the cells
+
+    Hit *hits; // found by the last hit_grid_resolve
+    size_t hit_count;
+} HitGrid;
+
+Result create_hit_grid(HitGrid *g, size_t max_planes);
+void destroy_hit_grid(HitGrid *g);
+
+// find the bullets that hit the planes of the world that are not remote,
+// replacing the hits of the last call. now is the time of the newest record
+// in the world's history. A plane is hit at most once per call, a bullet
+// hits at most one plane and never the plane that fired it
+NONULL(1, 2) void hit_grid_resolve(HitGrid *g, const World *w, time_t now);
@@ -0,0 +1,226 @@
+#include "metrics.h"
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+const f64 METRICS_PERCENTILES[STATS_PERCENTILE_COUNT] = {
+    0.5, 0.9, 0.99, 0.999, 1.0,
+};
+
+// column names of the packet types in csv dumps
+static const char *const PACKET_TYPE_NAMES[PACKET_TYPE_COUNT + 1] = {
+    [PACKET_TYPE_EMPTY]         = "empty",
+    [PACKET_TYPE_CONNECITON]    = "connection",
+    [PACKET_TYPE_DISCONNECTION] = "disconnection",
+    [PACKET_TYPE_PLANE]         = "plane",
+    [PACKET_TYPE_INPUT]         = "input",
+    [PACKET_TYPE_SNAPSHOT]      = "snapshot",
+    [PACKET_TYPE_STATS]         = "stats",
+    [PACKET_TYPE_KILL]          = "kill",
+    [PACKET_TYPE_COUNT]         = "unknown",
+};
+
+u64 metrics_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (u64)t.tv_sec * 1000000000ull + (u64)t.tv_nsec;
+}
+
+static size_t histogram_bucket(u64 value)
+{
+    const u64 max = (1ull << HISTOGRAM_MAX_BITS) - 1;
+    if (value > max)
+        value = max;
+    if (value < (1ull << HISTOGRAM_SUB_BITS))
+        return value;
+
+    // keep the top HISTOGRAM_SUB_BITS bits of the value, the highest of
+    // which is always set
+    u32 shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BITS - 1);
+    return ((size_t)shift << (HISTOGRAM_SUB_BITS - 1)) + (value >> shift);
+}
+
+u64 histogram_bucket_value(size_t index)
+{
+    if (index < (1u << HISTOGRAM_SUB_BITS))
+        return index;
+    u32 shift    = (index >> (HISTOGRAM_SUB_BITS - 1)) - 1;
+    u64 mantissa = index - ((size_t)shift << (HISTOGRAM_SUB_BITS - 1));
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void histogram_record(Histogram *h, u64 value)
+{
+    metric_add(&h->counts[histogram_bucket(value)], 1);
+}
+
+u64 histogram_percentile(const u64 *counts, f64 fraction)
+{
+    u64 total = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += counts[i];
+    if (total == 0)
+        return 0;
+
+    // the rank of the value wanted, counting from 1
+    u64 rank = (u64)(fraction * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > total)
+        rank = total;
+
+    u64 seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            return histogram_bucket_value(i);
+    }
+    return histogram_bucket_value(HISTOGRAM_BUCKETS - 1);
+}
+
+void metrics_count(_Atomic u64 *packets, const void *data, size_t length)
+{
+    PacketType type = PACKET_TYPE_COUNT;
+    if (length >= sizeof(PacketType))
+        memcpy(&type, data, sizeof(type));
+    if ((u32)type > PACKET_TYPE_COUNT)
+        type = PACKET_TYPE_COUNT;
+    metric_add(&packets[type], 1);
+}
+
+static inline u64 metric_read(const _Atomic u64 *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void metrics_add_to(const Metrics *m, MetricsTotals *totals)
+{
+    totals->workers++;
+    for (size_t i = 0; i <= PACKET_TYPE_COUNT; i++)
+    {
+        totals->packets_in[i] += metric_read(&m->packets_in[i]);
+        totals->packets_out[i] += metric_read(&m->packets_out[i]);
+    }
+    totals->bytes_in += metric_read(&m->bytes_in);
+    totals->bytes_out += metric_read(&m->bytes_out);
+    totals->send_errors += metric_read(&m->send_errors);
+    totals->kernel_drops += metric_read(&m->kernel_drops);
+    totals->connections += metric_read(&m->connections);
+    totals->rate_limited += metric_read(&m->rate_limited);
+    totals->rejected += metric_read(&m->rejected);
+    totals->egress_dropped += metric_read(&m->egress_dropped);
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        totals->loop_latency[i] += metric_read(&m->loop_latency.counts[i]);
+        totals->tick_duration[i] += metric_read(&m->tick_duration.counts[i]);
+        totals->egress_depth[i] += metric_read(&m->egress_depth.counts[i]);
+    }
+}
+
+void metrics_fill_packet(const MetricsTotals *totals, struct StatsPacket *p)
+{
+    *p = (struct StatsPacket){
+        .type         = PACKET_TYPE_STATS,
+        .workers      = totals->workers,
+        .connections  = totals->connections,
+        .bytes_in     = totals->bytes_in,
+        .bytes_out    = totals->bytes_out,
+        .send_errors  = totals->send_errors,
+        .kernel_drops = totals->kernel_drops,
+    };
+    memcpy(p->packets_in, totals->packets_in, sizeof(p->packets_in));
+    memcpy(p->packets_out, totals->packets_out, sizeof(p->packets_out));
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+    {
+        f64 fraction = METRICS_PERCENTILES[i];
+        p->loop_latency[i] =
+            histogram_percentile(totals->loop_latency, fraction);
+        p->tick_duration[i] =
+            histogram_percentile(totals->tick_duration, fraction);
+    }
+}
+
+void metrics_write_csv_header(FILE *file)
+{
+    fprintf(file, "time,workers,connections");
+    for (size_t i = 0; i <= PACKET_TYPE_COUNT; i++)
+        fprintf(file, ",%s_in", PACKET_TYPE_NAMES[i]);
+    for (size_t i = 0; i <= PACKET_TYPE_COUNT; i++)
+        fprintf(file, ",%s_out", PACKET_TYPE_NAMES[i]);
+    fprintf(file, ",bytes_in,bytes_out,send_errors,kernel_drops");
+    fprintf(file, ",rate_limited,rejected,egress_dropped");
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+        fprintf(file, ",loop_p%g", METRICS_PERCENTILES[i] * 100);
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+        fprintf(file, ",tick_p%g", METRICS_PERCENTILES[i] * 100);
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+        fprintf(file, ",egress_p%g", METRICS_PERCENTILES[i] * 100);
+    fprintf(file, "\n");
+}
+
+void metrics_write_csv(
+    FILE *file,
+    const MetricsTotals *now,
+    const MetricsTotals *last,
+    f64 seconds)
+{
+    assert(seconds > 0);
+    fprintf(
+        file,
+        "%ld,%lu,%lu",
+        (long)time(NULL),
+        now->workers,
+        now->connections);
+
+    // counters as rates per second
+    for (size_t i = 0; i <= PACKET_TYPE_COUNT; i++)
+    {
+        u64 in = now->packets_in[i] - last->packets_in[i];
+        fprintf(file, ",%.1f", in / seconds);
+    }
+    for (size_t i = 0; i <= PACKET_TYPE_COUNT; i++)
+    {
+        u64 out = now->packets_out[i] - last->packets_out[i];
+        fprintf(file, ",%.1f", out / seconds);
+    }
+    fprintf(
+        file,
+        ",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f",
+        (now->bytes_in - last->bytes_in) / seconds,
+        (now->bytes_out - last->bytes_out) / seconds,
+        (now->send_errors - last->send_errors) / seconds,
+        (now->kernel_drops - last->kernel_drops) / seconds,
+        (now->rate_limited - last->rate_limited) / seconds,
+        (now->rejected - last->rejected) / seconds,
+        (now->egress_dropped - last->egress_dropped) / seconds);
+
+    // histograms only of what was recorded since the last row
+    u64 loop[HISTOGRAM_BUCKETS];
+    u64 tick[HISTOGRAM_BUCKETS];
+    u64 egress[HISTOGRAM_BUCKETS];
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        loop[i]   = now->loop_latency[i] - last->loop_latency[i];
+        tick[i]   = now->tick_duration[i] - last->tick_duration[i];
+        egress[i] = now->egress_depth[i] - last->egress_depth[i];
+    }
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+    {
+        u64 value = histogram_percentile(loop, METRICS_PERCENTILES[i]);
+        fprintf(file, ",%lu", value);
+    }
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+    {
+        u64 value = histogram_percentile(tick, METRICS_PERCENTILES[i]);
+        fprintf(file, ",%lu", value);
+    }
+    for (size_t i = 0; i < STATS_PERCENTILE_COUNT; i++)
+    {
+        u64 value = histogram_percentile(egress, METRICS_PERCENTILES[i]);
+        fprintf(file, ",%lu", value);
+    }
+    fprintf(file, "\n");
+    fflush(file);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+/*
+ * Counters of what a server worker is doing, for graphing its load. Every
+ * worker owns its metrics and is the only thread writing them, but any
+ * thread can read them at any time, so they are relaxed atomics which the
+ * owner updates with a plain load and store.
+ *
+ * Latencies are recorded in log linear histograms, like HdrHistogram: every
+ * power of two is split into the same number of buckets, so each bucket is
+ * within a few percent of the values in it whatever their size.
+ */
+
+#include "packets.h"
+#include <stdatomic.h>
+#include <stdio.h>
+
+// the values below 2^HISTOGRAM_SUB_BITS get a bucket each, and each power of
+// two above is split into 2^(HISTOGRAM_SUB_BITS - 1) buckets
+#define HISTOGRAM_SUB_BITS 5
+// values of 2^HISTOGRAM_MAX_BITS and above are put in the last bucket
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS \
+    ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) << (HISTOGRAM_SUB_BITS - 1))
+
+typedef struct Histogram
+{
+    _Atomic u64 counts[HISTOGRAM_BUCKETS];
+} Histogram;
+
+typedef struct Metrics
+{
+    // datagrams by packet type, with unknown types counted in the last
+    _Atomic u64 packets_in[PACKET_TYPE_COUNT + 1];
+    _Atomic u64 packets_out[PACKET_TYPE_COUNT + 1];
+    _Atomic u64 bytes_in;
+    _Atomic u64 bytes_out;
+    _Atomic u64 send_errors;
+    _Atomic u64 kernel_drops; // datagrams dropped for a full socket buffer
+    _Atomic u64 connections;
+    _Atomic u64 rate_limited; // datagrams dropped for coming too fast
+    // datagrams dropped for their sender or type, or for being cut short
+    _Atomic u64 rejected;
+    // snapshot datagrams still queued when the next tick replaced them
+    _Atomic u64 egress_dropped;
+
+    Histogram loop_latency;  // ns from a wakeup until the worker waits again
+    Histogram tick_duration; // ns spent simulating and sending a tick
+    // snapshot datagrams queued on the worker at each pacing slot
+    Histogram egress_depth;
+} Metrics;
+
+// the sum of the metrics of several workers at one time, without atomics
+typedef struct MetricsTotals
+{
+    u64 workers;
+    u64 packets_in[PACKET_TYPE_COUNT + 1];
+    u64 packets_out[PACKET_TYPE_COUNT + 1];
+    u64 bytes_in;
+    u64 bytes_out;
+    u64 send_errors;
+    u64 kernel_drops;
+    u64 connections;
+    u64 rate_limited;
+    u64 rejected;
+    u64 egress_dropped;
+    u64 loop_latency[HISTOGRAM_BUCKETS];
+    u64 tick_duration[HISTOGRAM_BUCKETS];
+    u64 egress_depth[HISTOGRAM_BUCKETS];
+} MetricsTotals;
+
+// the percentiles of each histogram in stats packets and dumps
+extern const f64 METRICS_PERCENTILES[STATS_PERCENTILE_COUNT];
+
+// counters only have one writer, so they can be updated without a locked
+// instruction
+static inline void metric_add(_Atomic u64 *counter, u64 value)
+{
+    u64 old = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, old + value, memory_order_relaxed);
+}
+
+static inline void metric_set(_Atomic u64 *counter, u64 value)
+{
+    atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+// nanoseconds on the monotonic clock, for measuring latencies
+u64 metrics_now(void);
+
+NONULL(1) void histogram_record(Histogram *h, u64 value);
+
+// the largest value of the bucket index covers
+u64 histogram_bucket_value(size_t index);
+
+// the value at or below which fraction of the counts fall, 0 if empty
+NONULL(1) u64 histogram_percentile(const u64 *counts, f64 fraction);
+
+// count a datagram by the type in its first bytes
+NONULL(1, 2)
+void metrics_count(_Atomic u64 *packets, const void *data, size_t length);
+
+// add the current metrics of a worker to totals
+NONULL(1, 2) void metrics_add_to(const Metrics *m, MetricsTotals *totals);
+
+// reply to a stats query with totals
+NONULL(1, 2)
+void metrics_fill_packet(const MetricsTotals *totals, struct StatsPacket *p);
+
+NONULL(1) void metrics_write_csv_header(FILE *file);
+
+// write one row of the rates and latencies between two totals seconds apart.
+// Percentiles are of the values recorded in between
+NONULL(1, 2, 3)
+void metrics_write_csv(
+    FILE *file,
+    const MetricsTotals *now,
+    const MetricsTotals *last,
+    f64 seconds);
@@ -0,0 +1,142 @@
+#include "plane_history.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <messenger.h>
+
+#define HISTORY_MASK (PLANE_HISTORY_TICKS - 1)
+
+static_assert((PLANE_HISTORY_TICKS & HISTORY_MASK) == 0);
+
+Result create_plane_history(PlaneHistory *h, size_t capacity)
+{
+    size_t positions = capacity * PLANE_HISTORY_TICKS;
+
+    *h = (PlaneHistory){
+        .capacity = capacity,
+        .x        = malloc(positions * sizeof(f32)),
+        .y        = malloc(positions * sizeof(f32)),
+        .last     = calloc(capacity, sizeof(u32)),
+        .depth    = calloc(capacity, sizeof(u32)),
+    };
+    if (!h->x || !h->y || !h->last || !h->depth)
+    {
+        log_error("Failed to allocate plane history");
+        destroy_plane_history(h);
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+void destroy_plane_history(PlaneHistory *h)
+{
+    free(h->x);
+    free(h->y);
+    free(h->last);
+    free(h->depth);
+    *h = (PlaneHistory){0};
+}
+
+void plane_history_push(PlaneHistory *h, time_t time)
+{
+    u32 slot       = h->count++ & HISTORY_MASK;
+    h->times[slot] = time;
+    h->steps[slot] = 0;
+}
+
+void plane_history_store(PlaneHistory *h, size_t plane, const vec2 position)
+{
+    u32 slot = (h->count - 1) & HISTORY_MASK;
+    f32 *x   = &h->x[plane * PLANE_HISTORY_TICKS];
+    f32 *y   = &h->y[plane * PLANE_HISTORY_TICKS];
+
+    if (h->depth[plane] == 0 || h->count - h->last[plane] > 1)
+    {
+        // the plane is new or missed a record, its history starts again
+        h->depth[plane] = 1;
+    }
+    else if (h->last[plane] != h->count)
+    {
+        u32 previous = (slot - 1) & HISTORY_MASK;
+        vec2 moved   = {position[0] - x[previous], position[1] - y[previous]};
+
+        h->steps[slot] = glm_max(h->steps[slot], glm_vec2_norm(moved));
+        if (h->depth[plane] < PLANE_HISTORY_TICKS)
+            h->depth[plane]++;
+    }
+    x[slot]        = position[0];
+    y[slot]        = position[1];
+    h->last[plane] = h->count;
+}
+
+void plane_history_clear(PlaneHistory *h, size_t plane)
+{
+    h->depth[plane] = 0;
+}
+
+void plane_history_move(PlaneHistory *h, size_t from, size_t to)
+{
+    size_t size   = PLANE_HISTORY_TICKS * sizeof(f32);
+    size_t source = from * PLANE_HISTORY_TICKS;
+    size_t target = to * PLANE_HISTORY_TICKS;
+    memcpy(&h->x[target], &h->x[source], size);
+    memcpy(&h->y[target], &h->y[source], size);
+    h->last[to]  = h->last[from];
+    h->depth[to] = h->depth[from];
+}
+
+bool plane_history_rewind(
+    const PlaneHistory *h, size_t plane, time_t time, vec2 dest)
+{
+    // records of planes that stopped being stored are overwritten in time
+    u32 age = h->count - h->last[plane];
+    if (h->depth[plane] == 0 || age >= PLANE_HISTORY_TICKS)
+        return false;
+    u32 depth = h->depth[plane];
+    if (depth > PLANE_HISTORY_TICKS - age)
+        depth = PLANE_HISTORY_TICKS - age;
+
+    const f32 *x = &h->x[plane * PLANE_HISTORY_TICKS];
+    const f32 *y = &h->y[plane * PLANE_HISTORY_TICKS];
+
+    // walk back from the newest record to the first one not after time
+    u32 newer = (h->last[plane] - 1) & HISTORY_MASK;
+    if (time >= h->times[newer])
+    {
+        dest[0] = x[newer];
+        dest[1] = y[newer];
+        return true;
+    }
+    for (u32 i = 1; i < depth; i++)
+    {
+        u32 older = (newer - 1) & HISTORY_MASK;
+        if (time >= h->times[older])
+        {
+            time_t span = h->times[newer] - h->times[older];
+            f32 t = span > 0 ? (f32)(time - h->times[older]) / span : 1.f;
+            dest[0] = glm_lerp(x[older], x[newer], t);
+            dest[1] = glm_lerp(y[older], y[newer], t);
+            return true;
+        }
+        newer = older;
+    }
+    dest[0] = x[newer];
+    dest[1] = y[newer];
+    return true;
+}
+
+f32 plane_history_max_travel(const PlaneHistory *h, time_t time)
+{
+    u32 records = h->count;
+    if (records > PLANE_HISTORY_TICKS)
+        records = PLANE_HISTORY_TICKS;
+    f32 travel = 0;
+    for (u32 i = 0; i < records; i++)
+    {
+        u32 slot = (h->count - 1 - i) & HISTORY_MASK;
+        if (h->times[slot] <= time)
+            break;
+        travel += h->steps[slot];
+    }
+    return travel;
+}
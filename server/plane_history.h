@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ * Where every plane of a world was on the last few ticks, so hits can be
+ * decided against where a target was when the shooter's client saw it
+ * rather than where it is now. Each record is stamped with the time sent in
+ * snapshots as their update_time, which clients report back as the time
+ * they are looking at, and positions between two records are interpolated.
+ *
+ * Positions are kept per plane, with the x and y coordinates of every record
+ * of a plane next to each other, so rewinding one plane reads two short runs
+ * of memory instead of one scattered value per tick.
+ */
+
+#include <types.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// records kept, a power of 2. About half a second at the server tick rate,
+// clients further behind are rewound only as far as the oldest record
+#define PLANE_HISTORY_TICKS 32
+
+typedef struct PlaneHistory
+{
+    size_t capacity;
+    u32 count; // records pushed, the newest is at (count - 1) % TICKS
+
+    time_t times[PLANE_HISTORY_TICKS];
+    // furthest any plane moved between the record before and each record
+    f32 steps[PLANE_HISTORY_TICKS];
+
+    // per plane, PLANE_HISTORY_TICKS of each coordinate
+    f32 *x;
+    f32 *y;
+    u32 *last;  // the count when the plane was last stored
+    u32 *depth; // records in a row that hold the plane, up to the last
+} PlaneHistory;
+
+Result create_plane_history(PlaneHistory *h, size_t capacity);
+void destroy_plane_history(PlaneHistory *h);
+
+// start a record of every plane at time, which must not be before the
+// previous record. Planes not stored in it lose their history
+NONULL(1) void plane_history_push(PlaneHistory *h, time_t time);
+
+// store where a plane is in the newest record
+NONULL(1, 3)
+void plane_history_store(PlaneHistory *h, size_t plane, const vec2 position);
+
+// forget a plane, for a new plane taking its index
+NONULL(1) void plane_history_clear(PlaneHistory *h, size_t plane);
+
+// renumber a plane to follow it when it moves in the world. The history of
+// the plane to is overwritten
+NONULL(1) void plane_history_move(PlaneHistory *h, size_t from, size_t to);
+
+// find where a plane was at time, interpolating between the records around
+// it. Times after the newest record give the newest position and times
+// before the oldest the oldest. Returns false if the plane has no records
+NONULL(1, 4)
+bool plane_history_rewind(
+    const PlaneHistory *h, size_t plane, time_t time, vec2 dest);
+
+// the furthest any plane can have moved from time to the newest record
+NONULL(1) f32 plane_history_max_travel(const PlaneHistory *h, time_t time);
@@ -0,0 +1,26 @@
+#include "room.h"
+#include <messenger.h>
+
+Result create_room(
+    Room *r, u32 id, size_t max_planes, u32 tick, const SnapshotTiers *tiers)
+{
+    *r = (Room){.id = id};
+    if (create_world(&r->world, max_planes) != RS_SUCCESS ||
+        create_hit_grid(&r->hit_grid, max_planes) != RS_SUCCESS ||
+        create_snapshot_builder(&r->snapshot, max_planes) != RS_SUCCESS)
+    {
+        log_error("Failed to allocate room %u", id);
+        destroy_room(r);
+        return RS_FAILURE;
+    }
+    r->world.tick     = tick;
+    r->snapshot.tiers = *tiers;
+    return RS_SUCCESS;
+}
+
+void destroy_room(Room *r)
+{
+    destroy_snapshot_builder(&r->snapshot);
+    destroy_hit_grid(&r->hit_grid);
+    destroy_world(&r->world);
+}
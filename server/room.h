@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * A match, with its own planes, hits and snapshots. Clients pick the room
+ * they join when they connect, and only ever see and fight the planes in
+ * the same room, so one server can run many small matches on one port.
+ *
+ * A room is spread over the workers like a single match is. Every worker
+ * with clients in the room has its own Room holding their planes and copies
+ * of the room's planes on the other workers, steps it on its own tick and
+ * sends its planes to the other workers. A worker only creates a room when
+ * the first of its clients joins and destroys it once the last one leaves,
+ * so empty rooms cost nothing, and the clients of a busy room are spread
+ * over every worker by their address.
+ */
+
+#include "hit_grid.h"
+#include "snapshot_builder.h"
+#include "world.h"
+
+typedef struct Room
+{
+    u32 id;
+    size_t client_count; // clients of the worker in the room
+    World world;
+    HitGrid hit_grid; // decides which of the worker's planes were shot
+    SnapshotBuilder snapshot;
+} Room;
+
+// create an empty room for up to max_planes planes, counting its ticks from
+// tick so it steps in time with the other rooms of the worker, and sending
+// planes to its clients as often as tiers says
+NONULL(1, 5)
+Result create_room(
+    Room *r, u32 id, size_t max_planes, u32 tick, const SnapshotTiers *tiers);
+void destroy_room(Room *r);
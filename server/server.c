@@ -1,175 +1,232 @@
 #include "packets.h"
-#include <assert.h>
+#include "shard.h"
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
 #include <unistd.h>
-#include <arpa/inet.h>
 #include <messenger.h>
 
-#include <sys/queue.h>
-
-// generate a uid for new clients
-uid_t gen_uid(void)
-{
-    static uid_t id = 99;
-    return id++;
-}
-
-struct Connection
-{
-    uid_t id;
-    struct sockaddr client_addr;
-    socklen_t client_addr_len;
-
-    LIST_ENTRY(Connection) data;
-};
-
 const short SERVER_PORT = 8080;
 const short MAX_CLIENTS = 256;
 
-int main();
+// the most worker threads the server can be started with
+#define MAX_WORKERS 64
+// seconds a client can go without sending anything before it is dropped
+#define DEFAULT_IDLE_TIMEOUT 10
+// rooms clients can pick from. A worker only allocates a room while it has
+// players in it, sized for the room size whatever the occupancy
+#define DEFAULT_MAX_ROOMS 1024
+// datagrams a second handled from a client, 4 times what the client sends
+#define DEFAULT_RATE_LIMIT (4 * SERVER_TICK_RATE)
+// seconds between the rows written to the metrics file
+#define METRICS_DUMP_INTERVAL 1
+
+int main(int argc, char **argv);
 void print_nonvoid_bullets(struct Bullet *bullets);
 
+// read update rate tiers written as radius:rate pairs, nearest first, and
+// the rate of planes beyond them, like 1:60,3:15,5
+static Result parse_tiers(SnapshotTiers *tiers, const char *text)
+{
+    *tiers = (SnapshotTiers){0};
+    while (true)
+    {
+        char *end;
+        u32 value = strtoul(text, &end, 10);
+        if (end == text)
+            return RS_FAILURE;
+        if (*end != ':')
+        {
+            tiers->far_rate = value;
+            if (*end != '\0' || tiers->count == 0 || value < SNAPSHOT_MIN_RATE)
+                return RS_FAILURE;
+            return RS_SUCCESS;
+        }
+        if (tiers->count == SNAPSHOT_MAX_TIERS ||
+            value > SNAPSHOT_MAX_TIER_RADIUS ||
+            (tiers->count > 0 &&
+             value <= tiers->tiers[tiers->count - 1].radius))
+            return RS_FAILURE;
+        SnapshotTier *tier = &tiers->tiers[tiers->count++];
+        tier->radius       = value;
+        text               = end + 1;
+        tier->rate         = strtoul(text, &end, 10);
+        if (end == text || *end != ',' || tier->rate < SNAPSHOT_MIN_RATE)
+            return RS_FAILURE;
+        text = end + 1;
+    }
+}
+
+// kept so the server can restart itself with the same options
+static int saved_argc;
+static char **saved_argv;
+
 void crash_handler(int)
 {
     // NOTE: this function causes massive memory leaks
     log_error("Auto restarting server after crash");
-    main();
+    main(saved_argc, saved_argv);
 }
 
-int main()
+int main(int argc, char **argv)
 {
     signal(SIGSEGV, crash_handler);
+    saved_argc = argc;
+    saved_argv = argv;
 
-    // list of connected clients
-    LIST_HEAD(ConnectionList, Connection) connection_list;
-    LIST_INIT(&connection_list);
-
-    size_t client_count = 0;
-
-    // start listening for connections
-    struct sockaddr_in server_addr = {
-        .sin_family      = AF_INET,
-        .sin_port        = htons(SERVER_PORT),
-        .sin_addr.s_addr = INADDR_ANY,
+    ShardConfig config = {
+        .workers      = 1,
+        .port         = SERVER_PORT,
+        .max_clients  = MAX_CLIENTS,
+        .max_rooms    = DEFAULT_MAX_ROOMS,
+        .idle_timeout = DEFAULT_IDLE_TIMEOUT * SERVER_TICK_RATE,
+        .rate_limit   = DEFAULT_RATE_LIMIT,
     };
-    int server_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    assert(server_socket != -1);
-    // TODO error check
-    if (bind(
-            server_socket,
-            (struct sockaddr *)&server_addr,
-            sizeof(server_addr)) == -1)
-    {
-        log_error("Failed to bind server socket");
-        return 1;
-    }
-    // upon new connections assign id
-    for (;;)
+
+    // -w sets the number of worker threads, each with its own socket, -t
+    // the seconds of silence before a client is dropped, -c the most clients
+    // at once, -n the number of rooms, -s the most clients in one room, -m a
+    // csv file the metrics are appended to every second, -r a file every
+    // received datagram is recorded to, for replaying, -u uses io_uring
+    // instead of the socket loop, -l the datagrams a second handled from
+    // each client, 0 for no limit, -f how often clients are sent planes by
+    // how many cells away they are, as radius:rate tiers and a far rate, and
+    // -i and -o the bytes of kernel buffer for each worker's incoming and
+    // outgoing datagrams
+    const char *metrics_path = NULL;
+    int option;
+    optind = 1;
+    while ((option = getopt(argc, argv, "w:t:c:n:s:m:r:ul:f:i:o:")) != -1)
     {
-        struct sockaddr client_addr;
-        socklen_t client_addr_size = sizeof(client_addr);
-        Packet recieved_packet;
-        if (recvfrom(
-                server_socket,
-                &recieved_packet,
-                sizeof(recieved_packet),
-                0,
-                &client_addr,
-                &client_addr_size) < 0)
-        {
-            log_warning("Error recieving packet");
-            continue;
-        }
-        struct Connection *c; // store the connection node when relevant
-        switch (recieved_packet.type)
+        switch (option)
         {
-        case PACKET_TYPE_EMPTY:
-            // send same packet back
-            sendto(
-                server_socket,
-                &recieved_packet,
-                sizeof(recieved_packet),
-                0,
-                &client_addr,
-                client_addr_size);
+        case 'w':
+            config.workers = strtoul(optarg, NULL, 10);
+            if (config.workers == 0 || config.workers > MAX_WORKERS)
+            {
+                log_error("Worker count must be between 1 and %i", MAX_WORKERS);
+                return 1;
+            }
+            break;
+        case 't':
+            config.idle_timeout = strtoul(optarg, NULL, 10) * SERVER_TICK_RATE;
+            if (config.idle_timeout == 0)
+            {
+                log_error("Idle timeout must be at least a second");
+                return 1;
+            }
             break;
-        case PACKET_TYPE_CONNECITON:
-            if (client_count >= MAX_CLIENTS)
+        case 'c':
+            config.max_clients = strtoul(optarg, NULL, 10);
+            if (config.max_clients == 0)
             {
-                log_warning("Connection denied, too many players");
-                break;
+                log_error("At least one client must be allowed");
+                return 1;
             }
-            log_info("New connection");
-            // send back uid
+            break;
+        case 'n':
+            config.max_rooms = strtoul(optarg, NULL, 10);
+            if (config.max_rooms == 0 || config.max_rooms > UINT32_MAX)
             {
-                struct ConnectionPacket cpack = {
-                    .return_uid = gen_uid(),
-                    .type       = PACKET_TYPE_CONNECITON,
-                };
-                sendto(
-                    server_socket,
-                    &cpack,
-                    sizeof(cpack),
-                    0,
-                    &client_addr,
-                    client_addr_size);
-                // add new client node
-                struct Connection *new_node = malloc(sizeof(struct Connection));
-                assert(new_node);
-                *new_node = (struct Connection){
-                    .client_addr     = client_addr,
-                    .client_addr_len = client_addr_size,
-                    .id              = cpack.return_uid,
-                };
-                LIST_INSERT_HEAD(&connection_list, new_node, data);
-                client_count++;
+                log_error("Room count must be at least 1");
+                return 1;
             }
             break;
-        case PACKET_TYPE_DISCONNECTION:
-            log_info("A client has disconnected");
-            // send disconnect and id to all clients
-            // and delete the node when encountered
-            struct Connection *removed = NULL;
-            LIST_FOREACH(c, &connection_list, data)
+        case 's':
+            config.room_size = strtoul(optarg, NULL, 10);
+            if (config.room_size == 0)
             {
-                if (c->id == recieved_packet.disconnect_packet.id)
-                {
-                    removed = c; // set so it can be removed after loop
-                }
-                sendto(
-                    server_socket,
-                    &recieved_packet,
-                    sizeof(recieved_packet),
-                    0,
-                    &c->client_addr,
-                    c->client_addr_len);
+                log_error("At least one client must fit in a room");
+                return 1;
             }
-            LIST_REMOVE(removed, data);
-            if (removed)
-                free(removed);
-            client_count--;
             break;
-        case PACKET_TYPE_PLANE:
-            // update all clients with plane info
-            LIST_FOREACH(c, &connection_list, data)
+        case 'm':
+            metrics_path = optarg;
+            break;
+        case 'r':
+            config.capture_path = optarg;
+            break;
+        case 'u':
+            config.backend = BATCH_IO_URING;
+            break;
+        case 'l':
+            config.rate_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            if (parse_tiers(&config.tiers, optarg) != RS_SUCCESS)
             {
-                // debug bulet list not empty
-                if (sendto(
-                        server_socket,
-                        &recieved_packet,
-                        sizeof(recieved_packet),
-                        0,
-                        &c->client_addr,
-                        c->client_addr_len) == -1)
-                    log_error("Local error sending plane packet");
+                log_error(
+                    "Update tiers must be up to %i radius:rate pairs with "
+                    "growing radii of at most %i, then a far rate, like "
+                    "1:60,3:15,5. Every rate must be at least %i",
+                    SNAPSHOT_MAX_TIERS,
+                    SNAPSHOT_MAX_TIER_RADIUS,
+                    SNAPSHOT_MIN_RATE);
+                return 1;
             }
             break;
+        case 'i':
+            config.receive_buffer = strtol(optarg, NULL, 10);
+            break;
+        case 'o':
+            config.send_buffer = strtol(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(
+                stderr,
+                "usage: %s [-w workers] [-t timeout] [-c max clients] "
+                "[-n rooms] [-s room size] [-m metrics.csv] [-r capture] "
+                "[-u] [-l rate limit] [-f update tiers] [-i receive buffer] "
+                "[-o send buffer]\n",
+                argv[0]);
+            return 1;
         }
     }
+
+    FILE *metrics_file = NULL;
+    if (metrics_path != NULL)
+    {
+        metrics_file = fopen(metrics_path, "a");
+        if (metrics_file == NULL)
+        {
+            log_error("Failed to open metrics file %s", metrics_path);
+            return 1;
+        }
+        // a file being appended to already has its header
+        fseek(metrics_file, 0, SEEK_END);
+        if (ftell(metrics_file) == 0)
+            metrics_write_csv_header(metrics_file);
+    }
+
+    ShardGroup server;
+    if (create_shard_group(&server, &config) != RS_SUCCESS ||
+        shard_group_start(&server) != RS_SUCCESS)
+    {
+        log_error("Failed to start server");
+        return 1;
+    }
+    log_info(
+        "Server running with %zu workers on %s",
+        config.workers,
+        batch_io_backend(server.shards[0].io) == BATCH_IO_URING
+            ? "io_uring"
+            : "sockets");
+
+    // the workers run until the process is killed, meanwhile the main
+    // thread dumps their metrics so file writes never stall a tick
+    MetricsTotals last = {0};
+    while (metrics_file != NULL)
+    {
+        sleep(METRICS_DUMP_INTERVAL);
+        MetricsTotals now = {0};
+        shard_group_metrics(&server, &now);
+        metrics_write_csv(metrics_file, &now, &last, METRICS_DUMP_INTERVAL);
+        last = now;
+    }
+    shard_group_wait(&server);
+    destroy_shard_group(&server);
+    return 0;
 }
 
 void print_nonvoid_bullets(struct Bullet *bullets)
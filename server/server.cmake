@@ -1,5 +1,9 @@
 set(SERVER_NAME ${PROJECT_NAME}_server)
 
-add_executable(${SERVER_NAME} ${CMAKE_CURRENT_LIST_DIR}/server.c)
+file(GLOB SERVER_SOURCES ${CMAKE_CURRENT_LIST_DIR}/*.c)
 
-target_link_libraries(${SERVER_NAME} PRIVATE ${SHARED_NAME} cutils)
+add_executable(${SERVER_NAME} ${SERVER_SOURCES})
+
+find_package(Threads REQUIRED)
+
+target_link_libraries(${SERVER_NAME} PRIVATE ${SHARED_NAME} cutils Threads::Threads)
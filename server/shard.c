@@ -0,0 +1,1150 @@
+#include "shard.h"
+#include "snapshot.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <messenger.h>
+#include <udp_socket.h>
+#include <utils.h>
+
+typedef enum ShardMessageType
+{
+    SHARD_MESSAGE_PLANE = 0,
+    SHARD_MESSAGE_REMOVE, // the plane's client has disconnected
+    SHARD_MESSAGE_KILL,   // a bullet hit a plane of the sending worker
+} ShardMessageType;
+
+typedef struct ShardBullet
+{
+    u32 slot;
+    Bullet bullet;
+    FireEvent fired;
+} ShardBullet;
+
+// the state of a plane sent from its worker to the others, with only the
+// parts needed to send it to clients
+typedef struct ShardMessage
+{
+    ShardMessageType type;
+    uid_t id;
+    u32 room;
+
+    int plane_type;
+    vec2 position;
+    f32 heading;
+    f32 speed;
+    time_t view_delay;
+    u32 bullet_count;
+    struct KillPacket kill; // SHARD_MESSAGE_KILL only
+    ShardBullet bullets[];
+} ShardMessage;
+
+// datagrams a sender limited to rate a second can send at once
+static inline u32 rate_burst(u32 rate) { return rate > 4 ? rate / 4 : 1; }
+
+// generate a uid for new clients, unique across all workers
+static uid_t gen_uid(void)
+{
+    static atomic_int id = 99;
+    return atomic_fetch_add(&id, 1);
+}
+
+static inline ShardQueue *
+shard_queue(const ShardGroup *g, size_t from, size_t to)
+{
+    return &g->queues[from * g->shard_count + to];
+}
+
+// open the worker's socket, sharing the port with the other workers
+static Result open_shard_socket(Shard *s, u16 port, bool reuse_port)
+{
+    struct sockaddr_in server_addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(port),
+        .sin_addr.s_addr = INADDR_ANY,
+    };
+    s->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s->socket == -1)
+    {
+        log_error("Failed to create server socket");
+        return RS_FAILURE;
+    }
+    // every worker binds the same port, the kernel then picks the socket
+    // of each datagram by the address it came from
+    const int enable     = 1;
+    const socklen_t size = sizeof(enable);
+    if (reuse_port &&
+        setsockopt(s->socket, SOL_SOCKET, SO_REUSEPORT, &enable, size) == -1)
+    {
+        log_error("Failed to share the server port between workers");
+        return RS_FAILURE;
+    }
+    if (bind(
+            s->socket,
+            (struct sockaddr *)&server_addr,
+            sizeof(server_addr)) == -1)
+    {
+        log_error("Failed to bind server socket");
+        return RS_FAILURE;
+    }
+
+    // larger buffers ride out bursts, and what the kernel still drops is
+    // counted in the worker's metrics
+    const ShardConfig *c = &s->group->config;
+    if (udp_socket_set_buffers(s->socket, c->receive_buffer, c->send_buffer) !=
+        RS_SUCCESS)
+        log_warning("Failed to set the server socket buffers");
+    if (udp_socket_count_drops(s->socket) != RS_SUCCESS)
+        log_warning("Datagrams dropped by the kernel will not be counted");
+    if (s->index == 0)
+    {
+        int receive, send;
+        udp_socket_buffers(s->socket, &receive, &send);
+        log_info(
+            "Socket buffers of %i bytes for receiving and %i for sending",
+            receive,
+            send);
+    }
+    return RS_SUCCESS;
+}
+
+// start the worker's tick and pacing timers and wake it with them. The
+// pacing timer fires in the middle of each slot, so it never races the tick.
+// Offline workers have no timers, they are stepped by shard_advance and send
+// every snapshot at once
+static Result
+start_shard_timer(Shard *s, bool offline, const struct timespec *start)
+{
+    if (offline)
+    {
+        s->tick_timer = (TickTimer){
+            .fd    = -1,
+            .rate  = SERVER_TICK_RATE,
+            .delta = 1.f / SERVER_TICK_RATE,
+        };
+        return RS_SUCCESS;
+    }
+    u32 pace_rate              = SERVER_TICK_RATE * SHARD_PACE_SLOTS;
+    struct timespec pace_start = *start;
+    pace_start.tv_nsec += 1000000000L / pace_rate / 2;
+    if (pace_start.tv_nsec >= 1000000000L)
+    {
+        pace_start.tv_sec++;
+        pace_start.tv_nsec -= 1000000000L;
+    }
+    if (create_tick_timer(&s->tick_timer, SERVER_TICK_RATE, start) !=
+            RS_SUCCESS ||
+        create_tick_timer(&s->pace_timer, pace_rate, &pace_start) !=
+            RS_SUCCESS ||
+        batch_io_watch(s->io, s->tick_timer.fd) != RS_SUCCESS)
+        return RS_FAILURE;
+    return batch_io_watch(s->io, s->pace_timer.fd);
+}
+
+Result create_shard_group(ShardGroup *g, const ShardConfig *config)
+{
+    assert(config->workers > 0);
+    size_t worker_count = config->workers;
+    size_t max_clients  = config->max_clients;
+    u16 port            = config->port;
+    size_t queue_count  = worker_count * worker_count;
+
+    *g = (ShardGroup){
+        .config      = *config,
+        .shards      = calloc(worker_count, sizeof(Shard)),
+        .shard_count = worker_count,
+        .queues      = aligned_alloc(64, queue_count * sizeof(ShardQueue)),
+    };
+    ShardConfig *c = &g->config;
+    if (c->max_rooms == 0)
+        c->max_rooms = 1;
+    if (c->room_size == 0)
+        c->room_size = SHARD_DEFAULT_ROOM_SIZE;
+    if (c->tiers.count == 0)
+        c->tiers = SNAPSHOT_DEFAULT_TIERS;
+    g->room_clients = calloc(c->max_rooms, sizeof(atomic_size_t));
+    atomic_init(&g->running, false);
+    atomic_init(&g->client_count, 0);
+    if (g->shards == NULL || g->queues == NULL || g->room_clients == NULL)
+    {
+        log_error("Failed to allocate server workers");
+        free(g->shards);
+        free(g->queues);
+        free(g->room_clients);
+        return RS_FAILURE;
+    }
+    memset(g->queues, 0, queue_count * sizeof(ShardQueue));
+    // full since time 0, so a replay starts it the same as the recording
+    u32 stranger_rate = config->rate_limit * SHARD_STRANGER_CLIENTS;
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        g->shards[i] = (Shard){
+            .group         = g,
+            .index         = i,
+            .socket        = -1,
+            .tick_timer.fd = -1,
+            .pace_timer.fd = -1,
+            .strangers     = token_bucket_full(rate_burst(stranger_rate), 0),
+        };
+    }
+
+    // every timer starts on the same tick
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    start.tv_nsec += 1000000000L / SERVER_TICK_RATE;
+    if (start.tv_nsec >= 1000000000L)
+    {
+        start.tv_sec++;
+        start.tv_nsec -= 1000000000L;
+    }
+
+    CaptureHeader capture = {
+        .workers      = worker_count,
+        .max_clients  = max_clients,
+        .max_rooms    = c->max_rooms,
+        .room_size    = c->room_size,
+        .idle_timeout = config->idle_timeout,
+        .rate_limit   = config->rate_limit,
+        .tiers        = c->tiers,
+    };
+    if (config->capture_path != NULL &&
+        create_capture_file(&g->capture, config->capture_path, &capture) !=
+            RS_SUCCESS)
+    {
+        destroy_shard_group(g);
+        return RS_FAILURE;
+    }
+
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        Shard *s = &g->shards[i];
+        if (config->offline == false)
+        {
+            if (open_shard_socket(s, port, worker_count > 1) != RS_SUCCESS)
+            {
+                destroy_shard_group(g);
+                return RS_FAILURE;
+            }
+            if (port == 0)
+            {
+                // the other workers share the port the first one was given
+                struct sockaddr_in addr;
+                socklen_t addr_len = sizeof(addr);
+                getsockname(s->socket, (struct sockaddr *)&addr, &addr_len);
+                port = ntohs(addr.sin_port);
+            }
+        }
+
+        s->io         = create_batch_io(s->socket, config->backend);
+        s->rooms      = calloc(c->max_rooms, sizeof(Room *));
+        s->open_rooms = malloc(c->max_rooms * sizeof(u32));
+        if (s->io == NULL || s->rooms == NULL || s->open_rooms == NULL ||
+            create_broadcast_pool(&s->broadcasts, SHARD_BROADCAST_BUFFERS) !=
+                RS_SUCCESS ||
+            create_connection_table(
+                &s->connections,
+                max_clients,
+                config->idle_timeout,
+                c->room_size) != RS_SUCCESS ||
+            start_shard_timer(s, config->offline, &start) != RS_SUCCESS ||
+            (config->capture_path != NULL &&
+             create_capture_buffer(&s->capture, &g->capture, i) !=
+                 RS_SUCCESS))
+        {
+            log_error("Failed to start server simulation");
+            destroy_shard_group(g);
+            return RS_FAILURE;
+        }
+
+        for (size_t to = 0; to < worker_count; to++)
+        {
+            if (to == i)
+                continue;
+            ShardQueue *q = shard_queue(g, i, to);
+            if (create_shard_queue(q, SHARD_QUEUE_SIZE) != RS_SUCCESS)
+            {
+                destroy_shard_group(g);
+                return RS_FAILURE;
+            }
+        }
+    }
+    g->config.port = port;
+    return RS_SUCCESS;
+}
+
+void destroy_shard_group(ShardGroup *g)
+{
+    for (size_t i = 0; i < g->shard_count; i++)
+    {
+        Shard *s = &g->shards[i];
+        destroy_connection_table(&s->connections);
+        destroy_batch_io(s->io); // releases the queued broadcasts
+        destroy_broadcast_pool(&s->broadcasts);
+        if (s->socket != -1)
+            close(s->socket);
+        destroy_tick_timer(&s->tick_timer);
+        destroy_tick_timer(&s->pace_timer);
+        for (size_t r = 0; r < s->open_room_count; r++)
+        {
+            destroy_room(s->rooms[s->open_rooms[r]]);
+            free(s->rooms[s->open_rooms[r]]);
+        }
+        free(s->rooms);
+        free(s->open_rooms);
+        destroy_capture_buffer(&s->capture);
+    }
+    destroy_capture_file(&g->capture);
+    for (size_t i = 0; i < g->shard_count * g->shard_count; i++)
+        destroy_shard_queue(&g->queues[i]);
+    free(g->shards);
+    free(g->queues);
+    free(g->room_clients);
+    *g = (ShardGroup){0};
+}
+
+// queue a datagram on the worker's batch io, counting it in the metrics
+static void shard_send(
+    Shard *s,
+    const void *data,
+    size_t length,
+    const struct sockaddr *addr,
+    socklen_t addr_len)
+{
+    metrics_count(s->metrics.packets_out, data, length);
+    metric_add(&s->metrics.bytes_out, length);
+    batch_io_send(s->io, data, length, addr, addr_len);
+}
+
+// queue a packet to every client of this worker in a room. The packet is
+// copied once into a broadcast buffer that every send points at, so it can
+// live on the stack and goes out with the next flush
+static void
+send_to_clients(Shard *s, u32 room, const void *packet, size_t size)
+{
+    ConnectionTable *t = &s->connections;
+    BroadcastBuffer *b = broadcast_encode(&s->broadcasts, packet, size);
+    for (size_t i = 0; i < t->count; i++)
+    {
+        const struct Connection *c = &t->connections[i];
+        if (c->room != room)
+            continue;
+        metrics_count(s->metrics.packets_out, packet, size);
+        metric_add(&s->metrics.bytes_out, size);
+        if (b != NULL)
+            batch_io_send_buffer(
+                s->io, b, &c->client_addr, c->client_addr_len);
+        else
+            batch_io_send(
+                s->io, packet, size, &c->client_addr, c->client_addr_len);
+    }
+    if (b != NULL)
+        broadcast_release(b);
+    else
+        batch_io_flush(s->io); // every buffer is queued, send from the stack
+}
+
+// tell this worker's clients in a room that a plane is gone
+static void send_disconnect(Shard *s, u32 room, uid_t id)
+{
+    struct DisconnectPacket packet = {
+        .type = PACKET_TYPE_DISCONNECTION,
+        .id   = id,
+    };
+    send_to_clients(s, room, &packet, sizeof(packet));
+}
+
+// get the room with id on this worker, creating it if none of the worker's
+// clients are in it yet. Returns NULL if it cannot be allocated
+static Room *open_room(Shard *s, u32 id)
+{
+    if (s->rooms[id] != NULL)
+        return s->rooms[id];
+    const ShardConfig *c = &s->group->config;
+    Room *r              = malloc(sizeof(Room));
+    if (r == NULL ||
+        create_room(r, id, c->room_size, s->tick, &c->tiers) != RS_SUCCESS)
+    {
+        free(r);
+        return NULL;
+    }
+    s->rooms[id]                        = r;
+    s->open_rooms[s->open_room_count++] = id;
+    return r;
+}
+
+// destroy the rooms the worker's clients have all left. Done at the end of
+// a tick, as clients leave while their room is being stepped
+static void close_empty_rooms(Shard *s)
+{
+    for (size_t i = 0; i < s->open_room_count;)
+    {
+        u32 id = s->open_rooms[i];
+        if (s->rooms[id]->client_count > 0)
+        {
+            i++;
+            continue;
+        }
+        destroy_room(s->rooms[id]);
+        free(s->rooms[id]);
+        s->rooms[id]     = NULL;
+        s->open_rooms[i] = s->open_rooms[--s->open_room_count];
+    }
+}
+
+// remove a client, telling every other client in its room on every worker
+// that its plane is gone, including the one leaving
+static void disconnect_client(Shard *s, struct Connection *c)
+{
+    ShardGroup *g = s->group;
+    uid_t id      = c->id;
+    Room *r       = s->rooms[c->room];
+    send_disconnect(s, r->id, id);
+
+    // the other workers tell their own clients
+    for (size_t to = 0; to < g->shard_count; to++)
+    {
+        if (to == s->index)
+            continue;
+        ShardQueue *q   = shard_queue(g, s->index, to);
+        ShardMessage *m = shard_queue_reserve(q, sizeof(*m));
+        if (m == NULL)
+            continue; // the plane goes stale instead
+        *m = (ShardMessage){
+            .type = SHARD_MESSAGE_REMOVE,
+            .id   = id,
+            .room = r->id,
+        };
+        shard_queue_commit(q);
+    }
+
+    world_remove_plane(&r->world, id);
+    connection_table_remove(&s->connections, id);
+    r->client_count--;
+    atomic_fetch_sub(&g->room_clients[r->id], 1);
+    atomic_fetch_sub(&g->client_count, 1);
+}
+
+static bool is_loopback(const struct sockaddr *addr, socklen_t addr_len)
+{
+    if (addr->sa_family != AF_INET || addr_len < sizeof(struct sockaddr_in))
+        return false;
+    const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+    return (ntohl(in->sin_addr.s_addr) >> 24) == 127;
+}
+
+// add a client to the room it asked for and send it its uid. The request is
+// reused as the reply, so it stays valid until the batch is flushed
+static void connect_client(
+    Shard *s,
+    time_t now,
+    struct ConnectionPacket *request,
+    const struct sockaddr *addr,
+    socklen_t addr_len)
+{
+    ShardGroup *g = s->group;
+    u32 room      = request->room;
+    if (room >= g->config.max_rooms)
+    {
+        log_warning("Connection denied, there is no room %u", room);
+        return;
+    }
+    if (atomic_fetch_add(&g->client_count, 1) >= g->config.max_clients)
+    {
+        atomic_fetch_sub(&g->client_count, 1);
+        log_warning("Connection denied, too many players");
+        return;
+    }
+    if (atomic_fetch_add(&g->room_clients[room], 1) >= g->config.room_size)
+    {
+        atomic_fetch_sub(&g->room_clients[room], 1);
+        atomic_fetch_sub(&g->client_count, 1);
+        log_warning("Connection denied, room %u is full", room);
+        return;
+    }
+
+    // an empty room opened here is closed again at the end of the tick
+    Room *r = open_room(s, room);
+    if (r == NULL)
+    {
+        atomic_fetch_sub(&g->room_clients[room], 1);
+        atomic_fetch_sub(&g->client_count, 1);
+        log_warning("Connection denied, no memory for room %u", room);
+        return;
+    }
+    ConnectionTable *t   = &s->connections;
+    uid_t id             = gen_uid();
+    struct Connection *c = connection_table_add(t, id, addr, addr_len, s->tick);
+    if (c == NULL)
+    {
+        atomic_fetch_sub(&g->room_clients[room], 1);
+        atomic_fetch_sub(&g->client_count, 1);
+        if (t->count == t->capacity)
+            log_warning("Connection denied, connection table full");
+        else
+            log_warning("Connection denied, no memory for the connection");
+        return;
+    }
+    // planes of clients that left on other workers stay in the world until
+    // they go stale, and can fill it while the room has space
+    if (world_add_plane(&r->world, id, request->plane_type) == NULL)
+    {
+        connection_table_remove(t, id);
+        atomic_fetch_sub(&g->room_clients[room], 1);
+        atomic_fetch_sub(&g->client_count, 1);
+        log_warning("Connection denied, world of room %u is full", room);
+        return;
+    }
+    log_info("New connection in room %u", room);
+    c->room      = room;
+    c->datagrams = token_bucket_full(rate_burst(g->config.rate_limit), now);
+    r->client_count++;
+
+    *request = (struct ConnectionPacket){
+        .type       = PACKET_TYPE_CONNECITON,
+        .return_uid = id,
+        .plane_type = request->plane_type,
+        .room       = room,
+    };
+    shard_send(s, request, sizeof(*request), addr, addr_len);
+}
+
+// check if a datagram is handled, or dropped before it costs the worker
+// more than the lookup of its sender. Addresses without a connection can
+// only connect, ping or ask for stats, and share a bucket
+static bool
+accept_datagram(Shard *s, struct Connection *c, PacketType type, time_t now)
+{
+    if (c == NULL && type != PACKET_TYPE_CONNECITON &&
+        type != PACKET_TYPE_EMPTY && type != PACKET_TYPE_STATS)
+    {
+        metric_add(&s->metrics.rejected, 1);
+        return false;
+    }
+    u32 rate = s->group->config.rate_limit;
+    if (rate == 0)
+        return true;
+    if (c == NULL)
+        rate *= SHARD_STRANGER_CLIENTS;
+    TokenBucket *b = c != NULL ? &c->datagrams : &s->strangers;
+    if (token_bucket_take(b, rate, rate_burst(rate), now))
+        return true;
+    metric_add(&s->metrics.rate_limited, 1);
+    return false;
+}
+
+// handle a single recieved datagram of length bytes that arrived at time
+// now, any replies are queued on the batch io and sent when the batch is
+// flushed
+static void handle_packet(
+    Shard *s,
+    time_t now,
+    Packet *recieved_packet,
+    size_t length,
+    const struct sockaddr *client_addr,
+    socklen_t client_addr_size)
+{
+    if (packet_complete(recieved_packet, length) == false)
+    {
+        metric_add(&s->metrics.rejected, 1);
+        return;
+    }
+
+    ShardGroup *g        = s->group;
+    ConnectionTable *t   = &s->connections;
+    struct Connection *c = connection_table_find_addr(
+        t, client_addr, client_addr_size); // NULL for unknown senders
+    // any datagram shows the client is still there
+    if (c != NULL)
+        c->last_seen = s->tick;
+    if (accept_datagram(s, c, recieved_packet->type, now) == false)
+        return;
+
+    switch (recieved_packet->type)
+    {
+    case PACKET_TYPE_EMPTY:
+        // send same packet back
+        shard_send(
+            s,
+            recieved_packet,
+            sizeof(struct EmptyPacket),
+            client_addr,
+            client_addr_size);
+        break;
+    case PACKET_TYPE_CONNECITON:
+        // the reply was lost and the client asked again, so send the same
+        // uid instead of adding a second plane
+        if (c != NULL)
+        {
+            struct ConnectionPacket *cpack =
+                &recieved_packet->connection_packet;
+            cpack->return_uid = c->id;
+            cpack->room       = c->room;
+            shard_send(
+                s, cpack, sizeof(*cpack), client_addr, client_addr_size);
+            break;
+        }
+        connect_client(
+            s,
+            now,
+            &recieved_packet->connection_packet,
+            client_addr,
+            client_addr_size);
+        break;
+    case PACKET_TYPE_DISCONNECTION:
+        // clients can only disconnect themselves
+        if (c == NULL || c->id != recieved_packet->disconnect_packet.id)
+            break;
+        log_info("A client has disconnected");
+        disconnect_client(s, c);
+        break;
+    case PACKET_TYPE_INPUT:
+        // only the client flying a plane can control it
+        if (c == NULL || c->id != recieved_packet->input_packet.id)
+            break;
+        world_set_input(
+            &s->rooms[c->room]->world, &recieved_packet->input_packet, now);
+        snapshot_client_ack(
+            connection_snapshot(t, c),
+            recieved_packet->input_packet.snapshot_ack);
+        break;
+    case PACKET_TYPE_STATS:
+        // metrics are only for whoever runs the server
+        if (is_loopback(client_addr, client_addr_size) == false)
+            break;
+        {
+            MetricsTotals totals = {0};
+            shard_group_metrics(g, &totals);
+            metrics_fill_packet(&totals, &recieved_packet->stats_packet);
+            shard_send(
+                s,
+                recieved_packet,
+                sizeof(struct StatsPacket),
+                client_addr,
+                client_addr_size);
+        }
+        break;
+    case PACKET_TYPE_PLANE:
+    case PACKET_TYPE_SNAPSHOT:
+    case PACKET_TYPE_KILL:
+    case PACKET_TYPE_COUNT:
+        // the server simulates every plane itself, so client side plane
+        // state is not relayed anymore
+        break;
+    }
+}
+
+// copy the state of a plane the other workers need into a message
+static void write_plane_message(
+    ShardMessage *m, const WorldPlane *p, u32 bullet_count)
+{
+    *m = (ShardMessage){
+        .type         = SHARD_MESSAGE_PLANE,
+        .id           = p->id,
+        .plane_type   = p->plane.plane_type,
+        .heading      = p->plane.heading,
+        .speed        = p->plane.speed,
+        .view_delay   = p->view_delay,
+        .bullet_count = bullet_count,
+    };
+    glm_vec2_copy((f32 *)p->plane.position, m->position);
+
+    ShardBullet *bullet = m->bullets;
+    for (u32 i = 0; i < MAX_BULLET_COUNT; i++)
+    {
+        if (p->plane.active_bullets[i].used == false)
+            continue;
+        *bullet++ = (ShardBullet){
+            .slot   = i,
+            .bullet = p->plane.active_bullets[i],
+            .fired  = p->fired[i],
+        };
+    }
+}
+
+// send the state of every plane simulated by this worker to the others
+static void send_planes(Shard *s)
+{
+    ShardGroup *g = s->group;
+    if (g->shard_count == 1)
+        return;
+
+    for (size_t r = 0; r < s->open_room_count; r++)
+    {
+        const Room *room = s->rooms[s->open_rooms[r]];
+        for (size_t i = 0; i < room->world.plane_count; i++)
+        {
+            const WorldPlane *p = &room->world.planes[i];
+            if (p->remote)
+                continue;
+
+            u32 bullet_count = 0;
+            for (size_t b = 0; b < MAX_BULLET_COUNT; b++)
+                bullet_count += p->plane.active_bullets[b].used;
+            size_t size =
+                sizeof(ShardMessage) + bullet_count * sizeof(ShardBullet);
+
+            for (size_t to = 0; to < g->shard_count; to++)
+            {
+                if (to == s->index)
+                    continue;
+                ShardQueue *q   = shard_queue(g, s->index, to);
+                ShardMessage *m = shard_queue_reserve(q, size);
+                if (m == NULL)
+                    continue;
+                write_plane_message(m, p, bullet_count);
+                m->room = room->id;
+                shard_queue_commit(q);
+            }
+        }
+    }
+}
+
+// copy the state of another worker's plane into the world of its room
+static void apply_plane_message(Room *r, const ShardMessage *m)
+{
+    WorldPlane *p = world_find_plane(&r->world, m->id);
+    if (p == NULL)
+    {
+        p = world_add_plane(&r->world, m->id, m->plane_type);
+        if (p == NULL)
+            return;
+        p->remote = true;
+    }
+    if (p->remote == false)
+        return;
+
+    p->remote_tick      = r->world.tick;
+    p->plane.plane_type = m->plane_type;
+    p->plane.heading    = m->heading;
+    p->plane.speed      = m->speed;
+    p->view_delay       = m->view_delay;
+    glm_vec2_copy((f32 *)m->position, p->plane.position);
+
+    for (size_t i = 0; i < MAX_BULLET_COUNT; i++)
+        p->plane.active_bullets[i].used = false;
+    for (u32 i = 0; i < m->bullet_count; i++)
+    {
+        const ShardBullet *b = &m->bullets[i];
+        assert(b->slot < MAX_BULLET_COUNT);
+        p->plane.active_bullets[b->slot] = b->bullet;
+        p->fired[b->slot]                = b->fired;
+    }
+}
+
+// remove the bullet that hit a plane, from the worker simulating it or from
+// the copy of another worker's plane
+static void remove_bullet(Room *r, uid_t shooter, u32 slot)
+{
+    WorldPlane *p = world_find_plane(&r->world, shooter);
+    if (p != NULL && slot < MAX_BULLET_COUNT)
+        p->plane.active_bullets[slot].used = false;
+}
+
+// destroy the planes of this worker in a room that were hit this tick.
+// Every client in the room on every worker is told who shot them down, and
+// the shooter's worker removes the bullet
+static void resolve_hits(Shard *s, Room *r, time_t now)
+{
+    ShardGroup *g = s->group;
+    HitGrid *h    = &r->hit_grid;
+    hit_grid_resolve(h, &r->world, now);
+    if (h->hit_count == 0)
+        return;
+
+    for (size_t i = 0; i < h->hit_count; i++)
+    {
+        const Hit *hit = &h->hits[i];
+
+        struct KillPacket kill = {
+            .type    = PACKET_TYPE_KILL,
+            .victim  = r->world.planes[hit->victim].id,
+            .shooter = r->world.planes[hit->shooter].id,
+            .slot    = hit->slot,
+            .tick    = r->world.tick,
+        };
+        log_info("Plane %i shot down by %i", kill.victim, kill.shooter);
+        remove_bullet(r, kill.shooter, kill.slot);
+        send_to_clients(s, r->id, &kill, sizeof(kill));
+
+        for (size_t to = 0; to < g->shard_count; to++)
+        {
+            if (to == s->index)
+                continue;
+            ShardQueue *q   = shard_queue(g, s->index, to);
+            ShardMessage *m = shard_queue_reserve(q, sizeof(*m));
+            if (m == NULL)
+                continue; // the plane still disappears when it goes stale
+            *m = (ShardMessage){
+                .type = SHARD_MESSAGE_KILL,
+                .id   = kill.victim,
+                .room = r->id,
+                .kill = kill,
+            };
+            shard_queue_commit(q);
+        }
+    }
+
+    // removing a plane moves the last one into its place, so going from the
+    // end never moves a plane that has not been looked at yet
+    for (size_t i = r->world.plane_count; i-- > 0;)
+    {
+        if (h->hit[i] == false)
+            continue;
+        struct Connection *c =
+            connection_table_find(&s->connections, r->world.planes[i].id);
+        if (c != NULL)
+            disconnect_client(s, c);
+    }
+}
+
+// apply every plane sent by the other workers since the last tick, and
+// remove the remote planes that stopped being sent. Planes of rooms none of
+// this worker's clients are in are dropped
+static void receive_planes(Shard *s)
+{
+    ShardGroup *g = s->group;
+    for (size_t from = 0; from < g->shard_count; from++)
+    {
+        if (from == s->index)
+            continue;
+        ShardQueue *q = shard_queue(g, from, s->index);
+        const ShardMessage *m;
+        size_t size;
+        while ((m = shard_queue_peek(q, &size)) != NULL)
+        {
+            Room *r = s->rooms[m->room];
+            if (r == NULL)
+            {
+                // nobody here to tell
+            }
+            else if (m->type == SHARD_MESSAGE_PLANE)
+            {
+                apply_plane_message(r, m);
+            }
+            else if (m->type == SHARD_MESSAGE_REMOVE)
+            {
+                world_remove_plane(&r->world, m->id);
+                send_disconnect(s, r->id, m->id);
+            }
+            else if (m->type == SHARD_MESSAGE_KILL)
+            {
+                remove_bullet(r, m->kill.shooter, m->kill.slot);
+                send_to_clients(s, r->id, &m->kill, sizeof(m->kill));
+            }
+            shard_queue_pop(q);
+        }
+    }
+
+    // a remove message may have been dropped, or the worker may be stuck
+    for (size_t r = 0; r < s->open_room_count; r++)
+    {
+        World *w = &s->rooms[s->open_rooms[r]]->world;
+        for (size_t i = 0; i < w->plane_count;)
+        {
+            WorldPlane *p = &w->planes[i];
+            if (p->remote && w->tick - p->remote_tick > SHARD_STALE_TICKS)
+                world_remove_plane(w, p->id); // moves another plane to i
+            else
+                i++;
+        }
+    }
+}
+
+// queue the parts of a client's snapshot still waiting to be sent, returns
+// how many were queued
+static size_t send_egress(Shard *s, struct Connection *c)
+{
+    // a client's parts are queued together, so with segmentation offload
+    // they go to the kernel as one send. That needs every part but the last
+    // to be the same size, so those are padded to full, which is less than a
+    // plane as parts are only closed when the next plane does not fit.
+    // Clients only read size bytes of data, the padding is zeroed so nothing
+    // stale is sent
+    const Room *room = s->rooms[c->room];
+    bool pad         = batch_io_segmenting(s->io);
+    size_t full_size =
+        offsetof(struct SnapshotPacket, data) + MAX_SNAPSHOT_DATA;
+    size_t queued = c->view.part_count - c->egress_next;
+    for (; c->egress_next < c->view.part_count; c->egress_next++)
+    {
+        size_t i = c->egress_next;
+        struct SnapshotPacket *part =
+            snapshot_view_part(&room->snapshot, c->view, i);
+        size_t size = snapshot_packet_size(part);
+        if (pad && i + 1 < c->view.part_count)
+        {
+            memset(part->data + part->size, 0, MAX_SNAPSHOT_DATA - part->size);
+            size = full_size;
+        }
+        shard_send(s, part, size, &c->client_addr, c->client_addr_len);
+    }
+    return queued;
+}
+
+// pacing slots the pacing timer has fired since it started
+static u64 pace_slot(const Shard *s)
+{
+    return s->pace_timer.tick + s->pace_timer.dropped;
+}
+
+// send an even share of the queued snapshots for each slot left before the
+// end of the tick, whole clients at a time. The last slot sends whatever is
+// left, including clients moved behind the cursor by a disconnect
+static void drain_egress(Shard *s)
+{
+    if (s->egress_queued == 0)
+        return;
+    histogram_record(&s->metrics.egress_depth, s->egress_queued);
+
+    ConnectionTable *t = &s->connections;
+    u64 slot           = pace_slot(s);
+    if (s->pace_timer.fd != -1 && slot < s->egress_deadline)
+    {
+        u64 slots    = s->egress_deadline - slot + 1;
+        size_t share = (s->egress_queued + slots - 1) / slots;
+        size_t sent  = 0;
+        while (sent < share && s->egress_cursor < t->count)
+            sent += send_egress(s, &t->connections[s->egress_cursor++]);
+        s->egress_queued -= sent < s->egress_queued ? sent : s->egress_queued;
+    }
+    else
+    {
+        for (size_t i = 0; i < t->count; i++)
+            send_egress(s, &t->connections[i]);
+        s->egress_queued = 0;
+    }
+    batch_io_flush(s->io);
+}
+
+// pack the snapshot of every client of the worker, from the rooms they are
+// in, and send the first share of them. The rest are paced out over the
+// tick by drain_egress
+static void send_snapshots(Shard *s, time_t now)
+{
+    // slots that passed while the worker was busy are over, and parts not
+    // sent by now were superseded, and their buffers are reused
+    if (s->pace_timer.fd != -1 && tick_timer_consume(&s->pace_timer) > 0)
+        drain_egress(s);
+    ConnectionTable *t = &s->connections;
+    for (size_t i = 0; i < t->count; i++)
+    {
+        struct Connection *c = &t->connections[i];
+        metric_add(
+            &s->metrics.egress_dropped, c->view.part_count - c->egress_next);
+    }
+
+    for (size_t r = 0; r < s->open_room_count; r++)
+    {
+        Room *room = s->rooms[s->open_rooms[r]];
+        snapshot_builder_begin(
+            &room->snapshot, &room->world, room->world.tick, now);
+    }
+
+    // every view is packed before anything is queued, as packing can move
+    // the snapshot buffers
+    s->egress_queued = 0;
+    for (size_t i = 0; i < t->count; i++)
+    {
+        struct Connection *c = &t->connections[i];
+        Room *room           = s->rooms[c->room];
+        c->view              = snapshot_builder_build_view(
+            &room->snapshot, &room->world, c->id, &t->snapshots[i]);
+        c->egress_next = 0;
+        s->egress_queued += c->view.part_count;
+    }
+
+    // the pacing timer fires SHARD_PACE_SLOTS times between ticks, so the
+    // tick that just started ends with this many slots
+    TickTimer *tick    = &s->tick_timer;
+    s->egress_cursor   = 0;
+    s->egress_deadline = (tick->tick + tick->dropped) * SHARD_PACE_SLOTS;
+    drain_egress(s);
+}
+
+// advance every room by the number of ticks that have elapsed, starting
+// with tick first, then send every client a snapshot of what it can see
+static void shard_tick(Shard *s, time_t now, u64 first, u64 ticks)
+{
+    u64 start = metrics_now();
+
+    for (size_t r = 0; r < s->open_room_count; r++)
+        s->rooms[s->open_rooms[r]]->world.tick = first;
+    receive_planes(s);
+
+    // bullets move less than a plane's width per tick, so checking every
+    // step is enough for them not to pass through planes. Positions are
+    // recorded first, as hits are checked against the newest record
+    for (size_t r = 0; r < s->open_room_count; r++)
+    {
+        Room *room = s->rooms[s->open_rooms[r]];
+        for (u64 i = 0; i < ticks; i++)
+        {
+            world_step(&room->world, s->tick_timer.delta);
+            world_record(&room->world, now);
+            resolve_hits(s, room, now);
+        }
+    }
+    s->tick = first + ticks;
+
+    send_planes(s);
+
+    // clients that crashed or lost their connection never say goodbye
+    struct Connection *idle;
+    while ((idle = connection_table_next_idle(&s->connections, s->tick)))
+    {
+        log_info("Client %i timed out", idle->id);
+        disconnect_client(s, idle);
+    }
+
+    send_snapshots(s, now);
+    close_empty_rooms(s);
+
+    histogram_record(&s->metrics.tick_duration, metrics_now() - start);
+}
+
+static void log_shard_stats(Shard *s)
+{
+    batch_io_log_stats(s->io);
+
+    ShardGroup *g = s->group;
+    u64 dropped   = 0;
+    for (size_t to = 0; to < g->shard_count; to++)
+        dropped += shard_queue(g, s->index, to)->dropped;
+    if (dropped > 0)
+        log_warning(
+            "Worker %zu dropped %lu plane updates to other workers",
+            s->index,
+            dropped);
+    if (s->broadcasts.exhausted > 0)
+        log_warning(
+            "Worker %zu ran out of broadcast buffers %lu times",
+            s->index,
+            s->broadcasts.exhausted);
+}
+
+static void *shard_run(void *arg)
+{
+    Shard *s = arg;
+
+    time_t next_stats_time = get_time() + SHARD_STATS_INTERVAL;
+    while (atomic_load(&s->group->running))
+    {
+        int count  = batch_io_wait(s->io, 1000);
+        u64 wakeup = metrics_now();
+        time_t now = get_time();
+        for (int i = 0; i < count; i++)
+        {
+            const struct sockaddr *client_addr;
+            socklen_t client_addr_size;
+            size_t length;
+            Packet *p = batch_io_received(
+                s->io, i, &length, &client_addr, &client_addr_size);
+            metrics_count(s->metrics.packets_in, p, length);
+            metric_add(&s->metrics.bytes_in, length);
+            // recorded before handling, which can reuse the packet as a reply
+            if (s->capture.data != NULL)
+                capture_datagram(
+                    &s->capture, now, client_addr, client_addr_size, p, length);
+            handle_packet(s, now, p, length, client_addr, client_addr_size);
+        }
+        // send everything queued while handling the batch
+        batch_io_flush(s->io);
+
+        if (batch_io_ready(s->io, s->pace_timer.fd) &&
+            tick_timer_consume(&s->pace_timer) > 0)
+            drain_egress(s);
+        if (batch_io_ready(s->io, s->tick_timer.fd))
+        {
+            u64 ticks = tick_timer_consume(&s->tick_timer);
+            if (ticks > 0)
+            {
+                // skipped ticks are still counted, so the tick matches
+                // other workers
+                TickTimer *t = &s->tick_timer;
+                u64 first    = t->tick + t->dropped - ticks;
+                shard_tick(s, now, first, ticks);
+                if (s->capture.data != NULL)
+                    capture_tick(&s->capture, now, first, ticks);
+            }
+            if (s->capture.data != NULL)
+                capture_maybe_flush(&s->capture, now);
+        }
+
+        Metrics *m = &s->metrics;
+        metric_set(&m->send_errors, batch_io_stats(s->io)->send_errors);
+        metric_set(&m->kernel_drops, batch_io_stats(s->io)->kernel_drops);
+        metric_set(&m->connections, s->connections.count);
+        histogram_record(&m->loop_latency, metrics_now() - wakeup);
+
+        if (get_time() >= next_stats_time)
+        {
+            log_shard_stats(s);
+            next_stats_time += SHARD_STATS_INTERVAL;
+        }
+    }
+    return NULL;
+}
+
+Result shard_group_start(ShardGroup *g)
+{
+    atomic_store(&g->running, true);
+    for (size_t i = 0; i < g->shard_count; i++)
+    {
+        Shard *s = &g->shards[i];
+        if (pthread_create(&s->thread, NULL, shard_run, s) != 0)
+        {
+            log_error("Failed to start server worker %zu", i);
+            // stop the workers that did start
+            atomic_store(&g->running, false);
+            for (size_t j = 0; j < i; j++)
+                pthread_join(g->shards[j].thread, NULL);
+            return RS_FAILURE;
+        }
+    }
+    return RS_SUCCESS;
+}
+
+void shard_group_wait(ShardGroup *g)
+{
+    for (size_t i = 0; i < g->shard_count; i++)
+        pthread_join(g->shards[i].thread, NULL);
+}
+
+void shard_group_stop(ShardGroup *g)
+{
+    atomic_store(&g->running, false);
+    shard_group_wait(g);
+}
+
+void shard_group_metrics(const ShardGroup *g, MetricsTotals *totals)
+{
+    for (size_t i = 0; i < g->shard_count; i++)
+        metrics_add_to(&g->shards[i].metrics, totals);
+}
+
+void shard_feed(
+    Shard *s,
+    time_t now,
+    Packet *packet,
+    size_t length,
+    const struct sockaddr *addr,
+    socklen_t addr_len)
+{
+    assert(s->group->config.offline);
+    metrics_count(s->metrics.packets_in, packet, length);
+    metric_add(&s->metrics.bytes_in, length);
+    handle_packet(s, now, packet, length, addr, addr_len);
+    batch_io_flush(s->io);
+}
+
+void shard_advance(Shard *s, time_t now, u64 first, u64 count)
+{
+    assert(s->group->config.offline);
+    s->tick_timer.tick = first + count;
+    shard_tick(s, now, first, count);
+    metric_set(&s->metrics.connections, s->connections.count);
+}
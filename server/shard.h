@@ -0,0 +1,167 @@
+#pragma once
+
+/*
+ * Worker threads of the server. Every worker has its own socket bound to the
+ * server port with SO_REUSEPORT, so the kernel spreads clients over the
+ * workers by their address and a client always reaches the same worker. A
+ * worker owns the connections and planes of its clients: it simulates them
+ * and sends its clients their snapshots.
+ *
+ * To see the planes of the other workers, every worker sends the state of
+ * its planes to each other worker at the end of every tick, through a lock
+ * free queue for each pair of workers. Planes received from other workers
+ * are kept in the world as remote planes, which are not simulated. All the
+ * tick timers start together, so every worker numbers ticks the same.
+ *
+ * Planes are kept per room, see room.h, and a worker only steps and sends
+ * snapshots for the rooms its clients are in. Messages between workers
+ * carry the room, and are dropped by workers with no clients in it.
+ */
+
+#include "batch_io.h"
+#include "capture.h"
+#include "connection_table.h"
+#include "metrics.h"
+#include "room.h"
+#include "shard_queue.h"
+#include "tick_timer.h"
+#include <pthread.h>
+
+// bytes of plane state that can be waiting to be read by one worker from
+// another, planes that do not fit are sent on the next tick
+#define SHARD_QUEUE_SIZE (1 << 20)
+// ticks without an update before a remote plane is assumed to be gone
+#define SHARD_STALE_TICKS SERVER_TICK_RATE
+// packets for a whole room that can wait for the next flush, broadcasts
+// beyond these are sent straight away
+#define SHARD_BROADCAST_BUFFERS 256
+// datagrams a second from all unknown addresses together that a worker
+// handles, as a multiple of the limit of one client
+#define SHARD_STRANGER_CLIENTS 16
+// most clients in one room when the config does not say. Every room sizes
+// its world and snapshots for this many planes, so it is kept to a match
+#define SHARD_DEFAULT_ROOM_SIZE 64
+// the snapshots of a tick are sent in this many slots spread over the tick
+// after the first, so the socket and clients get them a few at a time
+#define SHARD_PACE_SLOTS 4
+// how often the batching stats are written to the log, in microseconds
+#define SHARD_STATS_INTERVAL (10 * SEC_TO_MICROSEC)
+
+typedef struct ShardConfig
+{
+    size_t workers;
+    u16 port; // 0 for any free port, which is then stored in the group
+    size_t max_clients;
+    // rooms are numbered from 0 to max_rooms - 1, 0 for a single room
+    size_t max_rooms;
+    // most clients in one room, 0 for SHARD_DEFAULT_ROOM_SIZE
+    size_t room_size;
+    u32 idle_timeout; // ticks without a datagram before a client is dropped
+    // datagrams a second handled from each client, a quarter second of them
+    // can come at once. 0 handles every datagram
+    u32 rate_limit;
+    // bytes the kernel buffers for each worker's socket in each direction,
+    // 0 for the system default
+    int receive_buffer;
+    int send_buffer;
+    // how often clients are sent planes by their distance, no tiers for
+    // SNAPSHOT_DEFAULT_TIERS
+    SnapshotTiers tiers;
+    BatchIOBackend backend; // falls back to sockets if io_uring is missing
+    // NULL, or a file every datagram and tick is recorded to
+    const char *capture_path;
+    // no sockets, timers or threads, datagrams and ticks are fed with
+    // shard_feed and shard_advance instead, for replaying captures
+    bool offline;
+} ShardConfig;
+
+typedef struct ShardGroup ShardGroup;
+
+typedef struct Shard
+{
+    ShardGroup *group;
+    size_t index;
+    pthread_t thread;
+
+    int socket;
+    BatchIO *io;
+    BroadcastPool broadcasts; // packets queued for every client in a room
+
+    // clients whose packets arrive on this worker's socket, in every room
+    ConnectionTable connections;
+
+    // rooms the worker's clients are in by id, NULL for the others, and the
+    // ids of the rooms that exist so empty ones are never looked at
+    Room **rooms;
+    u32 *open_rooms;
+    size_t open_room_count;
+
+    TickTimer tick_timer;
+    u32 tick; // the tick of every room on the worker
+
+    // wakes the worker in the middle of each pacing slot. The snapshot
+    // datagrams still queued for the worker's clients, the client to send
+    // from next and the pacing slot the tick ends with
+    TickTimer pace_timer;
+    size_t egress_queued;
+    size_t egress_cursor;
+    u64 egress_deadline;
+
+    // shared by every address without a connection, which can only connect
+    // or ping, so spoofed senders cannot make the worker send more than this
+    TokenBucket strangers;
+
+    Metrics metrics; // read by any thread, written only by the worker
+    CaptureBuffer capture; // unused unless the server is capturing
+} Shard;
+
+struct ShardGroup
+{
+    ShardConfig config;
+    Shard *shards;
+    size_t shard_count;
+
+    // queues[from * shard_count + to] carries planes from one worker to
+    // another, the queues of a worker to itself are unused
+    ShardQueue *queues;
+
+    atomic_bool running;
+    atomic_size_t client_count;  // connections across all workers
+    atomic_size_t *room_clients; // connections in each room
+
+    CaptureFile capture;
+};
+
+// open a socket for each worker on the port of the config, unless the config
+// is offline
+Result create_shard_group(ShardGroup *g, const ShardConfig *config);
+void destroy_shard_group(ShardGroup *g);
+
+// start a thread for every worker
+Result shard_group_start(ShardGroup *g);
+
+// wait for every worker to stop
+void shard_group_wait(ShardGroup *g);
+
+// ask every worker to stop after its current wakeup, and wait for them
+void shard_group_stop(ShardGroup *g);
+
+// sum the metrics of every worker into zeroed totals, safe to call while the
+// workers run
+NONULL(1, 2)
+void shard_group_metrics(const ShardGroup *g, MetricsTotals *totals);
+
+// handle a datagram as if it had arrived on the worker's socket at time now.
+// Only for offline groups
+NONULL(1, 3, 5)
+void shard_feed(
+    Shard *s,
+    time_t now,
+    Packet *packet,
+    size_t length,
+    const struct sockaddr *addr,
+    socklen_t addr_len);
+
+// step the worker's world count ticks from tick first at time now, as if
+// its timer had fired. Only for offline groups
+NONULL(1) void shard_advance(Shard *s, time_t now, u64 first, u64 count);
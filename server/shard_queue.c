@@ -0,0 +1,111 @@
+#include "shard_queue.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <messenger.h>
+
+// every message starts with its size, and is padded so the next header is
+// aligned
+typedef size_t MessageHeader;
+#define MESSAGE_ALIGN alignof(max_align_t)
+// header of the unused space at the end of the ring, the message after it
+// starts at the beginning of the ring
+#define MESSAGE_WRAP SIZE_MAX
+
+static inline size_t message_span(size_t size)
+{
+    size_t span = sizeof(MessageHeader) + size;
+    return (span + MESSAGE_ALIGN - 1) & ~(MESSAGE_ALIGN - 1);
+}
+
+Result create_shard_queue(ShardQueue *q, size_t size)
+{
+    size_t capacity = MESSAGE_ALIGN;
+    while (capacity < size)
+        capacity <<= 1;
+
+    *q = (ShardQueue){
+        .data = aligned_alloc(MESSAGE_ALIGN, capacity),
+        .size = capacity,
+    };
+    if (q->data == NULL)
+    {
+        log_error("Failed to allocate shard queue");
+        return RS_FAILURE;
+    }
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    return RS_SUCCESS;
+}
+
+void destroy_shard_queue(ShardQueue *q)
+{
+    free(q->data);
+    q->data = NULL;
+}
+
+void *shard_queue_reserve(ShardQueue *q, size_t size)
+{
+    size_t span = message_span(size);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    // the reader only ever frees more space, so an old head is safe to use
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+    // a message is never split, if it does not fit before the end of the
+    // ring the rest of the ring is skipped
+    size_t offset     = tail & (q->size - 1);
+    size_t contiguous = q->size - offset;
+    size_t needed     = span <= contiguous ? span : contiguous + span;
+    if (span > q->size || tail - head + needed > q->size)
+    {
+        q->dropped++;
+        return NULL;
+    }
+
+    if (span > contiguous)
+    {
+        *(MessageHeader *)(q->data + offset) = MESSAGE_WRAP;
+        offset                               = 0;
+    }
+    *(MessageHeader *)(q->data + offset) = size;
+    q->reserved_tail                     = tail + needed;
+    return q->data + offset + sizeof(MessageHeader);
+}
+
+void shard_queue_commit(ShardQueue *q)
+{
+    // release so the message is written before the reader can see it
+    atomic_store_explicit(&q->tail, q->reserved_tail, memory_order_release);
+}
+
+const void *shard_queue_peek(ShardQueue *q, size_t *size)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head == tail)
+        return NULL;
+
+    size_t offset         = head & (q->size - 1);
+    MessageHeader message = *(const MessageHeader *)(q->data + offset);
+    if (message == MESSAGE_WRAP)
+    {
+        // the wrap is committed with the message after it, so there is
+        // always a message at the start of the ring
+        head += q->size - offset;
+        atomic_store_explicit(&q->head, head, memory_order_release);
+        offset  = 0;
+        message = *(const MessageHeader *)q->data;
+        assert(head != tail);
+    }
+
+    q->peeked_size = message;
+    *size          = message;
+    return q->data + offset + sizeof(MessageHeader);
+}
+
+void shard_queue_pop(ShardQueue *q)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    // release so the message has been read before the writer reuses it
+    atomic_store_explicit(
+        &q->head, head + message_span(q->peeked_size), memory_order_release);
+}
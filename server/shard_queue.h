@@ -0,0 +1,46 @@
+#pragma once
+
+/*
+ * Lock free queue of variable sized messages between two threads, one
+ * writing and one reading. Messages are written in place into a ring of
+ * bytes, so a message costs one copy. The writer and the reader each own
+ * one end of the ring, and only publish their end with an atomic store once
+ * a message is complete.
+ *
+ * A writer that finds the queue full drops the message instead of waiting.
+ */
+
+#include <types.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct ShardQueue
+{
+    u8 *data;
+    size_t size; // bytes in the ring, a power of 2
+
+    // owned by the writer, on their own cache line so the two threads do
+    // not invalidate each other's cache when they move their ends
+    alignas(64) atomic_size_t tail; // end of the last committed message
+    size_t reserved_tail;           // end of the reserved message
+    u64 dropped;                    // messages that did not fit
+
+    // owned by the reader
+    alignas(64) atomic_size_t head; // start of the next message
+    size_t peeked_size;             // size of the message being read
+} ShardQueue;
+
+// size is rounded up to a power of 2
+Result create_shard_queue(ShardQueue *q, size_t size);
+void destroy_shard_queue(ShardQueue *q);
+
+// writer: get space for a message of size bytes, returns NULL if the queue
+// is full. The message is only seen by the reader after commit
+NONULL(1) void *shard_queue_reserve(ShardQueue *q, size_t size);
+NONULL(1) void shard_queue_commit(ShardQueue *q);
+
+// reader: get the oldest message, returns NULL if the queue is empty. The
+// message stays valid until it is popped
+NONULL(1, 2) const void *shard_queue_peek(ShardQueue *q, size_t *size);
+NONULL(1) void shard_queue_pop(ShardQueue *q);
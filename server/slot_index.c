@@ -0,0 +1,89 @@
+#include "slot_index.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+Result create_slot_index(SlotIndex *index, size_t capacity)
+{
+    // keep the index at most half full so probes stay short
+    size_t slots = 1;
+    while (slots < capacity * 2)
+        slots <<= 1;
+
+    *index = (SlotIndex){
+        .keys   = malloc(slots * sizeof(u64)),
+        .values = malloc(slots * sizeof(u32)),
+        .mask   = slots - 1,
+    };
+    if (index->keys == NULL || index->values == NULL)
+        return RS_FAILURE;
+    memset(index->values, 0xff, slots * sizeof(u32));
+    return RS_SUCCESS;
+}
+
+void destroy_slot_index(SlotIndex *index)
+{
+    free(index->keys);
+    free(index->values);
+    *index = (SlotIndex){0};
+}
+
+void slot_index_insert(SlotIndex *index, u64 key, u32 value)
+{
+    size_t slot = slot_index_home(index, key);
+    while (index->values[slot] != SLOT_NONE)
+        slot = (slot + 1) & index->mask;
+    index->keys[slot]   = key;
+    index->values[slot] = value;
+}
+
+// find the slot holding value under key, the index has at most one
+static size_t find_value(const SlotIndex *index, u64 key, u32 value)
+{
+    size_t slot = slot_index_home(index, key);
+    while (index->values[slot] != value || index->keys[slot] != key)
+    {
+        assert(index->values[slot] != SLOT_NONE);
+        slot = (slot + 1) & index->mask;
+    }
+    return slot;
+}
+
+void slot_index_remove(SlotIndex *index, u64 key, u32 value)
+{
+    size_t hole = find_value(index, key, value);
+
+    // move later keys of the same run back into the hole, unless that would
+    // put them before their home slot, so probes never stop early
+    size_t slot = hole;
+    for (;;)
+    {
+        slot = (slot + 1) & index->mask;
+        if (index->values[slot] == SLOT_NONE)
+            break;
+        size_t home = slot_index_home(index, index->keys[slot]);
+        if (((slot - home) & index->mask) >= ((slot - hole) & index->mask))
+        {
+            index->keys[hole]   = index->keys[slot];
+            index->values[hole] = index->values[slot];
+            hole                = slot;
+        }
+    }
+    index->values[hole] = SLOT_NONE;
+}
+
+void slot_index_move(SlotIndex *index, u64 key, u32 from, u32 to)
+{
+    index->values[find_value(index, key, from)] = to;
+}
+
+u32 slot_index_find(const SlotIndex *index, u64 key)
+{
+    size_t slot = slot_index_home(index, key);
+    for (; index->values[slot] != SLOT_NONE; slot = (slot + 1) & index->mask)
+    {
+        if (index->keys[slot] == key)
+            return index->values[slot];
+    }
+    return SLOT_NONE;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+/*
+ * Open addressing map from a 64 bit key to a slot in a dense array, with
+ * linear probing. Keys do not have to be unique, lookups that can meet
+ * several entries under one key walk them with slot_index_home and compare
+ * the array entries themselves. Removal shifts the rest of the probe run
+ * back instead of leaving tombstones, so the index never degrades.
+ *
+ * The index is kept at most half full of the capacity it is created with
+ * and never grows, like the arrays it points into.
+ */
+
+#include <types.h>
+#include <stddef.h>
+
+// value of an empty slot in the index
+#define SLOT_NONE UINT32_MAX
+
+typedef struct SlotIndex
+{
+    u64 *keys;
+    u32 *values; // SLOT_NONE if the slot is empty
+    size_t mask; // slot count - 1, the slot count is a power of 2
+} SlotIndex;
+
+Result create_slot_index(SlotIndex *index, size_t capacity);
+void destroy_slot_index(SlotIndex *index);
+
+// slot a key is placed in when there are no collisions, probes continue
+// with (slot + 1) & mask until a slot holds SLOT_NONE
+static inline size_t slot_index_home(const SlotIndex *index, u64 key)
+{
+    return (key * 0x9e3779b97f4a7c15ull >> 32) & index->mask;
+}
+
+NONULL(1) void slot_index_insert(SlotIndex *index, u64 key, u32 value);
+// remove value from under key, it has to be in the index
+NONULL(1) void slot_index_remove(SlotIndex *index, u64 key, u32 value);
+// point key at to instead of from, after the array moved an entry
+NONULL(1) void slot_index_move(SlotIndex *index, u64 key, u32 from, u32 to);
+
+// the value of the first entry under key, or SLOT_NONE. Only for keys that
+// are unique
+NONULL(1) u32 slot_index_find(const SlotIndex *index, u64 key);
@@ -0,0 +1,442 @@
+#include "snapshot_builder.h"
+#include "snapshot.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <messenger.h>
+
+Result create_snapshot_builder(SnapshotBuilder *b, size_t max_planes)
+{
+    size_t history_size = SNAPSHOT_HISTORY * max_planes;
+
+    *b = (SnapshotBuilder){
+        .parts           = malloc(max_planes * sizeof(struct SnapshotPacket)),
+        .capacity        = max_planes,
+        .max_planes      = max_planes,
+        .tiers           = SNAPSHOT_DEFAULT_TIERS,
+        .history         = malloc(history_size * sizeof(PlaneState)),
+        .history_ids     = malloc(history_size * sizeof(uid_t)),
+        .visible         = calloc(max_planes, sizeof(u32)),
+        .visible_rates   = malloc(max_planes * sizeof(u32)),
+        .visible_bullets = malloc(max_planes * sizeof(BulletMask)),
+        .visible_list    = malloc(max_planes * sizeof(u32)),
+        .candidates      = malloc(max_planes * sizeof(SnapshotCandidate)),
+    };
+    if (!b->parts || !b->history || !b->history_ids || !b->visible ||
+        !b->visible_rates || !b->visible_bullets || !b->visible_list ||
+        !b->candidates ||
+        create_aoi_grid(&b->grid, max_planes))
+    {
+        log_error("Failed to allocate snapshot buffers");
+        destroy_snapshot_builder(b);
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+void destroy_snapshot_builder(SnapshotBuilder *b)
+{
+    free(b->parts);
+    free(b->history);
+    free(b->history_ids);
+    free(b->visible);
+    free(b->visible_rates);
+    free(b->visible_bullets);
+    free(b->visible_list);
+    free(b->candidates);
+    destroy_aoi_grid(&b->grid);
+    *b = (SnapshotBuilder){0};
+}
+
+void snapshot_builder_begin(
+    SnapshotBuilder *b, World *w, u32 tick, time_t update_time)
+{
+    b->part_count  = 0;
+    b->tick        = tick;
+    b->update_time = update_time;
+
+    size_t history_index            = tick % SNAPSHOT_HISTORY;
+    b->history_ticks[history_index] = tick;
+    b->planes = &b->history[history_index * b->max_planes];
+
+    uid_t *ids = &b->history_ids[history_index * b->max_planes];
+    for (size_t i = 0; i < w->plane_count; i++)
+    {
+        b->planes[i] = create_plane_state(&w->planes[i].plane);
+        ids[i]       = w->planes[i].id;
+    }
+
+    aoi_grid_build(&b->grid, w);
+}
+
+// add an empty part to the end of the snapshot, growing the buffer if needed.
+// Views only refer to parts by index, so moving the buffer is safe
+static struct SnapshotPacket *add_part(SnapshotBuilder *b)
+{
+    if (b->part_count == b->capacity)
+    {
+        size_t capacity = b->capacity * 2;
+        void *parts =
+            realloc(b->parts, capacity * sizeof(struct SnapshotPacket));
+        if (parts == NULL)
+        {
+            log_error("Failed to grow snapshot buffers");
+            return NULL;
+        }
+        b->parts    = parts;
+        b->capacity = capacity;
+    }
+
+    return &b->parts[b->part_count++];
+}
+
+// everything needed to write the planes of one client's view
+typedef struct ViewWriter
+{
+    uid_t viewer;
+    SnapshotView view;
+    u32 baseline_tick;
+    const SnapshotRecord *baseline; // NULL if sending everything in full
+    const PlaneState *baseline_planes;
+    const uid_t *baseline_ids;
+    SnapshotRecord *record;
+} ViewWriter;
+
+// find the state a client has for a plane in the baseline snapshot
+static const PlaneState *
+find_baseline(const ViewWriter *v, uid_t id, const BulletMask **bullets)
+{
+    if (v->baseline == NULL)
+        return NULL;
+    for (size_t i = 0; i < v->baseline->plane_count; i++)
+    {
+        if (v->baseline->planes[i].id != id)
+            continue;
+        // the plane may have been moved in the world since the baseline
+        u32 slot = v->baseline->planes[i].slot;
+        if (v->baseline_ids[slot] != id)
+            return NULL;
+        *bullets = &v->baseline->planes[i].bullets;
+        return &v->baseline_planes[slot];
+    }
+    return NULL;
+}
+
+// start a new part at the end of the view, returns NULL if there is no
+// memory for it
+static struct SnapshotPacket *begin_part(SnapshotBuilder *b, ViewWriter *v)
+{
+    struct SnapshotPacket *part = add_part(b);
+    if (part == NULL)
+        return NULL;
+    snapshot_begin(part, b->tick, v->baseline_tick, b->update_time);
+    v->view.part_count++;
+    return part;
+}
+
+// the part of the view being filled, or NULL if it has none yet
+static inline struct SnapshotPacket *
+last_part(SnapshotBuilder *b, ViewWriter *v)
+{
+    return v->view.part_count > 0 ? &b->parts[b->part_count - 1] : NULL;
+}
+
+static bool
+write_fire(SnapshotBuilder *b, ViewWriter *v, uid_t id, const FireEvent *fire)
+{
+    struct SnapshotPacket *part = last_part(b, v);
+    if (part != NULL && snapshot_write_fire(part, id, fire))
+        return true;
+    part = begin_part(b, v);
+    return part != NULL && snapshot_write_fire(part, id, fire);
+}
+
+// write a plane to the last part of the view, or a new part if it is full,
+// followed by the fire events of its bullets in bullets that the client does
+// not have yet. The plane is recorded so it can be used as a baseline later
+static void write_plane(
+    SnapshotBuilder *b,
+    ViewWriter *v,
+    const WorldPlane *world_plane,
+    u32 slot,
+    const BulletMask *bullets)
+{
+    uid_t id                           = world_plane->id;
+    const PlaneState *plane            = &b->planes[slot];
+    const BulletMask *baseline_bullets = NULL;
+    const PlaneState *baseline = find_baseline(v, id, &baseline_bullets);
+
+    struct SnapshotPacket *part = last_part(b, v);
+    if (part == NULL ||
+        snapshot_write_plane(part, id, plane, baseline) == false)
+    {
+        part = begin_part(b, v);
+        if (part == NULL)
+            return;
+        if (snapshot_write_plane(part, id, plane, baseline) == false)
+        {
+            log_error("Plane %i does not fit in a snapshot", id);
+            return;
+        }
+    }
+
+    // the client has the bullets that were sent by the baseline tick, unless
+    // their slot has been fired again since
+    BulletMask known     = {0};
+    const Bullet *active = world_plane->plane.active_bullets;
+    if (baseline_bullets != NULL)
+    {
+        for (size_t i = 0; bullet_mask_next(baseline_bullets, &i); i++)
+            if (active[i].used &&
+                world_plane->fired[i].tick <= v->baseline_tick)
+                bullet_mask_set(&known, i);
+    }
+
+    // the client fires its own bullets, so it is never sent them
+    for (size_t i = 0; id != v->viewer && bullet_mask_next(bullets, &i); i++)
+    {
+        if (active[i].used == false || bullet_mask_test(&known, i))
+            continue;
+        if (write_fire(b, v, id, &world_plane->fired[i]))
+            bullet_mask_set(&known, i);
+    }
+
+    SnapshotRecord *record = v->record;
+    if (record->plane_count == SNAPSHOT_FRAME_PLANES)
+    {
+        record->overflow = true;
+        return;
+    }
+    record->planes[record->plane_count].id      = id;
+    record->planes[record->plane_count].slot    = slot;
+    record->planes[record->plane_count].bullets = known;
+    record->plane_count++;
+}
+
+// pick the snapshot to delta against, if the client has one that is still
+// in the history
+static void
+choose_baseline(SnapshotBuilder *b, SnapshotClient *client, ViewWriter *v)
+{
+    u32 acked = client->acked_tick;
+    if (acked == 0 || b->tick - acked >= SNAPSHOT_HISTORY)
+        return;
+    size_t history_index         = acked % SNAPSHOT_HISTORY;
+    const SnapshotRecord *record = &client->records[history_index];
+    if (record->tick != acked || record->overflow ||
+        b->history_ticks[history_index] != acked)
+        return;
+
+    v->baseline_tick   = acked;
+    v->baseline        = record;
+    v->baseline_planes = &b->history[history_index * b->max_planes];
+    v->baseline_ids    = &b->history_ids[history_index * b->max_planes];
+}
+
+void snapshot_client_ack(SnapshotClient *client, u32 tick)
+{
+    // only acknowledge snapshots that were sent, and never go backwards
+    if (tick <= client->acked_tick ||
+        client->records[tick % SNAPSHOT_HISTORY].tick != tick)
+        return;
+    client->acked_tick = tick;
+}
+
+// mark a plane as in the view at rate, a plane in several tiers, through
+// its bullets, gets the fastest
+static inline void mark_visible(SnapshotBuilder *b, u32 plane, u32 rate)
+{
+    if (b->visible[plane] == b->view_stamp)
+    {
+        if (rate > b->visible_rates[plane])
+            b->visible_rates[plane] = rate;
+        return;
+    }
+    b->visible[plane]                   = b->view_stamp;
+    b->visible_rates[plane]             = rate;
+    b->visible_bullets[plane]           = (BulletMask){0};
+    b->visible_list[b->visible_count++] = plane;
+}
+
+// bytes written to the parts of a view so far
+static size_t view_size(const SnapshotBuilder *b, const ViewWriter *v)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < v->view.part_count; i++)
+        size += snapshot_view_part(b, v->view, i)->size;
+    return size;
+}
+
+// updates a second of planes distance cells from the viewer
+static u32 tier_rate(const SnapshotTiers *t, u32 distance)
+{
+    for (u32 i = 0; i < t->count; i++)
+    {
+        if (distance <= t->tiers[i].radius)
+            return t->tiers[i].rate;
+    }
+    return t->far_rate;
+}
+
+// add the plane in slot to the candidates of the view if it is due, which
+// it is once it has waited a second divided by its rate
+static void consider_plane(
+    SnapshotBuilder *b,
+    const World *w,
+    SnapshotClient *client,
+    u32 slot,
+    u32 rate)
+{
+    SnapshotPriority *sent = &client->priorities[slot];
+    if (sent->id != w->planes[slot].id)
+        *sent = (SnapshotPriority){.id = w->planes[slot].id};
+    f32 priority = (f32)rate * (b->tick - sent->sent_tick) / SERVER_TICK_RATE;
+    if (priority < 1)
+        return;
+    b->candidates[b->candidate_count++] = (SnapshotCandidate){
+        .slot     = slot,
+        .priority = priority,
+    };
+}
+
+static int compare_candidates(const void *a, const void *b)
+{
+    // highest priority first
+    f32 x = ((const SnapshotCandidate *)a)->priority;
+    f32 y = ((const SnapshotCandidate *)b)->priority;
+    return (x < y) - (x > y);
+}
+
+SnapshotView snapshot_builder_build_view(
+    SnapshotBuilder *b, World *w, uid_t viewer, SnapshotClient *client)
+{
+    ViewWriter v = {
+        .viewer          = viewer,
+        .view.first_part = b->part_count,
+        .record          = &client->records[b->tick % SNAPSHOT_HISTORY],
+    };
+    choose_baseline(b, client, &v);
+
+    // the record being replaced is never used as a baseline again, the
+    // client must have acknowledged a newer one to receive deltas
+    *v.record = (SnapshotRecord){.tick = b->tick};
+
+    // a new stamp hides every plane marked by the last view
+    if (++b->view_stamp == 0)
+    {
+        memset(b->visible, 0, w->capacity * sizeof(u32));
+        b->view_stamp = 1;
+    }
+    b->visible_count = 0;
+
+    // find the planes in the cells within the tiers, and the bullets in the
+    // cells around the viewer
+    const SnapshotTiers *tiers = &b->tiers;
+    i32 radius                 = GRID_VIEW_RADIUS;
+    if (tiers->count > 0 &&
+        (i32)tiers->tiers[tiers->count - 1].radius > radius)
+        radius = tiers->tiers[tiers->count - 1].radius;
+    WorldPlane *viewer_plane = world_find_plane(w, viewer);
+    if (viewer_plane != NULL)
+    {
+        const i32 *center = b->grid.plane_cells[viewer_plane - w->planes];
+        for (i32 y = -radius; y <= radius; y++)
+        {
+            for (i32 x = -radius; x <= radius; x++)
+            {
+                ivec2 coordinate    = {center[0] + x, center[1] + y};
+                const AoiCell *cell = aoi_grid_find(&b->grid, coordinate);
+                if (cell == NULL)
+                    continue;
+                u32 distance = abs(x) > abs(y) ? abs(x) : abs(y);
+                u32 rate     = tier_rate(tiers, distance);
+
+                u32 p = cell->first_plane;
+                for (; p != AOI_NONE; p = b->grid.next_plane[p])
+                    mark_visible(b, p, rate);
+                if (distance > GRID_VIEW_RADIUS)
+                    continue;
+
+                u32 i = cell->first_bullet;
+                for (; i != AOI_NONE; i = b->grid.bullets[i].next)
+                {
+                    const AoiBullet *bullet = &b->grid.bullets[i];
+                    mark_visible(b, bullet->plane, rate);
+                    bullet_mask_set(
+                        &b->visible_bullets[bullet->plane], bullet->slot);
+                }
+            }
+        }
+    }
+
+    // the viewer's own plane is always sent, first, for the client to
+    // correct its prediction
+    b->candidate_count = 0;
+    u32 viewer_slot    = AOI_NONE;
+    if (viewer_plane != NULL)
+    {
+        viewer_slot = viewer_plane - w->planes;
+        write_plane(
+            b,
+            &v,
+            viewer_plane,
+            viewer_slot,
+            &b->visible_bullets[viewer_slot]);
+    }
+    for (size_t i = 0; i < b->visible_count; i++)
+    {
+        u32 p = b->visible_list[i];
+        if (p != viewer_slot)
+            consider_plane(b, w, client, p, b->visible_rates[p]);
+    }
+
+    // planes beyond the tiers, enough of them a tick that each is looked at
+    // as often as it is due, so the client still knows roughly where
+    // everyone is
+    size_t checks = w->plane_count * tiers->far_rate / SERVER_TICK_RATE + 1;
+    if (checks < SNAPSHOT_DISTANT_CHECKS)
+        checks = SNAPSHOT_DISTANT_CHECKS;
+    if (checks > w->plane_count)
+        checks = w->plane_count;
+    for (size_t n = 0; n < checks; n++)
+    {
+        size_t p               = client->distant_cursor % w->plane_count;
+        client->distant_cursor = p + 1;
+        if (b->visible[p] != b->view_stamp)
+            consider_plane(b, w, client, p, tiers->far_rate);
+    }
+
+    // fill the budget with the planes that waited the longest for their
+    // rate, only planes around the viewer have bullets to send
+    qsort(
+        b->candidates,
+        b->candidate_count,
+        sizeof(SnapshotCandidate),
+        compare_candidates);
+    const BulletMask no_bullets = {0};
+    for (size_t i = 0; i < b->candidate_count; i++)
+    {
+        if (v.record->plane_count == SNAPSHOT_FRAME_PLANES ||
+            view_size(b, &v) >= SNAPSHOT_VIEW_BUDGET)
+            break;
+        u32 p                   = b->candidates[i].slot;
+        const BulletMask *fired = &no_bullets;
+        if (b->visible[p] == b->view_stamp)
+            fired = &b->visible_bullets[p];
+        write_plane(b, &v, &w->planes[p], p, fired);
+        client->priorities[p].sent_tick = b->tick;
+    }
+
+    // let the client know how many parts to wait for before acknowledging,
+    // a view too large to count can never be acknowledged
+    u8 part_count = v.view.part_count < UINT8_MAX ? v.view.part_count : 0;
+    for (size_t i = 0; i < v.view.part_count; i++)
+    {
+        struct SnapshotPacket *part = snapshot_view_part(b, v.view, i);
+
+        part->part       = i;
+        part->part_count = part_count;
+    }
+
+    return v.view;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+/*
+ * Collects the latest state of every plane in the world once per tick and
+ * packs what each client can see into as few snapshot packets as possible.
+ * Bullets in the cells around the client are sent once each, as the fire
+ * event that spawned them, and the client simulates them from there.
+ *
+ * Each client has a budget of bytes a tick, and its planes are scheduled
+ * into it by priority. How often a plane is due depends on its distance
+ * from the client's plane, counted in grid cells, which are the chunks the
+ * client draws: the tiers give an update rate for each ring of cells
+ * around the client, and planes beyond the last ring are sent at the far
+ * rate, a few of them looked at each tick. A plane's priority grows with
+ * the ticks since the client was last sent it by its rate, and the due
+ * planes with the highest priority are sent until the budget is spent, the
+ * rest gaining priority until they are, so in a crowd every plane is sent
+ * less often instead of packets being lost at random. The client moves the
+ * planes it hears from less often along their heading in between.
+ *
+ * Planes are delta encoded against the newest snapshot the client has
+ * acknowledged. To do that the state of the world is kept for the last
+ * SNAPSHOT_HISTORY ticks, and each client keeps a record of the planes and
+ * bullets it has on those ticks. If the client has not acknowledged a
+ * snapshot that is still in the history, everything is sent in full.
+ *
+ * The packets are kept until the next tick, so they can be queued for the
+ * clients without being copied.
+ */
+
+#include "aoi_grid.h"
+#include <snapshot.h>
+
+// bytes of planes and fire events a client is sent a tick, the last plane
+// to fit can go over it
+#define SNAPSHOT_VIEW_BUDGET (2 * MAX_SNAPSHOT_DATA)
+// fewest planes beyond the tiers looked at a tick, clients cycle through
+// the rest
+#define SNAPSHOT_DISTANT_CHECKS 16
+#define SNAPSHOT_MAX_TIERS 4
+// furthest ring of cells a tier can reach, every cell within it is looked
+// at for each view
+#define SNAPSHOT_MAX_TIER_RADIUS 8
+
+// planes up to radius cells from the client's plane are sent rate times a
+// second, at most every tick and at least SNAPSHOT_MIN_RATE times
+typedef struct SnapshotTier
+{
+    u32 radius;
+    u32 rate;
+} SnapshotTier;
+
+typedef struct SnapshotTiers
+{
+    u32 count;
+    SnapshotTier tiers[SNAPSHOT_MAX_TIERS]; // nearest first
+    u32 far_rate; // planes beyond the last tier
+} SnapshotTiers;
+
+// every tick in the view, 15 times a second in the cells near it and 5
+// times a second anywhere else
+#define SNAPSHOT_DEFAULT_TIERS                                                 \
+    ((SnapshotTiers){                                                          \
+        .count    = 2,                                                         \
+        .tiers    = {{GRID_VIEW_RADIUS, SERVER_TICK_RATE}, {3, 15}},           \
+        .far_rate = 5,                                                         \
+    })
+
+// the parts packed for one client
+typedef struct SnapshotView
+{
+    size_t first_part;
+    size_t part_count;
+} SnapshotView;
+
+// what one client was sent on a tick
+typedef struct SnapshotRecord
+{
+    u32 tick;
+    bool overflow; // not every plane fit, so the record cannot be a baseline
+    size_t plane_count;
+    struct
+    {
+        uid_t id;
+        u32 slot;           // index of the plane in the world on the tick
+        BulletMask bullets; // bullets the client has been sent
+    } planes[SNAPSHOT_FRAME_PLANES];
+} SnapshotRecord;
+
+// when a client was last sent the plane in one world slot
+typedef struct SnapshotPriority
+{
+    uid_t id; // the plane in the slot then, another plane was never sent
+    u32 sent_tick;
+} SnapshotPriority;
+
+// snapshot state kept for each client
+typedef struct SnapshotClient
+{
+    size_t distant_cursor; // next plane beyond the tiers to look at
+    u32 acked_tick;        // newest snapshot the client has in full
+    SnapshotRecord records[SNAPSHOT_HISTORY];
+    // max_planes of the builder, by the world slot of each plane
+    SnapshotPriority *priorities;
+} SnapshotClient;
+
+// a plane due to be sent in the view being built
+typedef struct SnapshotCandidate
+{
+    u32 slot;
+    f32 priority;
+} SnapshotCandidate;
+
+typedef struct SnapshotBuilder
+{
+    struct SnapshotPacket *parts;
+    size_t part_count;
+    size_t capacity;
+
+    u32 tick;
+    time_t update_time;
+
+    AoiGrid grid;
+    size_t max_planes;
+    SnapshotTiers tiers;
+
+    // state of each world plane on the last SNAPSHOT_HISTORY ticks, each
+    // tick is max_planes long and is stored at tick % SNAPSHOT_HISTORY
+    PlaneState *history;
+    uid_t *history_ids;
+    u32 history_ticks[SNAPSHOT_HISTORY];
+    PlaneState *planes; // the current tick in history
+
+    // planes within the tiers of the view being built, visible holds the
+    // stamp of the last view a plane was in
+    u32 view_stamp;
+    u32 *visible;
+    u32 *visible_rates; // the rate of the nearest tier the plane is in
+    BulletMask *visible_bullets;
+    u32 *visible_list;
+    size_t visible_count;
+    SnapshotCandidate *candidates;
+    size_t candidate_count;
+} SnapshotBuilder;
+
+Result create_snapshot_builder(SnapshotBuilder *b, size_t max_planes);
+void destroy_snapshot_builder(SnapshotBuilder *b);
+
+// capture the state of every plane for this tick and sort the world into
+// the grid, dropping the previous tick's packets
+void snapshot_builder_begin(
+    SnapshotBuilder *b, World *w, u32 tick, time_t update_time);
+
+// pack what the plane with id viewer can see into its budget. client should
+// start zeroed, with priorities pointing at max_planes zeroed entries. The
+// world must not change between begin and the last view
+NONULL(1, 2, 4)
+SnapshotView snapshot_builder_build_view(
+    SnapshotBuilder *b, World *w, uid_t viewer, SnapshotClient *client);
+
+// note that a client has received every part of a snapshot
+void snapshot_client_ack(SnapshotClient *client, u32 tick);
+
+static inline struct SnapshotPacket *
+snapshot_view_part(const SnapshotBuilder *b, SnapshotView view, size_t i)
+{
+    return &b->parts[view.first_part + i];
+}
@@ -0,0 +1,80 @@
+#include "tick_timer.h"
+#include <errno.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <messenger.h>
+
+Result create_tick_timer(TickTimer *t, u32 rate, const struct timespec *start)
+{
+    if (rate == 0 || rate > 1000)
+    {
+        log_error("Invalid tick rate %u", rate);
+        return RS_FAILURE;
+    }
+
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1)
+    {
+        log_error("Failed to create tick timer");
+        return RS_FAILURE;
+    }
+
+    const long interval_ns = 1000000000L / rate;
+    struct itimerspec spec = {
+        .it_interval = {.tv_sec = 0, .tv_nsec = interval_ns},
+        .it_value    = {.tv_sec = 0, .tv_nsec = interval_ns},
+    };
+    int flags = 0;
+    if (start != NULL)
+    {
+        // an absolute start in the past reports the ticks since then
+        spec.it_value = *start;
+        flags         = TFD_TIMER_ABSTIME;
+    }
+    if (timerfd_settime(fd, flags, &spec, NULL) == -1)
+    {
+        log_error("Failed to start tick timer");
+        close(fd);
+        return RS_FAILURE;
+    }
+
+    *t = (TickTimer){
+        .fd    = fd,
+        .rate  = rate,
+        .delta = 1.f / rate,
+    };
+    return RS_SUCCESS;
+}
+
+void destroy_tick_timer(TickTimer *t)
+{
+    if (t->fd != -1)
+        close(t->fd);
+    t->fd = -1;
+}
+
+u64 tick_timer_consume(TickTimer *t)
+{
+    // the timerfd counts every expiration since the last read, so ticks
+    // missed while the server was busy are still reported here
+    u64 expirations = 0;
+    if (read(t->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            log_error("Error reading tick timer");
+        return 0;
+    }
+
+    if (expirations > TICK_TIMER_MAX_CATCHUP)
+    {
+        log_warning(
+            "Server is %lu ticks of its %u Hz timer behind, skipping ahead",
+            expirations - TICK_TIMER_MAX_CATCHUP,
+            t->rate);
+        t->dropped += expirations - TICK_TIMER_MAX_CATCHUP;
+        expirations = TICK_TIMER_MAX_CATCHUP;
+    }
+
+    t->tick += expirations;
+    return expirations;
+}
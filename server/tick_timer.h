@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * Fixed rate simulation clock for the server, backed by a timerfd.
+ * The timer is armed against CLOCK_MONOTONIC with a fixed interval, so late
+ * wakeups do not push back later ticks. Any ticks missed while the server
+ * was busy are reported so the simulation can catch up instead of drifting
+ * behind real time.
+ */
+
+#include <types.h>
+#include <time.h>
+
+// the most ticks simulated at once after a stall, any more are dropped
+#define TICK_TIMER_MAX_CATCHUP 8
+
+typedef struct TickTimer
+{
+    int fd;
+    u32 rate;    // ticks per second
+    f32 delta;   // seconds simulated by each tick
+    u64 tick;    // number of ticks consumed since the timer started
+    u64 dropped; // ticks skipped because the server fell too far behind
+} TickTimer;
+
+// start a timer which ticks rate times per second. start is the
+// CLOCK_MONOTONIC time of the first tick, or NULL to tick one interval from
+// now. Timers with the same start and rate tick together
+Result create_tick_timer(TickTimer *t, u32 rate, const struct timespec *start);
+void destroy_tick_timer(TickTimer *t);
+
+// read how many ticks have elapsed since the last call, at most
+// TICK_TIMER_MAX_CATCHUP. Returns 0 if the timer has not fired
+u64 tick_timer_consume(TickTimer *t);
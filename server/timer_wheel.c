@@ -0,0 +1,114 @@
+#include "timer_wheel.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <messenger.h>
+
+Result create_timer_wheel(TimerWheel *w, size_t capacity, u32 span)
+{
+    size_t slot_count = 1;
+    while (slot_count <= span)
+        slot_count <<= 1;
+
+    *w = (TimerWheel){
+        .slots     = malloc(slot_count * sizeof(u32)),
+        .slot_mask = slot_count - 1,
+        .next      = malloc(capacity * sizeof(u32)),
+        .prev      = malloc(capacity * sizeof(u32)),
+        .deadlines = malloc(capacity * sizeof(u32)),
+        .scheduled = calloc(capacity, sizeof(bool)),
+    };
+    if (!w->slots || !w->next || !w->prev || !w->deadlines || !w->scheduled)
+    {
+        log_error("Failed to allocate timer wheel");
+        destroy_timer_wheel(w);
+        return RS_FAILURE;
+    }
+    memset(w->slots, 0xff, slot_count * sizeof(u32));
+    return RS_SUCCESS;
+}
+
+void destroy_timer_wheel(TimerWheel *w)
+{
+    free(w->slots);
+    free(w->next);
+    free(w->prev);
+    free(w->deadlines);
+    free(w->scheduled);
+    *w = (TimerWheel){0};
+}
+
+void timer_wheel_add(TimerWheel *w, u32 timer, u32 deadline)
+{
+    assert(w->scheduled[timer] == false);
+
+    // every timer in a slot is due on the same tick, so nothing can be
+    // scheduled a whole turn of the wheel ahead
+    i32 ahead = (i32)(deadline - w->tick);
+    if (ahead < 0)
+        deadline = w->tick;
+    else if ((u32)ahead > w->slot_mask)
+        deadline = w->tick + w->slot_mask;
+
+    u32 *slot = &w->slots[deadline & w->slot_mask];
+    if (*slot != TIMER_NONE)
+        w->prev[*slot] = timer;
+    w->next[timer]      = *slot;
+    w->prev[timer]      = TIMER_NONE;
+    w->deadlines[timer] = deadline;
+    w->scheduled[timer] = true;
+    *slot               = timer;
+}
+
+void timer_wheel_remove(TimerWheel *w, u32 timer)
+{
+    if (w->scheduled[timer] == false)
+        return;
+    u32 next = w->next[timer];
+    u32 prev = w->prev[timer];
+    if (prev != TIMER_NONE)
+        w->next[prev] = next;
+    else
+        w->slots[w->deadlines[timer] & w->slot_mask] = next;
+    if (next != TIMER_NONE)
+        w->prev[next] = prev;
+    w->scheduled[timer] = false;
+}
+
+void timer_wheel_move(TimerWheel *w, u32 from, u32 to)
+{
+    timer_wheel_remove(w, to);
+    if (w->scheduled[from] == false)
+        return;
+
+    u32 next = w->next[from];
+    u32 prev = w->prev[from];
+    if (prev != TIMER_NONE)
+        w->next[prev] = to;
+    else
+        w->slots[w->deadlines[from] & w->slot_mask] = to;
+    if (next != TIMER_NONE)
+        w->prev[next] = to;
+
+    w->next[to]        = next;
+    w->prev[to]        = prev;
+    w->deadlines[to]   = w->deadlines[from];
+    w->scheduled[to]   = true;
+    w->scheduled[from] = false;
+}
+
+bool timer_wheel_pop(TimerWheel *w, u32 tick, u32 *timer)
+{
+    // the wheel stops on a slot until it is empty, then moves on
+    for (; (i32)(tick - w->tick) >= 0; w->tick++)
+    {
+        u32 first = w->slots[w->tick & w->slot_mask];
+        if (first == TIMER_NONE)
+            continue;
+        assert(w->deadlines[first] == w->tick);
+        timer_wheel_remove(w, first);
+        *timer = first;
+        return true;
+    }
+    return false;
+}
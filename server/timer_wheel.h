@@ -0,0 +1,51 @@
+#pragma once
+
+/*
+ * Hashed timer wheel. Each timer is due on a tick, and is kept in a list
+ * for that tick modulo the number of slots. Advancing the wheel only looks
+ * at the slots of the ticks that have passed, so the cost per tick does not
+ * grow with the number of timers, only with the number that are due.
+ *
+ * Timers are numbered by the caller from 0 to capacity - 1, and the lists
+ * are linked through arrays indexed by timer, so the wheel never allocates
+ * after it is created.
+ */
+
+#include <types.h>
+#include <stddef.h>
+
+// end of a slot's list
+#define TIMER_NONE UINT32_MAX
+
+typedef struct TimerWheel
+{
+    u32 *slots;       // first timer due in each slot
+    size_t slot_mask; // slot count - 1, the slot count is a power of 2
+    u32 tick;         // the first tick that has not been advanced past
+
+    // per timer
+    u32 *next;
+    u32 *prev;
+    u32 *deadlines;
+    bool *scheduled;
+} TimerWheel;
+
+// timers can be scheduled at most span ticks ahead
+Result create_timer_wheel(TimerWheel *w, size_t capacity, u32 span);
+void destroy_timer_wheel(TimerWheel *w);
+
+// schedule a timer that is not scheduled yet. A deadline too far ahead is
+// brought forward to the furthest tick the wheel can hold, and one that has
+// passed is due on the next tick advanced
+NONULL(1) void timer_wheel_add(TimerWheel *w, u32 timer, u32 deadline);
+
+// unschedule a timer, which may not be scheduled
+NONULL(1) void timer_wheel_remove(TimerWheel *w, u32 timer);
+
+// renumber a timer, to follow the thing it times when that moves. The
+// timer to is overwritten
+NONULL(1) void timer_wheel_move(TimerWheel *w, u32 from, u32 to);
+
+// advance the wheel to tick and unschedule the first timer that is due,
+// returns false when no timers are due
+NONULL(1, 3) bool timer_wheel_pop(TimerWheel *w, u32 tick, u32 *timer);
@@ -0,0 +1,28 @@
+#include "token_bucket.h"
+#include <utils.h>
+
+bool token_bucket_take(TokenBucket *b, u32 rate, u32 burst, time_t now)
+{
+    // whole tokens only, the time of a partly earned token is kept for the
+    // next take. A clock going backwards earns nothing
+    u64 earned = 0;
+    if (now > b->updated)
+        earned = (u64)(now - b->updated) * rate / SEC_TO_MICROSEC;
+    if (earned > 0)
+    {
+        if (b->tokens + earned >= burst)
+        {
+            b->tokens  = burst;
+            b->updated = now;
+        }
+        else
+        {
+            b->tokens += earned;
+            b->updated += earned * SEC_TO_MICROSEC / rate;
+        }
+    }
+    if (b->tokens == 0)
+        return false;
+    b->tokens--;
+    return true;
+}
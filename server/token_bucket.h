@@ -0,0 +1,27 @@
+#pragma once
+
+/*
+ * Rate limiting of the datagrams from a sender. A bucket holds up to burst
+ * tokens and gains rate tokens a second, and every datagram takes one, so a
+ * sender can keep up rate datagrams a second after a burst of that many.
+ * Tokens are only added when one is taken, so an idle bucket costs nothing.
+ */
+
+#include <sys/types.h>
+#include <types.h>
+
+typedef struct TokenBucket
+{
+    u32 tokens;
+    time_t updated; // microseconds, the tokens are up to date until then
+} TokenBucket;
+
+// a full bucket at time now
+static inline TokenBucket token_bucket_full(u32 burst, time_t now)
+{
+    return (TokenBucket){.tokens = burst, .updated = now};
+}
+
+// take a token at time now, returns false if the bucket is empty
+NONULL(1)
+bool token_bucket_take(TokenBucket *b, u32 rate, u32 burst, time_t now);
@@ -0,0 +1,526 @@
+#define _GNU_SOURCE // struct mmsghdr
+#include "uring_io.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <messenger.h>
+#include <udp_socket.h>
+
+// sendmsg requests that can be queued before they must be submitted
+#define URING_IO_SQ_ENTRIES 1024
+// room for a full submission queue of sends, every receive buffer and the
+// polls, so completions are never waiting on the kernel
+#define URING_IO_CQ_ENTRIES 4096
+// id of the buffer ring among the ring's provided buffers
+#define URING_IO_BUFFER_GROUP 0
+
+// what a completion is for, in the upper half of its user data. The lower
+// half is the index of the message or watched fd
+#define URING_IO_RECV (1ull << 32)
+#define URING_IO_SEND (2ull << 32)
+#define URING_IO_POLL (3ull << 32)
+
+// the rings are shared with the kernel, which reads the tails the server
+// moves and writes the heads, so they are accessed with acquire and release
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+struct UringIO
+{
+    int ring_fd;
+    int socket;
+
+    void *rings;
+    size_t rings_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    // submission queue, sq_tail is ahead of the kernel's until submitted
+    u32 *sq_head;
+    u32 *sq_ktail;
+    u32 sq_mask;
+    u32 sq_entries;
+    u32 sq_tail;
+
+    // completion queue
+    u32 *cq_head;
+    u32 *cq_tail;
+    u32 cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // receive buffers, and the ring that gives them to the kernel
+    struct io_uring_buf_ring *buffer_ring;
+    size_t buffer_ring_size;
+    u16 buffer_tail;
+    u8 *buffers;
+    size_t buffer_size;
+    struct msghdr recv_msg; // the layout of the buffers, read by the kernel
+    bool recv_armed;
+
+    // buffers holding received datagrams in order, first those handed out
+    // by the last wait, then those waiting for the next
+    u16 queue[URING_IO_BUFFERS];
+    size_t queue_start;
+    size_t queue_count;
+    size_t handed_out;
+
+    int watched[URING_IO_WATCH_COUNT];
+    bool poll_armed[URING_IO_WATCH_COUNT];
+    bool readable[URING_IO_WATCH_COUNT]; // since the last wait
+    bool ready[URING_IO_WATCH_COUNT];    // during the last wait
+    size_t watch_count;
+
+    int *send_results;
+    size_t sends_in_flight;
+};
+
+static int uring_enter(
+    int fd, u32 to_submit, u32 min_complete, u32 flags, void *arg, size_t size)
+{
+    return syscall(
+        __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size);
+}
+
+// submit the queued requests and wait for wait_count completions, or up to
+// timeout_ms if it is not negative. Returns -1 with errno set on error,
+// including ETIME on timeout
+static int submit_and_wait(UringIO *u, u32 wait_count, int timeout_ms)
+{
+    store_release(u->sq_ktail, u->sq_tail);
+    u32 to_submit = u->sq_tail - load_acquire(u->sq_head);
+
+    struct __kernel_timespec timeout = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_nsec = timeout_ms % 1000 * 1000000L,
+    };
+    struct io_uring_getevents_arg arg = {
+        .ts = timeout_ms >= 0 ? (u64)&timeout : 0,
+    };
+    u32 flags = IORING_ENTER_EXT_ARG;
+    if (wait_count > 0)
+        flags |= IORING_ENTER_GETEVENTS;
+    return uring_enter(
+        u->ring_fd, to_submit, wait_count, flags, &arg, sizeof(arg)) < 0
+               ? -1
+               : 0;
+}
+
+// take back the requests a failed enter left unsubmitted, returning how
+// many were sends. Those keep -ECANCELED as their result, and a receive or
+// poll taken back is armed again by the next wait
+static size_t retract(UringIO *u)
+{
+    u32 head     = load_acquire(u->sq_head);
+    size_t sends = 0;
+    for (u32 i = head; i != u->sq_tail; i++)
+    {
+        u64 user_data = u->sqes[i & u->sq_mask].user_data;
+        u64 kind      = user_data & ~(u64)UINT32_MAX;
+        size_t index  = user_data & UINT32_MAX;
+        if (kind == URING_IO_SEND)
+            sends++;
+        else if (kind == URING_IO_RECV)
+            u->recv_armed = false;
+        else if (kind == URING_IO_POLL)
+            u->poll_armed[index] = false;
+    }
+    u->sq_tail = head;
+    store_release(u->sq_ktail, head);
+    return sends;
+}
+
+// get a zeroed request to fill in, submitting the queue if it is full
+static struct io_uring_sqe *get_sqe(UringIO *u)
+{
+    if (u->sq_tail - load_acquire(u->sq_head) == u->sq_entries)
+        submit_and_wait(u, 0, -1);
+    // a failed submit leaves the queue full, the oldest request would be
+    // overwritten and never complete
+    if (u->sq_tail - load_acquire(u->sq_head) == u->sq_entries)
+        u->sends_in_flight -= retract(u);
+    struct io_uring_sqe *sqe = &u->sqes[u->sq_tail++ & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// give buffers back to the kernel to receive into
+static void give_buffers(UringIO *u, const u16 *ids, size_t count)
+{
+    u16 mask = URING_IO_BUFFERS - 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        // the ring's tail overlays the first entry's reserved field, so
+        // entries are written field by field
+        struct io_uring_buf *b = &u->buffer_ring->bufs[u->buffer_tail & mask];
+        b->addr = (u64)(u->buffers + ids[i] * u->buffer_size);
+        b->len  = u->buffer_size;
+        b->bid  = ids[i];
+        u->buffer_tail++;
+    }
+    store_release(&u->buffer_ring->tail, u->buffer_tail);
+}
+
+// queue the receive and polls that the kernel has finished with
+static void arm(UringIO *u)
+{
+    if (u->recv_armed == false)
+    {
+        struct io_uring_sqe *sqe = get_sqe(u);
+        sqe->opcode              = IORING_OP_RECVMSG;
+        sqe->fd                  = u->socket;
+        sqe->addr                = (u64)&u->recv_msg;
+        sqe->len                 = 1;
+        sqe->ioprio              = IORING_RECV_MULTISHOT;
+        sqe->flags               = IOSQE_BUFFER_SELECT;
+        sqe->buf_group           = URING_IO_BUFFER_GROUP;
+        sqe->user_data           = URING_IO_RECV;
+        u->recv_armed            = true;
+    }
+    for (size_t i = 0; i < u->watch_count; i++)
+    {
+        if (u->poll_armed[i])
+            continue;
+        struct io_uring_sqe *sqe = get_sqe(u);
+        sqe->opcode              = IORING_OP_POLL_ADD;
+        sqe->fd                  = u->watched[i];
+        sqe->poll32_events       = POLLIN;
+        sqe->len                 = IORING_POLL_ADD_MULTI;
+        sqe->user_data           = URING_IO_POLL | i;
+        u->poll_armed[i]         = true;
+    }
+}
+
+static void handle_completion(UringIO *u, const struct io_uring_cqe *cqe)
+{
+    u64 kind     = cqe->user_data & ~(u64)UINT32_MAX;
+    size_t index = cqe->user_data & UINT32_MAX;
+    bool more    = cqe->flags & IORING_CQE_F_MORE;
+    switch (kind)
+    {
+    case URING_IO_RECV:
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            size_t slot = (u->queue_start + u->handed_out + u->queue_count++) %
+                          URING_IO_BUFFERS;
+            u->queue[slot] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        }
+        // running out of buffers ends the receive, it is armed again once
+        // the server has given some back
+        if (cqe->res < 0 && cqe->res != -ENOBUFS)
+            log_warning("Error receiving packets: %s", strerror(-cqe->res));
+        u->recv_armed = more;
+        break;
+    case URING_IO_SEND:
+        u->send_results[index] = cqe->res;
+        u->sends_in_flight--;
+        break;
+    case URING_IO_POLL:
+        if (cqe->res > 0)
+            u->readable[index] = true;
+        u->poll_armed[index] = more;
+        break;
+    }
+}
+
+static void reap(UringIO *u)
+{
+    u32 head = *u->cq_head;
+    u32 tail = load_acquire(u->cq_tail);
+    for (; head != tail; head++)
+        handle_completion(u, &u->cqes[head & u->cq_mask]);
+    store_release(u->cq_head, head);
+}
+
+static Result map_rings(UringIO *u, const struct io_uring_params *p)
+{
+    // with a single mmap the completion ring follows the submission ring
+    size_t sq_size = p->sq_off.array + p->sq_entries * sizeof(u32);
+    size_t cq_size =
+        p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    u->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    u->rings      = mmap(
+        NULL,
+        u->rings_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        u->ring_fd,
+        IORING_OFF_SQ_RING);
+    if (u->rings == MAP_FAILED)
+    {
+        u->rings = NULL;
+        return RS_FAILURE;
+    }
+    u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes      = mmap(
+        NULL,
+        u->sqes_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        u->ring_fd,
+        IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = NULL;
+        return RS_FAILURE;
+    }
+
+    u8 *rings     = u->rings;
+    u->sq_head    = (u32 *)(rings + p->sq_off.head);
+    u->sq_ktail   = (u32 *)(rings + p->sq_off.tail);
+    u->sq_mask    = *(u32 *)(rings + p->sq_off.ring_mask);
+    u->sq_entries = p->sq_entries;
+    u->sq_tail    = *u->sq_ktail;
+    u->cq_head    = (u32 *)(rings + p->cq_off.head);
+    u->cq_tail    = (u32 *)(rings + p->cq_off.tail);
+    u->cq_mask    = *(u32 *)(rings + p->cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe *)(rings + p->cq_off.cqes);
+
+    // requests are always submitted in order, so the indirection array is
+    // set up once to point every slot at its own request
+    u32 *array = (u32 *)(rings + p->sq_off.array);
+    for (u32 i = 0; i < p->sq_entries; i++)
+        array[i] = i;
+    return RS_SUCCESS;
+}
+
+static Result register_buffers(UringIO *u, size_t buffer_size)
+{
+    // a buffer starts with the recvmsg header, the sender's address and the
+    // control messages, the datagram follows aligned for any packet
+    u->recv_msg = (struct msghdr){
+        .msg_namelen    = sizeof(struct sockaddr),
+        .msg_controllen = UDP_SOCKET_CONTROL_SIZE,
+    };
+    size_t header = sizeof(struct io_uring_recvmsg_out) +
+                    sizeof(struct sockaddr) + UDP_SOCKET_CONTROL_SIZE;
+    u->buffer_size      = (header + buffer_size + 63) & ~(size_t)63;
+    u->buffers          = aligned_alloc(64, URING_IO_BUFFERS * u->buffer_size);
+    u->buffer_ring_size = URING_IO_BUFFERS * sizeof(struct io_uring_buf);
+    u->buffer_ring      = mmap(
+        NULL,
+        u->buffer_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    if (u->buffers == NULL || u->buffer_ring == MAP_FAILED)
+    {
+        u->buffer_ring = NULL;
+        return RS_FAILURE;
+    }
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr    = (u64)u->buffer_ring,
+        .ring_entries = URING_IO_BUFFERS,
+        .bgid         = URING_IO_BUFFER_GROUP,
+    };
+    if (syscall(
+            __NR_io_uring_register,
+            u->ring_fd,
+            IORING_REGISTER_PBUF_RING,
+            &reg,
+            1) < 0)
+        return RS_FAILURE;
+
+    u16 ids[URING_IO_BUFFERS];
+    for (size_t i = 0; i < URING_IO_BUFFERS; i++)
+        ids[i] = i;
+    give_buffers(u, ids, URING_IO_BUFFERS);
+    return RS_SUCCESS;
+}
+
+UringIO *create_uring_io(int socket, size_t buffer_size)
+{
+    UringIO *u = calloc(1, sizeof(UringIO));
+    if (u == NULL)
+    {
+        log_error("Failed to allocate io_uring");
+        return NULL;
+    }
+    u->socket = socket;
+
+    // one request failing to start must not stop the ones after it, and
+    // completions wait for the worker to enter the kernel rather than
+    // interrupting it
+    struct io_uring_params p = {
+        .flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+                 IORING_SETUP_COOP_TASKRUN,
+        .cq_entries = URING_IO_CQ_ENTRIES,
+    };
+    u->ring_fd = syscall(__NR_io_uring_setup, URING_IO_SQ_ENTRIES, &p);
+    if (u->ring_fd < 0)
+    {
+        log_warning("io_uring is not available: %s", strerror(errno));
+        free(u);
+        return NULL;
+    }
+    u32 needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG |
+                 IORING_FEAT_NODROP;
+    if ((p.features & needed) != needed || map_rings(u, &p) != RS_SUCCESS ||
+        register_buffers(u, buffer_size) != RS_SUCCESS)
+    {
+        log_warning("io_uring lacks the features the server needs");
+        destroy_uring_io(u);
+        return NULL;
+    }
+
+    // a kernel without multishot recvmsg fails the first receive, which is
+    // only seen once it is submitted
+    arm(u);
+    submit_and_wait(u, 0, -1);
+    reap(u);
+    if (u->recv_armed == false)
+    {
+        log_warning("io_uring lacks multishot receives");
+        destroy_uring_io(u);
+        return NULL;
+    }
+    return u;
+}
+
+void destroy_uring_io(UringIO *u)
+{
+    if (u == NULL)
+        return;
+    // closing the ring cancels the receive and polls
+    if (u->ring_fd >= 0)
+        close(u->ring_fd);
+    if (u->rings != NULL)
+        munmap(u->rings, u->rings_size);
+    if (u->sqes != NULL)
+        munmap(u->sqes, u->sqes_size);
+    if (u->buffer_ring != NULL)
+        munmap(u->buffer_ring, u->buffer_ring_size);
+    free(u->buffers);
+    free(u);
+}
+
+Result uring_io_watch(UringIO *u, int fd)
+{
+    if (u->watch_count == URING_IO_WATCH_COUNT)
+    {
+        log_error("Too many fds watched by io_uring");
+        return RS_FAILURE;
+    }
+    u->watched[u->watch_count++] = fd;
+    return RS_SUCCESS;
+}
+
+bool uring_io_ready(const UringIO *u, int fd)
+{
+    for (size_t i = 0; i < u->watch_count; i++)
+        if (u->watched[i] == fd)
+            return u->ready[i];
+    return false;
+}
+
+// check if a wait has anything to report without waiting
+static bool has_events(const UringIO *u)
+{
+    if (u->queue_count > 0)
+        return true;
+    for (size_t i = 0; i < u->watch_count; i++)
+        if (u->readable[i])
+            return true;
+    return false;
+}
+
+int uring_io_wait(
+    UringIO *u, int timeout_ms, UringDatagram *datagrams, size_t max)
+{
+    // the previous datagrams are done with, their buffers go back first so
+    // a receive that ran out of them can start again straight away
+    u16 done[URING_IO_BUFFERS];
+    for (size_t i = 0; i < u->handed_out; i++)
+        done[i] = u->queue[(u->queue_start + i) % URING_IO_BUFFERS];
+    give_buffers(u, done, u->handed_out);
+    u->queue_start = (u->queue_start + u->handed_out) % URING_IO_BUFFERS;
+    u->handed_out  = 0;
+
+    reap(u);
+    arm(u);
+    u32 wait_count = has_events(u) ? 0 : 1;
+    if (submit_and_wait(u, wait_count, timeout_ms) != 0 && errno != ETIME &&
+        errno != EINTR)
+    {
+        log_error("Error waiting for io_uring: %s", strerror(errno));
+        return -1;
+    }
+    reap(u);
+
+    for (size_t i = 0; i < u->watch_count; i++)
+    {
+        u->ready[i]    = u->readable[i];
+        u->readable[i] = false;
+    }
+
+    size_t count = u->queue_count < max ? u->queue_count : max;
+    for (size_t i = 0; i < count; i++)
+    {
+        u16 id    = u->queue[(u->queue_start + i) % URING_IO_BUFFERS];
+        u8 *start = u->buffers + id * u->buffer_size;
+        struct io_uring_recvmsg_out *out = (void *)start;
+        u8 *name    = start + sizeof(*out);
+        u8 *control = name + u->recv_msg.msg_namelen;
+        u8 *payload = control + u->recv_msg.msg_controllen;
+        // datagrams larger than the buffer are cut short, like recvmmsg
+        size_t room = u->buffer_size - (payload - start);
+        datagrams[i] = (UringDatagram){
+            .data        = payload,
+            .length      = out->payloadlen < room ? out->payloadlen : room,
+            .addr        = (const struct sockaddr *)name,
+            .addr_len    = out->namelen < u->recv_msg.msg_namelen
+                               ? out->namelen
+                               : u->recv_msg.msg_namelen,
+            .control     = control,
+            .control_len = out->controllen < u->recv_msg.msg_controllen
+                               ? out->controllen
+                               : u->recv_msg.msg_controllen,
+        };
+    }
+    u->queue_count -= count;
+    u->handed_out = count;
+    return count;
+}
+
+void uring_io_send(
+    UringIO *u, struct mmsghdr *msgs, size_t count, int *results)
+{
+    u->send_results = results;
+    for (size_t i = 0; i < count; i++)
+    {
+        results[i] = -ECANCELED; // until it completes
+        // dropped when the socket buffer is full, like the socket loop, so
+        // a flush never waits for the network
+        struct io_uring_sqe *sqe = get_sqe(u);
+        sqe->opcode              = IORING_OP_SENDMSG;
+        sqe->fd                  = u->socket;
+        sqe->addr                = (u64)&msgs[i].msg_hdr;
+        sqe->len                 = 1;
+        sqe->msg_flags           = MSG_DONTWAIT;
+        sqe->user_data           = URING_IO_SEND | i;
+        u->sends_in_flight++;
+    }
+
+    // the messages point at data the server reuses after the flush, so the
+    // sends must be done before returning. They complete during the submit
+    // unless the socket is busy, so this rarely waits. A failed enter can
+    // still have submitted some, and those are waited for all the same
+    bool logged = false;
+    while (u->sends_in_flight > 0)
+    {
+        if (submit_and_wait(u, 1, -1) != 0 && errno != EINTR)
+        {
+            if (logged == false)
+                log_error("Error sending with io_uring: %s", strerror(errno));
+            logged = true;
+            u->sends_in_flight -= retract(u);
+        }
+        reap(u);
+    }
+}
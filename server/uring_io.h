@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * io_uring backend of the batch io, used instead of epoll, recvmmsg and
+ * sendmmsg when the server is started with it. The socket has a single
+ * multishot recvmsg that stays armed and receives into a ring of buffers
+ * provided to the kernel, so receiving takes no system calls of its own.
+ * Every datagram waits in its buffer until a wait hands it to the server,
+ * and the buffers go back to the kernel on the wait after. Watched fds have
+ * multishot polls, and a flush is submitted as one sendmsg per message,
+ * all with a single system call that also waits for them.
+ *
+ * Talks to the kernel directly with the system calls, so nothing beyond the
+ * kernel headers is needed. Needs Linux 6.0 for multishot recvmsg, creating
+ * a ring on older kernels fails and the server uses the socket loop.
+ */
+
+#include <sys/socket.h>
+#include <types.h>
+
+// receive buffers shared with the kernel, datagrams beyond these are dropped
+// until the server catches up
+#define URING_IO_BUFFERS 512
+// fds besides the socket that can be watched
+#define URING_IO_WATCH_COUNT 4
+
+typedef struct UringIO UringIO;
+
+// a datagram received into one of the buffers
+typedef struct UringDatagram
+{
+    void *data;
+    size_t length;
+    const struct sockaddr *addr;
+    socklen_t addr_len;
+    void *control; // control messages, like the socket's drop count
+    size_t control_len;
+} UringDatagram;
+
+// create a ring receiving from a non blocking udp socket into buffers of
+// buffer_size bytes. Returns NULL if the kernel lacks io_uring or a feature
+// it needs
+UringIO *create_uring_io(int socket, size_t buffer_size);
+void destroy_uring_io(UringIO *u);
+
+// also wake uring_io_wait when fd becomes readable
+Result uring_io_watch(UringIO *u, int fd);
+
+// give the datagrams of the previous wait back to the kernel, then wait up
+// to timeout_ms for datagrams or a watched fd. Up to max datagrams are
+// stored in datagrams, the rest are kept for the next wait. Returns the
+// number stored, or -1 on error
+int uring_io_wait(
+    UringIO *u, int timeout_ms, UringDatagram *datagrams, size_t max);
+
+// check if a watched fd was readable during the last uring_io_wait
+bool uring_io_ready(const UringIO *u, int fd);
+
+// send every message and wait for them to finish, so their data can be
+// reused. The result of each is stored in results, the bytes sent or a
+// negative errno, -ECANCELED if the ring failed to submit it
+void uring_io_send(
+    UringIO *u, struct mmsghdr *msgs, size_t count, int *results);
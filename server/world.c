@@ -0,0 +1,158 @@
+#include "world.h"
+#include "plane_types.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <messenger.h>
+#include <utils.h>
+
+// longest view delay that is compensated for, as far back as the history goes
+#define MAX_VIEW_DELAY \
+    ((time_t)PLANE_HISTORY_TICKS * SEC_TO_MICROSEC / SERVER_TICK_RATE)
+
+// milliseconds of simulation at the current tick. Fire rates are kept against
+// this rather than the clock, so replaying the same input fires the same
+static inline time_t world_time(const World *w)
+{
+    return (time_t)w->tick * 1000 / SERVER_TICK_RATE;
+}
+
+Result create_world(World *w, size_t capacity)
+{
+    *w = (World){
+        .planes   = calloc(capacity, sizeof(WorldPlane)),
+        .capacity = capacity,
+    };
+    if (w->planes == NULL)
+    {
+        log_error("Failed to allocate world planes");
+        return RS_FAILURE;
+    }
+    if (create_slot_index(&w->by_id, capacity) != RS_SUCCESS ||
+        create_plane_history(&w->history, capacity) != RS_SUCCESS)
+    {
+        destroy_world(w);
+        return RS_FAILURE;
+    }
+    return RS_SUCCESS;
+}
+
+void destroy_world(World *w)
+{
+    free(w->planes);
+    destroy_slot_index(&w->by_id);
+    destroy_plane_history(&w->history);
+    *w = (World){0};
+}
+
+WorldPlane *world_add_plane(World *w, uid_t id, int plane_type)
+{
+    if (w->plane_count == w->capacity)
+        return NULL;
+    if (plane_type < 0 || plane_type >= PLANE_TYPE_MAX)
+    {
+        log_warning("Client requested invalid plane type %i", plane_type);
+        plane_type = PLANE_TYPE_FA18;
+    }
+
+    plane_history_clear(&w->history, w->plane_count);
+    slot_index_insert(&w->by_id, id, w->plane_count);
+    WorldPlane *p = &w->planes[w->plane_count++];
+
+    *p = (WorldPlane){
+        .id    = id,
+        .plane = create_plane_type(plane_type),
+        .input = {.type = PACKET_TYPE_INPUT, .id = id, .throttle = 1.f},
+    };
+    p->plane.next_fire_time = world_time(w);
+    return p;
+}
+
+WorldPlane *world_find_plane(World *w, uid_t id)
+{
+    u32 i = slot_index_find(&w->by_id, id);
+    return i == SLOT_NONE ? NULL : &w->planes[i];
+}
+
+void world_remove_plane(World *w, uid_t id)
+{
+    WorldPlane *p = world_find_plane(w, id);
+    if (p == NULL)
+        return;
+    u32 i = p - w->planes;
+    slot_index_remove(&w->by_id, id, i);
+
+    // keep the array dense by moving the last plane into the gap
+    u32 last = --w->plane_count;
+    if (i == last)
+        return;
+    slot_index_move(&w->by_id, w->planes[last].id, last, i);
+    plane_history_move(&w->history, last, i);
+    *p = w->planes[last];
+}
+
+void world_set_input(World *w, const struct InputPacket *input, time_t now)
+{
+    WorldPlane *p = world_find_plane(w, input->id);
+    if (p == NULL || p->remote)
+        return;
+    // udp can reorder packets, never go back to older controls
+    if (input->sequence <= p->input.sequence)
+        return;
+    p->input = *input;
+
+    // the view time comes from the client, so it can not be trusted to be
+    // in the past or within the history
+    if (input->view_time == 0)
+        return;
+    time_t delay = now - input->view_time;
+    if (delay < 0)
+        delay = 0;
+    else if (delay > MAX_VIEW_DELAY)
+        delay = MAX_VIEW_DELAY;
+    p->view_delay = delay;
+}
+
+void world_step(World *w, f32 delta)
+{
+    w->tick++;
+    time_t time = world_time(w);
+    for (size_t i = 0; i < w->plane_count; i++)
+    {
+        if (w->planes[i].remote)
+            continue;
+        Plane *plane                    = &w->planes[i].plane;
+        const struct InputPacket *input = &w->planes[i].input;
+
+        // same order as the client applies its own controls
+        size_t fired = MAX_BULLET_COUNT;
+        if (input->fire)
+            fired = plane_fire_bullet_at(plane, time);
+
+        plane_update(plane, delta);
+
+        // the new bullet has taken its first step, clients replay it from
+        // here with fire_event_bullet
+        if (fired != MAX_BULLET_COUNT && plane->active_bullets[fired].used)
+        {
+            Bullet *bullet = &plane->active_bullets[fired];
+            FireEvent *e   = &w->planes[i].fired[fired];
+            e->tick        = w->tick;
+            e->slot        = fired;
+            e->heading     = bullet->heading;
+            e->speed       = bullet->speed;
+            glm_vec2_copy(bullet->p, e->origin);
+        }
+
+        if (input->turn == LEFT || input->turn == RIGHT)
+            plane_turn(plane, delta, input->turn, 1.f);
+
+        plane->throttle = glm_clamp(input->throttle, 0.f, 1.f);
+    }
+}
+
+void world_record(World *w, time_t time)
+{
+    plane_history_push(&w->history, time);
+    for (size_t i = 0; i < w->plane_count; i++)
+        plane_history_store(&w->history, i, w->planes[i].plane.position);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * The server's copy of the game world. Every connected client owns a plane
+ * which is simulated here with the shared plane code, using the last input
+ * the client sent. The server's planes are the authoritative state that
+ * is broadcast to all clients.
+ *
+ * When the server runs several workers, each worker's world also holds
+ * copies of the planes of the other workers' clients, marked as remote.
+ *
+ * Where the planes were on the last few ticks is kept for lag compensation,
+ * so bullets can be checked against what the shooter's client saw.
+ */
+
+#include "packets.h"
+#include "plane_history.h"
+#include "slot_index.h"
+
+typedef struct WorldPlane
+{
+    uid_t id;
+    Plane plane;
+    struct InputPacket input; // controls applied every tick
+    // how the bullet in each slot of plane.active_bullets was fired
+    FireEvent fired[MAX_BULLET_COUNT];
+
+    // how far behind the server the client sees other planes, in
+    // microseconds. Its bullets hit planes where they were that long ago
+    time_t view_delay;
+
+    // simulated by another server worker, which sends its state every tick
+    bool remote;
+    u32 remote_tick; // tick the state of a remote plane was last received
+} WorldPlane;
+
+typedef struct World
+{
+    // dense array of planes, removal swaps the last plane into the gap
+    WorldPlane *planes;
+    size_t plane_count;
+    size_t capacity;
+    SlotIndex by_id; // uid to index in planes
+    u32 tick; // steps taken, the first step is tick 1
+
+    PlaneHistory history; // recorded positions, by index in planes
+} World;
+
+Result create_world(World *w, size_t capacity);
+void destroy_world(World *w);
+
+// add a plane for a new client, returns NULL if the world is full
+WorldPlane *world_add_plane(World *w, uid_t id, int plane_type);
+void world_remove_plane(World *w, uid_t id);
+WorldPlane *world_find_plane(World *w, uid_t id);
+
+// store the latest controls of a client, ignoring out of order packets. The
+// client's view delay is measured from its view time to now
+void world_set_input(World *w, const struct InputPacket *input, time_t now);
+
+// advance every plane that is not remote by one fixed tick of delta seconds,
+// recording the bullets fired during it
+void world_step(World *w, f32 delta);
+
+// record where every plane is at time, the time snapshots of the current
+// tick are stamped with
+void world_record(World *w, time_t time);
@@ -0,0 +1,126 @@
+#pragma once
+
+/*
+ * Reading and writing of values that are not a whole number of bytes. Bits
+ * are packed least significant first, so a value may span two bytes. A
+ * writer that runs out of space, or a reader that runs out of data, sets a
+ * flag and ignores everything after, so the caller only checks once at the
+ * end.
+ */
+
+#include "types.h"
+#include <assert.h>
+#include <stddef.h>
+
+typedef struct BitWriter
+{
+    u8 *cursor;
+    const u8 *end;
+    u64 scratch; // bits not yet written to the buffer
+    u32 scratch_bits;
+    bool overflow;
+} BitWriter;
+
+typedef struct BitReader
+{
+    const u8 *cursor;
+    const u8 *end;
+    u64 scratch; // bits read from the buffer but not yet returned
+    u32 scratch_bits;
+    bool failed;
+} BitReader;
+
+static inline BitWriter create_bit_writer(u8 *data, size_t size)
+{
+    return (BitWriter){.cursor = data, .end = data + size};
+}
+
+static inline BitReader create_bit_reader(const u8 *data, size_t size)
+{
+    return (BitReader){.cursor = data, .end = data + size};
+}
+
+// write the low bits of value, at most 32 bits at a time
+static inline void bit_write(BitWriter *w, u32 value, u32 bits)
+{
+    assert(bits <= 32);
+    if (bits < 32)
+        value &= ((u32)1 << bits) - 1;
+    w->scratch |= (u64)value << w->scratch_bits;
+    w->scratch_bits += bits;
+
+    while (w->scratch_bits >= 8)
+    {
+        if (w->cursor == w->end)
+        {
+            w->overflow     = true;
+            w->scratch_bits = 0;
+            return;
+        }
+        *w->cursor++ = (u8)w->scratch;
+        w->scratch >>= 8;
+        w->scratch_bits -= 8;
+    }
+}
+
+static inline void bit_write_bool(BitWriter *w, bool value)
+{
+    bit_write(w, value, 1);
+}
+
+// write a value between -2^(bits - 1) and 2^(bits - 1) - 1
+static inline void bit_write_signed(BitWriter *w, i32 value, u32 bits)
+{
+    bit_write(w, (u32)value, bits);
+}
+
+// pad the last byte with zeros, the writer then ends on a byte boundary
+static inline void bit_write_flush(BitWriter *w)
+{
+    if (w->scratch_bits > 0)
+        bit_write(w, 0, 8 - w->scratch_bits);
+}
+
+static inline u32 bit_read(BitReader *r, u32 bits)
+{
+    assert(bits <= 32);
+    while (r->scratch_bits < bits)
+    {
+        if (r->cursor == r->end)
+        {
+            r->failed = true;
+            return 0;
+        }
+        r->scratch |= (u64)*r->cursor++ << r->scratch_bits;
+        r->scratch_bits += 8;
+    }
+
+    u32 value = bits < 32 ? r->scratch & (((u64)1 << bits) - 1) : r->scratch;
+    r->scratch >>= bits;
+    r->scratch_bits -= bits;
+    return value;
+}
+
+static inline bool bit_read_bool(BitReader *r) { return bit_read(r, 1); }
+
+static inline i32 bit_read_signed(BitReader *r, u32 bits)
+{
+    u32 value = bit_read(r, bits);
+    // move the sign bit to the top so the shift back extends it
+    u32 shift = 32 - bits;
+    return (i32)(value << shift) >> shift;
+}
+
+// skip to the start of the next byte, the padding of bit_write_flush
+static inline void bit_read_align(BitReader *r)
+{
+    u32 padding = r->scratch_bits % 8;
+    r->scratch >>= padding;
+    r->scratch_bits -= padding;
+}
+
+// first byte that has not been read, after bit_read_align
+static inline const u8 *bit_read_next_byte(const BitReader *r)
+{
+    return r->cursor - r->scratch_bits / 8;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * The world is divided into a grid of square cells. The client draws one
+ * terrain chunk per cell and the server uses the same cells to decide
+ * which planes a client can see.
+ */
+
+#include "types.h"
+
+// width and height of a grid cell in world units
+#define GRID_CELL_SIZE (0.5)
+
+// number of cells around the player's cell that are in view
+#define GRID_VIEW_RADIUS (1)
+
+static inline i32 grid_signof(f64 x) { return (x > 0) - (x < 0); }
+
+// find which grid coordinate point is in, stores it in dest
+static inline void grid_cell_containing(const vec2 point, ivec2 dest)
+{
+    dest[0] =
+        (point[0] + grid_signof(point[0]) * GRID_CELL_SIZE / 2) / GRID_CELL_SIZE;
+    dest[1] =
+        (point[1] + grid_signof(point[1]) * GRID_CELL_SIZE / 2) / GRID_CELL_SIZE;
+}
@@ -0,0 +1,27 @@
+#include "packets.h"
+#include <stddef.h>
+
+// fewest bytes of each type of datagram that are handled. A shorter one
+// would be read past its end, into whatever the buffer held before
+static const size_t PACKET_SIZES[PACKET_TYPE_COUNT] = {
+    [PACKET_TYPE_EMPTY]         = sizeof(struct EmptyPacket),
+    [PACKET_TYPE_CONNECITON]    = sizeof(struct ConnectionPacket),
+    [PACKET_TYPE_DISCONNECTION] = sizeof(struct DisconnectPacket),
+    [PACKET_TYPE_PLANE]         = sizeof(struct PlanePacket),
+    [PACKET_TYPE_INPUT]         = sizeof(struct InputPacket),
+    [PACKET_TYPE_SNAPSHOT]      = offsetof(struct SnapshotPacket, data),
+    [PACKET_TYPE_STATS]         = sizeof(struct StatsPacket),
+    [PACKET_TYPE_KILL]          = sizeof(struct KillPacket),
+};
+
+bool packet_complete(const Packet *packet, size_t length)
+{
+    if (length < sizeof(PacketType) || (u32)packet->type >= PACKET_TYPE_COUNT ||
+        length < PACKET_SIZES[packet->type])
+        return false;
+    if (packet->type != PACKET_TYPE_SNAPSHOT)
+        return true;
+    const struct SnapshotPacket *s = &packet->snapshot_packet;
+    return s->size <= MAX_SNAPSHOT_DATA &&
+           length >= offsetof(struct SnapshotPacket, data) + s->size;
+}
@@ -2,6 +2,17 @@
 #include "plane.h"
 
 #define MAX_PACKET_DATA 1024
+// simulation steps per second on the server, also the rate snapshots are
+// sent at. Ticks in packets count these steps
+#define SERVER_TICK_RATE 60
+// largest amount of packed plane data in a single snapshot datagram, small
+// enough that the datagram fits in an Ethernet frame without fragmenting
+#define MAX_SNAPSHOT_DATA 1440
+// largest UDP payload of a 1500 byte Ethernet frame over IPv4
+#define MAX_UNFRAGMENTED_PAYLOAD 1472
+// latency percentiles in a stats packet: the 50th, 90th, 99th, 99.9th and the
+// largest value recorded
+#define STATS_PERCENTILE_COUNT 5
 
 typedef enum PacketType
 {
@@ -9,6 +20,11 @@ typedef enum PacketType
     PACKET_TYPE_CONNECITON,
     PACKET_TYPE_DISCONNECTION,
     PACKET_TYPE_PLANE,
+    PACKET_TYPE_INPUT,
+    PACKET_TYPE_SNAPSHOT,
+    PACKET_TYPE_STATS,
+    PACKET_TYPE_KILL,
+    PACKET_TYPE_COUNT, // number of packet types, not a type
 } PacketType;
 
 typedef union Packet
@@ -23,6 +39,8 @@ typedef union Packet
     {
         PacketType type;
         uid_t return_uid; // server send back uid for client
+        int plane_type;   // plane the client wants to fly
+        u32 room;         // match the client joins, only its planes are seen
     } connection_packet;
     struct DisconnectPacket
     {
@@ -36,4 +54,66 @@ typedef union Packet
         SimplePlane plane;
         time_t update_time;
     } data_packet;
+    // the controls a client is holding, applied by the server every tick
+    // until a newer input packet arrives
+    struct InputPacket
+    {
+        PacketType type;
+        uid_t id;
+        u32 sequence; // increases with each packet, older packets are ignored
+        i8 turn;      // Direction to turn, or 0 to fly straight
+        bool fire;
+        f32 throttle;
+        u32 snapshot_ack; // newest snapshot tick received in full
+        // server time of the planes the client is looking at, the newest
+        // snapshot's update_time plus the time since it arrived. 0 if the
+        // client has no snapshot yet
+        time_t view_time;
+    } input_packet;
+    // the state of every plane on one server tick, packed by snapshot.h.
+    // if the planes do not fit in one datagram the tick is split across
+    // several snapshot packets
+    struct SnapshotPacket
+    {
+        PacketType type;
+        u32 tick;
+        u32 baseline_tick; // tick the planes are encoded against, or 0
+        time_t update_time;
+        u8 part;         // index of this packet in the tick
+        u8 part_count;   // packets sent for the tick
+        u16 plane_count; // planes packed in data
+        u16 size;        // bytes used in data
+        u8 data[MAX_SNAPSHOT_DATA];
+    } snapshot_packet;
+    // asks the server for its metrics, only answered when sent from the same
+    // machine. The server replies with the totals of every worker since it
+    // started, packets are counted by type with unknown types last
+    struct StatsPacket
+    {
+        PacketType type;
+        u32 workers;
+        u64 connections;
+        u64 packets_in[PACKET_TYPE_COUNT + 1];
+        u64 packets_out[PACKET_TYPE_COUNT + 1];
+        u64 bytes_in;
+        u64 bytes_out;
+        u64 send_errors;
+        u64 kernel_drops; // datagrams the server's sockets had no room for
+        u64 loop_latency[STATS_PERCENTILE_COUNT];  // ns per wakeup
+        u64 tick_duration[STATS_PERCENTILE_COUNT]; // ns per tick
+    } stats_packet;
+    // sent to every client when the server decides a bullet hit a plane.
+    // The plane is destroyed and its client disconnected
+    struct KillPacket
+    {
+        PacketType type;
+        uid_t victim;
+        uid_t shooter;
+        u32 slot; // the bullet's index in the shooter's active_bullets
+        u32 tick;
+    } kill_packet;
 } Packet;
+
+// check if a datagram of length bytes is whole, of a known type, and for a
+// snapshot holds all the data its size claims
+NONULL(1) bool packet_complete(const Packet *packet, size_t length);
@@ -47,6 +47,16 @@ SimplePlane create_simple_plane(Plane *p)
     return out;
 }
 
+PlaneState create_plane_state(const Plane *p)
+{
+    return (PlaneState){
+        .plane_type = p->plane_type,
+        .position   = {p->position[0], p->position[1]},
+        .heading    = p->heading,
+        .velocity   = p->speed,
+    };
+}
+
 void plane_update(Plane *p, f32 delta)
 {
     assert(p->throttle <= 1.f);
@@ -68,16 +78,20 @@ void plane_update(Plane *p, f32 delta)
     }
 }
 
-void plane_fire_bullet(Plane *p)
+size_t plane_fire_bullet(Plane *p)
+{
+    return plane_fire_bullet_at(p, get_time() / 1000); // time in ms
+}
+
+size_t plane_fire_bullet_at(Plane *p, time_t time)
 {
     if (p->bullets_remaining <= 0)
-        return;
+        return MAX_BULLET_COUNT;
 
     // check allowed with fire rate
-    time_t time = get_time() / 1000; // get time converted to ms
     if (p->next_fire_time > time)
     {
-        return;
+        return MAX_BULLET_COUNT;
     }
 
     // find where to store bullet
@@ -91,7 +105,7 @@ void plane_fire_bullet(Plane *p)
     if (bullet_index == SIZE_MAX)
     {
         log_info("No more active bullets available\n");
-        return;
+        return MAX_BULLET_COUNT;
     }
 
     struct Bullet new_bullet = {
@@ -105,6 +119,7 @@ void plane_fire_bullet(Plane *p)
     p->active_bullets[bullet_index] = new_bullet;
     p->next_fire_time               = time + p->fire_interval;
     p->bullets_remaining--;
+    return bullet_index;
 }
 
 void update_bullet(Bullet *bullet, f32 delta)
@@ -128,6 +143,23 @@ void update_bullet(Bullet *bullet, f32 delta)
     glm_vec2_add(bullet->p, offset, bullet->p);
 }
 
+Bullet fire_event_bullet(const FireEvent *e, u32 tick, f32 tick_delta)
+{
+    Bullet bullet = {
+        .used    = true,
+        .drag    = BULLET_DRAG,
+        .heading = e->heading,
+        .speed   = e->speed,
+    };
+    glm_vec2_copy((f32 *)e->origin, bullet.p);
+
+    // same steps as the bullet took where it was fired, so it ends up in
+    // the same place
+    for (u32 t = e->tick; t < tick && bullet.used; t++)
+        update_bullet(&bullet, tick_delta);
+    return bullet;
+}
+
 void plane_turn(Plane *p, f32 delta, Direction d, f32 factor)
 {
     // add negative rotation, opposite of unit circle
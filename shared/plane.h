@@ -8,6 +8,8 @@
 // min speed, and weapons
 
 #define MAX_BULLET_COUNT 128
+// distance from a plane's position within which a bullet hits it
+#define BULLET_HIT_RADIUS 0.03f
 
 typedef enum Direction
 {
@@ -24,6 +26,52 @@ typedef struct Bullet
     f32 drag;
 } Bullet;
 
+// set of slots in a plane's active_bullets, one bit per slot
+typedef struct BulletMask
+{
+    u64 bits[(MAX_BULLET_COUNT + 63) / 64];
+} BulletMask;
+
+static inline void bullet_mask_set(BulletMask *m, size_t slot)
+{
+    m->bits[slot / 64] |= (u64)1 << (slot % 64);
+}
+
+static inline bool bullet_mask_test(const BulletMask *m, size_t slot)
+{
+    return (m->bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+// move slot to the first slot in the mask at or after it, returns false if
+// there are none. Masks are mostly empty, so this skips 64 slots at a time
+static inline bool bullet_mask_next(const BulletMask *m, size_t *slot)
+{
+    for (size_t word = *slot / 64; word < array_length(m->bits); word++)
+    {
+        u64 bits = m->bits[word];
+        if (word == *slot / 64)
+            bits &= UINT64_MAX << (*slot % 64);
+        if (bits != 0)
+        {
+            *slot = word * 64 + __builtin_ctzll(bits);
+            return true;
+        }
+    }
+    return false;
+}
+
+// everything needed to recreate a bullet, sent once when it is fired
+// instead of its state on every update. The bullet moves the same way from
+// here on wherever it is simulated
+typedef struct FireEvent
+{
+    u32 tick; // the bullet was at origin at the end of this tick
+    u8 slot;  // index in the plane's active_bullets
+    vec2 origin;
+    f32 heading;
+    f32 speed;
+} FireEvent;
+
 typedef struct Missile
 {
     bool used;
@@ -67,6 +115,16 @@ typedef struct SimplePlane
     Bullet active_bullets[MAX_BULLET_COUNT];
 } SimplePlane;
 
+// the part of a plane snapshots are made of, a SimplePlane without its
+// bullets, which are sent as fire events instead
+typedef struct PlaneState
+{
+    int plane_type;
+    vec2 position;
+    f32 heading;
+    f32 velocity;
+} PlaneState;
+
 // create a airplane with the given parameters. Will be used internally to
 // initialize each type of airplane
 Plane create_plane(
@@ -79,17 +137,28 @@ Plane create_plane(
 
 // convert a plane to a simple plane
 SimplePlane create_simple_plane(Plane *complex_plane);
+PlaneState create_plane_state(const Plane *complex_plane);
 
 // update a planes position and speed base on airplane parameters
 void plane_update(Plane *plane, f32 delta);
 void plane_turn(Plane *p, f32 delta, Direction d, f32 factor);
 
-void plane_fire_bullet(Plane *p);
+// returns the slot of the new bullet, or MAX_BULLET_COUNT if the plane
+// could not fire
+size_t plane_fire_bullet(Plane *p);
+// the same, with the fire rate kept against time in milliseconds instead of
+// the clock, for simulations that must repeat exactly
+size_t plane_fire_bullet_at(Plane *p, time_t time);
 
 void update_missile(
     Missile *missile, const SimplePlane *missile_target, f32 delta);
 void update_bullet(Bullet *bullet, f32 delta);
 
+// recreate the bullet of a fire event as it is at the end of tick, moved by
+// update_bullet once every tick of tick_delta seconds. The bullet is unused
+// if it has already slowed down and gone
+Bullet fire_event_bullet(const FireEvent *e, u32 tick, f32 tick_delta);
+
 // move an airplane to position p without changing speed or heading
 static inline void plane_set_position(Plane *plane, vec2 p)
 {
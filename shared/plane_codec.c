@@ -0,0 +1,207 @@
+#include "plane_codec.h"
+#include "grid.h"
+#include <math.h>
+
+// plane fields present in an entry
+#define FIELD_TYPE (1 << 0)
+#define FIELD_POSITION (1 << 1)
+#define FIELD_HEADING (1 << 2)
+#define FIELD_VELOCITY (1 << 3)
+#define PLANE_FIELD_BITS 4
+
+#define TYPE_BITS 8
+// cells close to the reference cell are sent as a small offset
+#define NEAR_CELL_BITS 4
+#define FAR_CELL_BITS 24
+
+#define TWO_PI ((f32)(2 * M_PI))
+
+// a position as the grid cell and the fixed point offset inside it
+typedef struct CodecPosition
+{
+    ivec2 cell;
+    u32 offset[2];
+} CodecPosition;
+
+static inline u32 max_code(u32 bits) { return ((u32)1 << bits) - 1; }
+
+static void quantize_position(const vec2 p, CodecPosition *q)
+{
+    grid_cell_containing(p, q->cell);
+    for (size_t i = 0; i < 2; i++)
+    {
+        // offset from the corner of the cell, in cells
+        f32 start  = q->cell[i] * GRID_CELL_SIZE - GRID_CELL_SIZE / 2;
+        f32 offset = (p[i] - start) / GRID_CELL_SIZE;
+        f32 code   = floorf(offset * (1 << CODEC_POSITION_BITS));
+
+        // rounding can put a point just outside the cell it was found in
+        if (code < 0)
+            code = 0;
+        if (code > max_code(CODEC_POSITION_BITS))
+            code = max_code(CODEC_POSITION_BITS);
+        q->offset[i] = code;
+    }
+}
+
+static void dequantize_position(const CodecPosition *q, vec2 p)
+{
+    // the middle of the step, so the position quantizes back to the same code
+    for (size_t i = 0; i < 2; i++)
+    {
+        f32 start = q->cell[i] * GRID_CELL_SIZE - GRID_CELL_SIZE / 2;
+        p[i]      = start + (q->offset[i] + 0.5f) * GRID_CELL_SIZE /
+                           (1 << CODEC_POSITION_BITS);
+    }
+}
+
+static inline u32 quantize_angle(f32 angle)
+{
+    // headings are not kept in range, but are usually within a few turns
+    if (angle < 0 || angle >= TWO_PI)
+        angle -= floorf(angle / TWO_PI) * TWO_PI;
+    u32 code = angle / TWO_PI * (1 << CODEC_ANGLE_BITS) + 0.5f;
+    return code & max_code(CODEC_ANGLE_BITS); // 2pi wraps around to 0
+}
+
+static inline f32 dequantize_angle(u32 code)
+{
+    return code * TWO_PI / (1 << CODEC_ANGLE_BITS);
+}
+
+static inline u32 quantize_range(f32 value, f32 max, u32 bits)
+{
+    if (value <= 0)
+        return 0;
+    if (value >= max)
+        return max_code(bits);
+    return value / max * max_code(bits) + 0.5f;
+}
+
+static inline f32 dequantize_range(u32 code, f32 max, u32 bits)
+{
+    return code * max / max_code(bits);
+}
+
+static inline bool
+position_differs(const CodecPosition *a, const CodecPosition *b)
+{
+    return a->cell[0] != b->cell[0] || a->cell[1] != b->cell[1] ||
+           a->offset[0] != b->offset[0] || a->offset[1] != b->offset[1];
+}
+
+static void write_position(
+    BitWriter *w, const CodecPosition *q, const ivec2 reference)
+{
+    i32 x = q->cell[0] - reference[0];
+    i32 y = q->cell[1] - reference[1];
+    i32 near_min = -(1 << (NEAR_CELL_BITS - 1));
+    i32 near_max = (1 << (NEAR_CELL_BITS - 1)) - 1;
+
+    if (x == 0 && y == 0)
+        bit_write_bool(w, false);
+    else if (x >= near_min && x <= near_max && y >= near_min && y <= near_max)
+    {
+        bit_write(w, 0b01, 2);
+        bit_write_signed(w, x, NEAR_CELL_BITS);
+        bit_write_signed(w, y, NEAR_CELL_BITS);
+    }
+    else
+    {
+        bit_write(w, 0b11, 2);
+        bit_write_signed(w, q->cell[0], FAR_CELL_BITS);
+        bit_write_signed(w, q->cell[1], FAR_CELL_BITS);
+    }
+    bit_write(w, q->offset[0], CODEC_POSITION_BITS);
+    bit_write(w, q->offset[1], CODEC_POSITION_BITS);
+}
+
+// read a position written against the cell in reference, which is then
+// set to the position's cell
+static void read_position(BitReader *r, vec2 p, ivec2 reference)
+{
+    CodecPosition q = {.cell = {reference[0], reference[1]}};
+    if (bit_read_bool(r))
+    {
+        if (bit_read_bool(r) == false)
+        {
+            q.cell[0] += bit_read_signed(r, NEAR_CELL_BITS);
+            q.cell[1] += bit_read_signed(r, NEAR_CELL_BITS);
+        }
+        else
+        {
+            q.cell[0] = bit_read_signed(r, FAR_CELL_BITS);
+            q.cell[1] = bit_read_signed(r, FAR_CELL_BITS);
+        }
+    }
+    q.offset[0] = bit_read(r, CODEC_POSITION_BITS);
+    q.offset[1] = bit_read(r, CODEC_POSITION_BITS);
+    dequantize_position(&q, p);
+    glm_ivec2_copy(q.cell, reference);
+}
+
+void plane_codec_write(
+    BitWriter *w, const PlaneState *plane, const PlaneState *baseline)
+{
+    CodecPosition position, old_position;
+    quantize_position(plane->position, &position);
+    quantize_position(baseline->position, &old_position);
+    u32 heading  = quantize_angle(plane->heading);
+    u32 velocity = quantize_range(
+        plane->velocity, CODEC_SPEED_MAX, CODEC_SPEED_BITS);
+
+    u32 flags = 0;
+    if (plane->plane_type != baseline->plane_type)
+        flags |= FIELD_TYPE;
+    if (position_differs(&position, &old_position))
+        flags |= FIELD_POSITION;
+    if (heading != quantize_angle(baseline->heading))
+        flags |= FIELD_HEADING;
+    if (velocity != quantize_range(
+                        baseline->velocity, CODEC_SPEED_MAX, CODEC_SPEED_BITS))
+        flags |= FIELD_VELOCITY;
+
+    bit_write(w, flags, PLANE_FIELD_BITS);
+    if (flags & FIELD_TYPE)
+        bit_write(w, plane->plane_type, TYPE_BITS);
+    if (flags & FIELD_POSITION)
+        write_position(w, &position, old_position.cell);
+    if (flags & FIELD_HEADING)
+        bit_write(w, heading, CODEC_ANGLE_BITS);
+    if (flags & FIELD_VELOCITY)
+        bit_write(w, velocity, CODEC_SPEED_BITS);
+}
+
+bool plane_codec_read(
+    BitReader *r, const PlaneState *baseline, PlaneState *plane)
+{
+    *plane = *baseline;
+
+    ivec2 old_cell;
+    grid_cell_containing(baseline->position, old_cell);
+
+    u32 flags = bit_read(r, PLANE_FIELD_BITS);
+    if (flags & FIELD_TYPE)
+        plane->plane_type = bit_read(r, TYPE_BITS);
+    if (flags & FIELD_POSITION)
+        read_position(r, plane->position, old_cell);
+    if (flags & FIELD_HEADING)
+        plane->heading = dequantize_angle(bit_read(r, CODEC_ANGLE_BITS));
+    if (flags & FIELD_VELOCITY)
+        plane->velocity = dequantize_range(
+            bit_read(r, CODEC_SPEED_BITS), CODEC_SPEED_MAX, CODEC_SPEED_BITS);
+
+    return r->failed == false;
+}
+
+void plane_quantize(PlaneState *plane)
+{
+    CodecPosition q;
+    quantize_position(plane->position, &q);
+    dequantize_position(&q, plane->position);
+    plane->heading  = dequantize_angle(quantize_angle(plane->heading));
+    plane->velocity = dequantize_range(
+        quantize_range(plane->velocity, CODEC_SPEED_MAX, CODEC_SPEED_BITS),
+        CODEC_SPEED_MAX,
+        CODEC_SPEED_BITS);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Compact encoding of a PlaneState for the network. Positions are sent as
+ * the grid cell they are in, relative to a cell the reader already knows,
+ * plus a fixed point offset inside the cell. Angles and speeds are quantized
+ * to a few bits each.
+ *
+ * A plane is written as the changes from a baseline, the copy the reader
+ * already has, or an empty plane to send everything. Comparisons are made
+ * on the quantized values, so changes too small to be sent are skipped.
+ */
+
+#include "bit_stream.h"
+#include "plane.h"
+
+// bits of the fixed point offset inside a grid cell, on each axis
+#define CODEC_POSITION_BITS 14
+// bits of a heading in [0, 2pi)
+#define CODEC_ANGLE_BITS 12
+// bits of a plane speed in [0, CODEC_SPEED_MAX]
+#define CODEC_SPEED_BITS 12
+#define CODEC_SPEED_MAX 32.f
+
+// write plane against baseline
+NONULL(1, 2, 3)
+void plane_codec_write(
+    BitWriter *w, const PlaneState *plane, const PlaneState *baseline);
+
+// read a plane written against baseline, returns false if the data is
+// malformed, in which case plane is incomplete
+NONULL(1, 2, 3)
+bool plane_codec_read(
+    BitReader *r, const PlaneState *baseline, PlaneState *plane);
+
+// round every field of a plane to the nearest value the codec can send,
+// which is what the reader will decode
+NONULL(1) void plane_quantize(PlaneState *plane);
@@ -22,8 +22,10 @@ __always_inline Plane create_plane_type(PlaneType type)
         // PLANE_TYPE, MIN_SPEED, THRUST, DRAG, TURN_RATE, BULLET_COUNT
     case PLANE_TYPE_F14:
         return create_plane(type, 0.12, 0.10, 0.07, 0.2 * M_PI, 128);
+    default: // not a plane, fly the default like world_add_plane does
     case PLANE_TYPE_FA18:
-        return create_plane(type, 0.05, 0.05, 0.05, 0.25 * M_PI, 128);
+        return create_plane(
+            PLANE_TYPE_FA18, 0.05, 0.05, 0.05, 0.25 * M_PI, 128);
     case PLANE_TYPE_F16:
         return create_plane(type, 0.06, 0.5, 0.04, 0.4 * M_PI, 75);
     case PLANE_TYPE_F4:
@@ -32,6 +34,5 @@ __always_inline Plane create_plane_type(PlaneType type)
         return create_plane(type, 0.08, 0.70, 0.04, 0.3 * M_PI, 50);
     case PLANE_TYPE_F35:
         return create_plane(type, 0.15, 0.65, 0.03, 0.2 * M_PI, 50);
-    case PLANE_TYPE_MAX: break;
     }
 }
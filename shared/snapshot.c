@@ -0,0 +1,196 @@
+#include "snapshot.h"
+#include "plane_codec.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ID_BITS 32
+#define SLOT_BITS 7
+static_assert(MAX_BULLET_COUNT <= (1 << SLOT_BITS));
+static_assert(sizeof(uid_t) * 8 <= ID_BITS);
+static_assert(
+    offsetof(struct SnapshotPacket, data) + MAX_SNAPSHOT_DATA <=
+    MAX_UNFRAGMENTED_PAYLOAD);
+
+// baseline of planes sent without one
+static const PlaneState empty_plane = {0};
+
+void snapshot_begin(
+    struct SnapshotPacket *s,
+    u32 tick,
+    u32 baseline_tick,
+    time_t update_time)
+{
+    s->type          = PACKET_TYPE_SNAPSHOT;
+    s->tick          = tick;
+    s->baseline_tick = baseline_tick;
+    s->update_time   = update_time;
+    s->part          = 0;
+    s->part_count    = 1;
+    s->plane_count   = 0;
+    s->size          = 0;
+}
+
+// start an entry at the end of the snapshot, entries start on a byte
+// boundary so the size can be counted in bytes
+static inline BitWriter begin_entry(struct SnapshotPacket *s, bool fire)
+{
+    BitWriter w =
+        create_bit_writer(s->data + s->size, sizeof(s->data) - s->size);
+    bit_write_bool(&w, fire);
+    return w;
+}
+
+static inline bool end_entry(struct SnapshotPacket *s, BitWriter *w)
+{
+    bit_write_flush(w);
+    // the size is not updated, so a partial entry is never sent
+    if (w->overflow)
+        return false;
+    s->size = w->cursor - s->data;
+    return true;
+}
+
+bool snapshot_write_plane(
+    struct SnapshotPacket *s,
+    uid_t id,
+    const PlaneState *plane,
+    const PlaneState *baseline)
+{
+    // a plane is its id, a bit set if it is a delta, then the plane
+    BitWriter w = begin_entry(s, false);
+    bit_write(&w, id, ID_BITS);
+    bit_write_bool(&w, baseline != NULL);
+    if (baseline == NULL)
+        baseline = &empty_plane;
+    plane_codec_write(&w, plane, baseline);
+
+    if (end_entry(s, &w) == false)
+        return false;
+    s->plane_count++;
+    return true;
+}
+
+static inline void write_f32(BitWriter *w, f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bit_write(w, bits, 32);
+}
+
+static inline f32 read_f32(BitReader *r)
+{
+    u32 bits = bit_read(r, 32);
+    f32 value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bool snapshot_write_fire(
+    struct SnapshotPacket *s, uid_t id, const FireEvent *fire)
+{
+    // the spawn is sent exactly, so the client's bullet follows the same
+    // path as the server's
+    BitWriter w = begin_entry(s, true);
+    bit_write(&w, id, ID_BITS);
+    bit_write(&w, fire->slot, SLOT_BITS);
+    bit_write(&w, fire->tick, 32);
+    write_f32(&w, fire->origin[0]);
+    write_f32(&w, fire->origin[1]);
+    write_f32(&w, fire->heading);
+    write_f32(&w, fire->speed);
+    return end_entry(s, &w);
+}
+
+SnapshotRead snapshot_read_entry(
+    const struct SnapshotPacket *s,
+    size_t *offset,
+    const SnapshotFrame *baseline,
+    SnapshotEntry *entry)
+{
+    // the size came over the network, so keep it inside the packet
+    size_t size = s->size < sizeof(s->data) ? s->size : sizeof(s->data);
+    if (*offset >= size)
+        return SNAPSHOT_READ_END;
+
+    BitReader r = create_bit_reader(s->data + *offset, size - *offset);
+    bool fire   = bit_read_bool(&r);
+    entry->id   = bit_read(&r, ID_BITS);
+    SnapshotRead result;
+
+    if (fire)
+    {
+        FireEvent *e = &entry->fire;
+        e->slot      = bit_read(&r, SLOT_BITS);
+        e->tick      = bit_read(&r, 32);
+        e->origin[0] = read_f32(&r);
+        e->origin[1] = read_f32(&r);
+        e->heading   = read_f32(&r);
+        e->speed     = read_f32(&r);
+        result       = SNAPSHOT_READ_FIRE;
+        if (r.failed || e->slot >= MAX_BULLET_COUNT)
+            return SNAPSHOT_READ_MALFORMED;
+    }
+    else
+    {
+        const PlaneState *base = &empty_plane;
+        if (bit_read_bool(&r))
+        {
+            base = baseline ? snapshot_frame_find(baseline, entry->id) : NULL;
+            // the length of a delta depends on its baseline, so nothing
+            // after it can be found either
+            if (base == NULL)
+                return SNAPSHOT_READ_NO_BASELINE;
+        }
+        if (plane_codec_read(&r, base, &entry->plane) == false)
+            return SNAPSHOT_READ_MALFORMED;
+        result = SNAPSHOT_READ_PLANE;
+    }
+
+    bit_read_align(&r);
+    *offset = bit_read_next_byte(&r) - s->data;
+    return result;
+}
+
+size_t snapshot_packet_size(const struct SnapshotPacket *s)
+{
+    return offsetof(struct SnapshotPacket, data) + s->size;
+}
+
+void snapshot_frame_reset(SnapshotFrame *f, const struct SnapshotPacket *s)
+{
+    f->tick           = s->tick;
+    f->update_time    = s->update_time;
+    f->parts_received = 0;
+    f->part_count     = s->part_count;
+    f->failed         = false;
+    f->plane_count    = 0;
+}
+
+bool snapshot_frame_add(SnapshotFrame *f, uid_t id, const PlaneState *plane)
+{
+    if (f->plane_count == SNAPSHOT_FRAME_PLANES)
+        return false;
+    f->ids[f->plane_count]    = id;
+    f->planes[f->plane_count] = *plane;
+    f->plane_count++;
+    return true;
+}
+
+const PlaneState *snapshot_frame_find(const SnapshotFrame *f, uid_t id)
+{
+    for (size_t i = 0; i < f->plane_count; i++)
+        if (f->ids[i] == id)
+            return &f->planes[i];
+    return NULL;
+}
+
+bool snapshot_frame_complete(const SnapshotFrame *f)
+{
+    // parts_received has a bit for at most 64 parts
+    if (f->failed || f->part_count == 0 || f->part_count > 64)
+        return false;
+    u64 all_parts =
+        f->part_count == 64 ? UINT64_MAX : ((u64)1 << f->part_count) - 1;
+    return f->parts_received == all_parts;
+}
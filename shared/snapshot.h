@@ -0,0 +1,117 @@
+#pragma once
+
+/*
+ * Packing of planes and fire events into world snapshot packets. Each plane
+ * is written as a delta against a baseline, the same plane in an older
+ * snapshot the client has acknowledged. Only the fields that differ from
+ * the baseline are written. A plane without a baseline is encoded against an
+ * empty plane, which sends everything that is not zero. Planes are packed
+ * with plane_codec.h.
+ *
+ * Bullets are not part of the planes. Each bullet is sent once as the fire
+ * event that spawned it, and the client simulates it from there.
+ *
+ * The client keeps the planes of recent ticks as frames, so it can rebuild
+ * the planes of a delta snapshot from the baseline frame.
+ */
+
+#include "packets.h"
+
+// ticks of snapshots kept to be used as baselines
+#define SNAPSHOT_HISTORY 32
+// most planes the client keeps for one tick
+#define SNAPSHOT_FRAME_PLANES 64
+// fewest times a second the server can be set to send each plane
+#define SNAPSHOT_MIN_RATE 2
+// intervals of the slowest rate the client keeps moving a plane that is not
+// updated. The server's byte budget stretches the intervals in a crowd
+#define SNAPSHOT_EXTRAPOLATE_INTERVALS 2
+
+// planes received for one tick, kept by the client to decode deltas
+typedef struct SnapshotFrame
+{
+    u32 tick;
+    time_t update_time;
+    u64 parts_received; // one bit per part index
+    u8 part_count;
+    bool failed; // a plane in the tick could not be decoded or stored
+
+    size_t plane_count;
+    uid_t ids[SNAPSHOT_FRAME_PLANES];
+    PlaneState planes[SNAPSHOT_FRAME_PLANES];
+} SnapshotFrame;
+
+typedef enum SnapshotRead
+{
+    SNAPSHOT_READ_PLANE = 0,
+    SNAPSHOT_READ_FIRE,
+    SNAPSHOT_READ_END,
+    // the plane's baseline is not in the frame given. The plane can not be
+    // decoded, and neither can the rest of the snapshot
+    SNAPSHOT_READ_NO_BASELINE,
+    SNAPSHOT_READ_MALFORMED,
+} SnapshotRead;
+
+// a plane or fire event read from a snapshot
+typedef struct SnapshotEntry
+{
+    uid_t id; // the plane, or the plane that fired
+    union
+    {
+        PlaneState plane;
+        FireEvent fire;
+    };
+} SnapshotEntry;
+
+// start an empty snapshot for a server tick, encoded against the snapshot
+// of baseline_tick, or 0 if there is no baseline
+NONULL(1)
+void snapshot_begin(
+    struct SnapshotPacket *s,
+    u32 tick,
+    u32 baseline_tick,
+    time_t update_time);
+
+// append a plane to the snapshot, returns false if there is not enough space
+// left, in which case the snapshot is unchanged.
+// baseline is the plane as the client has it in the baseline tick, or NULL
+// to send the whole plane
+NONULL(1, 3)
+bool snapshot_write_plane(
+    struct SnapshotPacket *s,
+    uid_t id,
+    const PlaneState *plane,
+    const PlaneState *baseline);
+
+// append a bullet fired by the plane id, like snapshot_write_plane
+NONULL(1, 3)
+bool snapshot_write_fire(
+    struct SnapshotPacket *s, uid_t id, const FireEvent *fire);
+
+// read the entry at offset and move offset to the next one. offset should
+// start at 0. Deltas are applied to the planes in baseline, which should be
+// the frame of the packet's baseline_tick, or NULL
+NONULL(1, 2, 4)
+SnapshotRead snapshot_read_entry(
+    const struct SnapshotPacket *s,
+    size_t *offset,
+    const SnapshotFrame *baseline,
+    SnapshotEntry *entry);
+
+// number of bytes of the packet that need to be sent
+NONULL(1) size_t snapshot_packet_size(const struct SnapshotPacket *s);
+
+// empty a frame to store the planes of the tick in s
+NONULL(1, 2)
+void snapshot_frame_reset(SnapshotFrame *f, const struct SnapshotPacket *s);
+
+// store a decoded plane, returns false if the frame is full
+NONULL(1, 3)
+bool snapshot_frame_add(SnapshotFrame *f, uid_t id, const PlaneState *plane);
+
+NONULL(1)
+const PlaneState *snapshot_frame_find(const SnapshotFrame *f, uid_t id);
+
+// check if every part of the tick has been received and decoded, which
+// makes the frame usable as a baseline
+NONULL(1) bool snapshot_frame_complete(const SnapshotFrame *f);
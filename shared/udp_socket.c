@@ -0,0 +1,52 @@
+#include "udp_socket.h"
+#include <string.h>
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40 // older headers lack it, the kernel may not
+#endif
+
+Result udp_socket_set_buffers(int socket, int receive, int send)
+{
+    Result result = RS_SUCCESS;
+    if (receive > 0 &&
+        setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &receive, sizeof(int)) == -1)
+        result = RS_FAILURE;
+    if (send > 0 &&
+        setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &send, sizeof(int)) == -1)
+        result = RS_FAILURE;
+    return result;
+}
+
+void udp_socket_buffers(int socket, int *receive, int *send)
+{
+    socklen_t size = sizeof(int);
+    if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, receive, &size) == -1)
+        *receive = 0;
+    size = sizeof(int);
+    if (getsockopt(socket, SOL_SOCKET, SO_SNDBUF, send, &size) == -1)
+        *send = 0;
+}
+
+Result udp_socket_count_drops(int socket)
+{
+    int enable = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(int)) ==
+        -1)
+        return RS_FAILURE;
+    return RS_SUCCESS;
+}
+
+bool udp_socket_drops(const struct msghdr *msg, u32 *drops)
+{
+    struct cmsghdr *c = CMSG_FIRSTHDR(msg);
+    for (; c != NULL; c = CMSG_NXTHDR((struct msghdr *)msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SO_RXQ_OVFL ||
+            c->cmsg_len < CMSG_LEN(sizeof(u32)))
+            continue;
+        // the data is not aligned for a u32 on every platform
+        memcpy(drops, CMSG_DATA(c), sizeof(u32));
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Socket options shared by the client and the server, so a capacity test
+ * can tell datagrams the kernel dropped from datagrams lost on the way or
+ * dropped by the game.
+ *
+ * A udp socket drops datagrams when its receive buffer is full, without
+ * telling anyone. With the drop count turned on the kernel attaches the
+ * number it has dropped since the socket was opened to the datagrams read
+ * with recvmsg, as an SO_RXQ_OVFL control message. The message is left out
+ * while nothing has been dropped. The buffers can also be made larger than
+ * the system default, up to net.core.rmem_max and wmem_max.
+ */
+
+#include "types.h"
+#include <sys/socket.h>
+
+// space for the control message of the drop count
+#define UDP_SOCKET_CONTROL_SIZE CMSG_SPACE(sizeof(u32))
+
+// set how many bytes the kernel buffers for the socket in each direction,
+// 0 leaves a direction at the system default. The kernel doubles them for
+// its bookkeeping and caps them at the system maximum, so the size it uses
+// is read back with udp_socket_buffers
+Result udp_socket_set_buffers(int socket, int receive, int send);
+
+// the bytes the kernel buffers for the socket in each direction
+NONULL(2, 3) void udp_socket_buffers(int socket, int *receive, int *send);
+
+// attach the count of dropped datagrams to the datagrams read from the
+// socket with recvmsg, which need UDP_SOCKET_CONTROL_SIZE bytes of control
+// space for it
+Result udp_socket_count_drops(int socket);
+
+// the datagrams the kernel had dropped when a message was received, counted
+// since the socket was opened. Returns false and leaves drops as it was if
+// the message says nothing about drops
+NONULL(1, 2) bool udp_socket_drops(const struct msghdr *msg, u32 *drops);
@@ -0,0 +1,757 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <utils.h>
+#include <snapshot.h>
+#include <plane_codec.h>
+#include <plane_types.h>
+
+#include "../../server/shard.h"
+#include "../../server/snapshot_builder.h"
+
+// benchmarks of the server and networking code, run with make bench
+
+#define BENCH(call)                      \
+    do                                   \
+    {                                    \
+        printf("Benchmark %s\n", #call); \
+        (call);                          \
+        printf("\n");                    \
+    } while (0)
+
+#define BENCH_TICK_RATE 60
+
+static f32 random_range(f32 min, f32 max)
+{
+    return min + (max - min) * ((f32)rand() / RAND_MAX);
+}
+
+// fill a world with planes spread evenly over a square, each with some
+// bullets around it. The square grows with the plane count so the number of
+// planes per cell stays the same
+static void populate_world(World *w, size_t plane_count, f32 planes_per_unit)
+{
+    f32 half_width = sqrtf(plane_count / planes_per_unit) / 2;
+    for (size_t i = 0; i < plane_count; i++)
+    {
+        WorldPlane *p = world_add_plane(w, 100 + i, PLANE_TYPE_FA18);
+        vec2 position = {
+            random_range(-half_width, half_width),
+            random_range(-half_width, half_width),
+        };
+        plane_set_position(&p->plane, position);
+        for (size_t b = 0; b < 16; b++)
+        {
+            p->fired[b] = (FireEvent){
+                .slot    = b,
+                .origin  = {position[0], position[1]},
+                .heading = random_range(0, 2 * M_PI),
+                .speed   = 1.75f,
+            };
+            p->plane.active_bullets[b] = (Bullet){
+                .used    = true,
+                .p       = {position[0] + random_range(-1, 1),
+                            position[1] + random_range(-1, 1)},
+                .heading = random_range(0, 2 * M_PI),
+                .speed   = 1.75f,
+                .drag    = 0.01f,
+            };
+        }
+    }
+}
+
+// bytes per second each client receives with the area of interest grid, as
+// the map grows at a constant density, compared with sending everything.
+// Clients acknowledge snapshots after a round trip of ack_delay ticks, so
+// most snapshots are deltas against a baseline from a few ticks ago
+void bench_aoi_bytes_per_client(void)
+{
+    const size_t populations[] = {64, 128, 256, 512, 1024};
+    const size_t ticks         = BENCH_TICK_RATE;
+    const size_t ack_delay     = 6;
+
+    printf(
+        "%8s %16s %16s %14s\n",
+        "planes",
+        "aoi bytes/s",
+        "full bytes/s",
+        "us per tick");
+
+    for (size_t n = 0; n < array_length(populations); n++)
+    {
+        size_t plane_count = populations[n];
+        srand(1);
+
+        World world;
+        SnapshotBuilder builder;
+        create_world(&world, plane_count);
+        create_snapshot_builder(&builder, plane_count);
+        populate_world(&world, plane_count, 1.f);
+
+        SnapshotClient *clients = calloc(plane_count, sizeof(SnapshotClient));
+        SnapshotPriority *priorities =
+            calloc(plane_count * plane_count, sizeof(SnapshotPriority));
+        for (size_t c = 0; c < plane_count; c++)
+            clients[c].priorities = &priorities[c * plane_count];
+        u64 aoi_bytes  = 0;
+        time_t elapsed = 0;
+        for (u32 t = 1; t <= ticks; t++)
+        {
+            world_step(&world, 1.f / BENCH_TICK_RATE);
+
+            time_t start = get_time();
+            snapshot_builder_begin(&builder, &world, t, 0);
+            for (size_t c = 0; c < plane_count; c++)
+            {
+                SnapshotView view = snapshot_builder_build_view(
+                    &builder, &world, world.planes[c].id, &clients[c]);
+                for (size_t i = 0; i < view.part_count; i++)
+                    aoi_bytes += snapshot_packet_size(
+                        snapshot_view_part(&builder, view, i));
+                if (t > ack_delay)
+                    snapshot_client_ack(&clients[c], t - ack_delay);
+            }
+            elapsed += get_time() - start;
+        }
+
+        // the whole world packed once, every plane and bullet, as every
+        // client used to receive
+        static struct SnapshotPacket full;
+        u64 full_bytes = 0;
+        snapshot_begin(&full, 0, 0, 0);
+        for (size_t i = 0; i < plane_count; i++)
+        {
+            WorldPlane *p    = &world.planes[i];
+            PlaneState plane = create_plane_state(&p->plane);
+            if (snapshot_write_plane(&full, 0, &plane, NULL) == false)
+            {
+                full_bytes += snapshot_packet_size(&full);
+                snapshot_begin(&full, 0, 0, 0);
+                snapshot_write_plane(&full, 0, &plane, NULL);
+            }
+            for (size_t b = 0; b < MAX_BULLET_COUNT; b++)
+            {
+                if (p->plane.active_bullets[b].used == false)
+                    continue;
+                if (snapshot_write_fire(&full, 0, &p->fired[b]))
+                    continue;
+                full_bytes += snapshot_packet_size(&full);
+                snapshot_begin(&full, 0, 0, 0);
+                snapshot_write_fire(&full, 0, &p->fired[b]);
+            }
+        }
+        full_bytes += snapshot_packet_size(&full);
+
+        printf(
+            "%8zu %16.0f %16lu %14.1f\n",
+            plane_count,
+            (f64)aoi_bytes / plane_count / ticks * BENCH_TICK_RATE,
+            full_bytes * BENCH_TICK_RATE,
+            (f64)elapsed / ticks);
+
+        free(clients);
+        free(priorities);
+        destroy_snapshot_builder(&builder);
+        destroy_world(&world);
+    }
+}
+
+// bytes per second each client receives when every plane is in its view,
+// and how often it is sent each plane it can see. The budget caps the bytes,
+// so the update rate falls as the crowd grows
+void bench_crowded_view(void)
+{
+    const size_t populations[] = {16, 64, 256, 1024};
+    const size_t ticks         = BENCH_TICK_RATE;
+    const size_t ack_delay     = 6;
+
+    printf(
+        "%8s %14s %14s %16s\n",
+        "planes",
+        "bytes/s",
+        "planes/tick",
+        "updates/s each");
+
+    for (size_t n = 0; n < array_length(populations); n++)
+    {
+        size_t plane_count = populations[n];
+        srand(1);
+
+        World world;
+        SnapshotBuilder builder;
+        create_world(&world, plane_count);
+        create_snapshot_builder(&builder, plane_count);
+        // the whole crowd in one cell
+        populate_world(&world, plane_count, plane_count / 0.25f);
+
+        SnapshotClient *clients = calloc(plane_count, sizeof(SnapshotClient));
+        SnapshotPriority *priorities =
+            calloc(plane_count * plane_count, sizeof(SnapshotPriority));
+        for (size_t c = 0; c < plane_count; c++)
+            clients[c].priorities = &priorities[c * plane_count];
+        u64 bytes = 0, sent = 0, visible = 0;
+        for (u32 t = 1; t <= ticks; t++)
+        {
+            world_step(&world, 1.f / BENCH_TICK_RATE);
+            snapshot_builder_begin(&builder, &world, t, 0);
+            for (size_t c = 0; c < plane_count; c++)
+            {
+                SnapshotView view = snapshot_builder_build_view(
+                    &builder, &world, world.planes[c].id, &clients[c]);
+                for (size_t i = 0; i < view.part_count; i++)
+                    bytes += snapshot_packet_size(
+                        snapshot_view_part(&builder, view, i));
+                sent += clients[c].records[t % SNAPSHOT_HISTORY].plane_count;
+                visible += builder.visible_count;
+                if (t > ack_delay)
+                    snapshot_client_ack(&clients[c], t - ack_delay);
+            }
+        }
+
+        printf(
+            "%8zu %14.0f %14.1f %16.1f\n",
+            plane_count,
+            (f64)bytes / plane_count / ticks * BENCH_TICK_RATE,
+            (f64)sent / plane_count / ticks,
+            (f64)sent / visible * BENCH_TICK_RATE);
+
+        free(clients);
+        free(priorities);
+        destroy_snapshot_builder(&builder);
+        destroy_world(&world);
+    }
+}
+
+// time to encode and decode one plane, and its size. Planes are written in
+// full, and as a delta against the same plane one tick earlier
+void bench_plane_codec(void)
+{
+    const size_t plane_count = 1024;
+    const size_t rounds      = 64;
+
+    printf(
+        "%10s %10s %12s %12s %12s\n",
+        "raw bytes",
+        "bytes",
+        "delta bytes",
+        "encode ns",
+        "decode ns");
+
+    static u8 buffer[64];
+    PlaneState *before = malloc(plane_count * sizeof(PlaneState));
+    PlaneState *after  = malloc(plane_count * sizeof(PlaneState));
+    srand(1);
+    World world;
+    create_world(&world, plane_count);
+    populate_world(&world, plane_count, 1.f);
+    for (size_t i = 0; i < plane_count; i++)
+        before[i] = create_plane_state(&world.planes[i].plane);
+    world_step(&world, 1.f / BENCH_TICK_RATE);
+    for (size_t i = 0; i < plane_count; i++)
+        after[i] = create_plane_state(&world.planes[i].plane);
+
+    const PlaneState empty = {0};
+    u64 bytes = 0, delta_bytes = 0;
+    time_t start = get_time();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        for (size_t i = 0; i < plane_count; i++)
+        {
+            BitWriter w = create_bit_writer(buffer, sizeof(buffer));
+            plane_codec_write(&w, &after[i], &empty);
+            bit_write_flush(&w);
+            bytes += w.cursor - buffer;
+        }
+    }
+    time_t encode = get_time() - start;
+
+    // decode the last encoded plane over and over
+    PlaneState out;
+    size_t size = bytes / rounds / plane_count;
+    start       = get_time();
+    for (size_t r = 0; r < rounds * plane_count; r++)
+    {
+        BitReader reader = create_bit_reader(buffer, sizeof(buffer));
+        plane_codec_read(&reader, &empty, &out);
+    }
+    time_t decode = get_time() - start;
+
+    for (size_t i = 0; i < plane_count; i++)
+    {
+        BitWriter w = create_bit_writer(buffer, sizeof(buffer));
+        plane_codec_write(&w, &after[i], &before[i]);
+        bit_write_flush(&w);
+        delta_bytes += w.cursor - buffer;
+    }
+
+    f64 encodes = rounds * plane_count;
+    printf(
+        "%10zu %10zu %12.1f %12.1f %12.1f\n",
+        sizeof(PlaneState),
+        size,
+        (f64)delta_bytes / plane_count,
+        encode * 1000 / encodes,
+        decode * 1000 / encodes);
+
+    destroy_world(&world);
+    free(before);
+    free(after);
+}
+
+// clients of one load thread of the shard benchmark
+typedef struct ShardLoad
+{
+    u16 port;
+    size_t socket_count;
+    int sockets[16];
+    time_t duration;
+    u64 echoes;
+    u64 snapshots;
+} ShardLoad;
+
+// connect every socket of a load thread, so the workers have planes
+static bool connect_load(ShardLoad *load)
+{
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(load->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    for (size_t i = 0; i < load->socket_count; i++)
+    {
+        int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s == -1 || connect(s, (struct sockaddr *)&addr, sizeof(addr)))
+            return false;
+        load->sockets[i] = s;
+
+        struct ConnectionPacket request = {.type = PACKET_TYPE_CONNECITON};
+        send(s, &request, sizeof(request), 0);
+        Packet reply;
+        do
+        {
+            struct pollfd fd = {.fd = s, .events = POLLIN};
+            if (poll(&fd, 1, 1000) != 1)
+                return false;
+            recv(s, &reply, sizeof(reply), 0);
+        } while (reply.type != PACKET_TYPE_CONNECITON);
+    }
+    return true;
+}
+
+// keep a window of echo requests in flight on every socket, counting the
+// replies and the snapshots the clients are sent meanwhile
+static void *run_load(void *arg)
+{
+    ShardLoad *load      = arg;
+    const size_t window  = 32;
+    size_t in_flight[16] = {0};
+    struct pollfd fds[16];
+    for (size_t i = 0; i < load->socket_count; i++)
+        fds[i] = (struct pollfd){.fd = load->sockets[i], .events = POLLIN};
+
+    struct EmptyPacket echo = {.type = PACKET_TYPE_EMPTY};
+    time_t end              = get_time() + load->duration;
+    while (get_time() < end)
+    {
+        for (size_t i = 0; i < load->socket_count; i++)
+            for (; in_flight[i] < window; in_flight[i]++)
+                send(fds[i].fd, &echo, sizeof(echo), 0);
+
+        // a request or reply lost on the way is given up after a while
+        if (poll(fds, load->socket_count, 100) == 0)
+        {
+            for (size_t i = 0; i < load->socket_count; i++)
+                in_flight[i] = 0;
+            continue;
+        }
+
+        for (size_t i = 0; i < load->socket_count; i++)
+        {
+            Packet reply;
+            while (recv(fds[i].fd, &reply, sizeof(reply), MSG_DONTWAIT) > 0)
+            {
+                if (reply.type == PACKET_TYPE_EMPTY)
+                {
+                    load->echoes++;
+                    in_flight[i]--;
+                }
+                else if (reply.type == PACKET_TYPE_SNAPSHOT)
+                {
+                    load->snapshots++;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// datagrams the server handles per second over loopback with a number of
+// worker threads, each with its own SO_REUSEPORT socket. The load threads
+// keep echo requests in flight from many client addresses, so the kernel
+// spreads them over the workers, while every worker also simulates and
+// exchanges the planes of its clients and sends them snapshots. Both io
+// backends are measured, io_uring only if the kernel supports it
+void bench_shard_scaling(void)
+{
+    const size_t worker_counts[]    = {1, 2, 4, 8};
+    const BatchIOBackend backends[] = {BATCH_IO_SOCKET, BATCH_IO_URING};
+    const char *backend_names[]     = {"sockets", "io_uring"};
+    const size_t load_threads       = 4;
+    const time_t duration           = 2 * SEC_TO_MICROSEC;
+
+    printf(
+        "cores: %li\n%8s %8s %14s %14s\n",
+        sysconf(_SC_NPROCESSORS_ONLN),
+        "backend",
+        "workers",
+        "echoes/s",
+        "snapshots/s");
+
+    for (size_t run = 0;
+         run < array_length(backends) * array_length(worker_counts);
+         run++)
+    {
+        size_t n           = run % array_length(worker_counts);
+        size_t b           = run / array_length(worker_counts);
+        ShardConfig config = {
+            .workers      = worker_counts[n],
+            .max_clients  = 256,
+            .idle_timeout = 10 * BENCH_TICK_RATE,
+            .backend      = backends[b],
+        };
+        ShardGroup group;
+        if (create_shard_group(&group, &config) != RS_SUCCESS ||
+            shard_group_start(&group) != RS_SUCCESS)
+        {
+            printf("failed to start %zu workers\n", worker_counts[n]);
+            return;
+        }
+        if (batch_io_backend(group.shards[0].io) != backends[b])
+        {
+            printf("%8s unavailable\n", backend_names[b]);
+            shard_group_stop(&group);
+            destroy_shard_group(&group);
+            return;
+        }
+
+        ShardLoad loads[load_threads];
+        pthread_t threads[load_threads];
+        bool connected = true;
+        for (size_t i = 0; i < load_threads; i++)
+        {
+            loads[i] = (ShardLoad){
+                .port         = group.config.port,
+                .socket_count = array_length(loads[i].sockets),
+                .duration     = duration,
+            };
+            for (size_t s = 0; s < loads[i].socket_count; s++)
+                loads[i].sockets[s] = -1;
+            connected = connected && connect_load(&loads[i]);
+        }
+        if (connected)
+        {
+            for (size_t i = 0; i < load_threads; i++)
+                pthread_create(&threads[i], NULL, run_load, &loads[i]);
+            for (size_t i = 0; i < load_threads; i++)
+                pthread_join(threads[i], NULL);
+        }
+
+        u64 echoes = 0, snapshots = 0;
+        for (size_t i = 0; i < load_threads; i++)
+        {
+            echoes += loads[i].echoes;
+            snapshots += loads[i].snapshots;
+            for (size_t s = 0; s < loads[i].socket_count; s++)
+                if (loads[i].sockets[s] != -1)
+                    close(loads[i].sockets[s]);
+        }
+        f64 seconds = (f64)duration / SEC_TO_MICROSEC;
+        printf(
+            "%8s %8zu %14.0f %14.0f%s\n",
+            backend_names[b],
+            worker_counts[n],
+            echoes / seconds,
+            snapshots / seconds,
+            connected ? "" : " (clients failed to connect)");
+
+        shard_group_stop(&group);
+        destroy_shard_group(&group);
+    }
+}
+
+// time per tick to find idle clients, as the number of connections grows.
+// Every client sends something each tick, which only stamps the connection,
+// and the timer wheel looks at each client once per timeout
+void bench_idle_timeouts(void)
+{
+    const size_t populations[] = {256, 1024, 4096, 16384};
+    const u32 timeout          = 10 * BENCH_TICK_RATE;
+    const u32 ticks            = 4 * timeout;
+
+    printf("%12s %14s\n", "connections", "ns per tick");
+    for (size_t n = 0; n < array_length(populations); n++)
+    {
+        ConnectionTable table;
+        create_connection_table(&table, populations[n], timeout, 1);
+        for (size_t i = 0; i < populations[n]; i++)
+        {
+            struct sockaddr_in addr = {
+                .sin_family = AF_INET,
+                .sin_port   = htons(i),
+            };
+            connection_table_add(
+                &table, i, (struct sockaddr *)&addr, sizeof(addr), 0);
+        }
+
+        time_t elapsed = 0;
+        for (u32 tick = 1; tick <= ticks; tick++)
+        {
+            for (size_t i = 0; i < table.count; i++)
+                table.connections[i].last_seen = tick;
+
+            time_t start = get_time();
+            if (connection_table_next_idle(&table, tick) != NULL)
+                printf("a client timed out\n");
+            elapsed += get_time() - start;
+        }
+        printf("%12zu %14.1f\n", populations[n], elapsed * 1000. / ticks);
+        destroy_connection_table(&table);
+    }
+}
+
+// time per tick to find which planes are hit, with the hit grid compared
+// with every plane checking every bullet of every other plane, which is what
+// each client used to do
+void bench_hit_detection(void)
+{
+    const size_t populations[] = {64, 256, 1024};
+    const size_t ticks         = 10;
+
+    printf("%8s %14s %14s\n", "planes", "grid us", "scan us");
+    for (size_t n = 0; n < array_length(populations); n++)
+    {
+        World world;
+        HitGrid grid;
+        create_world(&world, populations[n]);
+        create_hit_grid(&grid, populations[n]);
+        populate_world(&world, populations[n], 4.f);
+
+        world_record(&world, 0);
+        time_t start = get_time();
+        size_t hits  = 0;
+        for (size_t t = 0; t < ticks; t++)
+        {
+            hit_grid_resolve(&grid, &world, 0);
+            hits += grid.hit_count;
+        }
+        time_t grid_time = get_time() - start;
+
+        // the scan counts every bullet on every plane, the grid at most one
+        // per plane, so it can never find more
+        size_t scan_hits = 0;
+        start            = get_time();
+        for (size_t t = 0; t < ticks; t++)
+        {
+            for (size_t v = 0; v < world.plane_count; v++)
+            {
+                f32 *position = world.planes[v].plane.position;
+                for (size_t p = 0; p < world.plane_count; p++)
+                {
+                    Bullet *bullets = world.planes[p].plane.active_bullets;
+                    for (size_t b = 0; p != v && b < MAX_BULLET_COUNT; b++)
+                    {
+                        if (bullets[b].used &&
+                            glm_vec2_distance(bullets[b].p, position) <
+                                BULLET_HIT_RADIUS)
+                            scan_hits++;
+                    }
+                }
+            }
+        }
+        time_t scan_time = get_time() - start;
+
+        printf(
+            "%8zu %14.1f %14.1f\n",
+            populations[n],
+            (f64)grid_time / ticks,
+            (f64)scan_time / ticks);
+        if (hits > scan_hits)
+            printf("the grid found hits the scan did not\n");
+        destroy_hit_grid(&grid);
+        destroy_world(&world);
+    }
+}
+
+// time to find where a target was when a shot was fired, from the history
+// of positions recorded every tick, at random delays within the history
+void bench_rewind(void)
+{
+    const size_t plane_count = 1024;
+    const size_t shots       = 1 << 20;
+    const time_t tick_time   = SEC_TO_MICROSEC / BENCH_TICK_RATE;
+
+    PlaneHistory history;
+    create_plane_history(&history, plane_count);
+    for (u32 t = 1; t <= PLANE_HISTORY_TICKS; t++)
+    {
+        plane_history_push(&history, t * tick_time);
+        for (size_t p = 0; p < plane_count; p++)
+        {
+            vec2 position = {random_range(-8, 8), random_range(-8, 8)};
+            plane_history_store(&history, p, position);
+        }
+    }
+
+    u32 *planes   = malloc(shots * sizeof(u32));
+    time_t *times = malloc(shots * sizeof(time_t));
+    for (size_t i = 0; i < shots; i++)
+    {
+        planes[i] = rand() % plane_count;
+        times[i]  = random_range(0, PLANE_HISTORY_TICKS * tick_time);
+    }
+
+    vec2 sum     = {0};
+    time_t start = get_time();
+    for (size_t i = 0; i < shots; i++)
+    {
+        vec2 position;
+        plane_history_rewind(&history, planes[i], times[i], position);
+        glm_vec2_add(sum, position, sum);
+    }
+    time_t elapsed = get_time() - start;
+
+    printf(
+        "%zu planes, %i ticks of history: %.1f ns per rewind (%.0f)\n",
+        plane_count,
+        PLANE_HISTORY_TICKS,
+        elapsed * 1000. / shots,
+        sum[0] + sum[1]);
+    free(planes);
+    free(times);
+    destroy_plane_history(&history);
+}
+
+// cpu time of the calling thread in nanoseconds, which includes the kernel
+// delivering loopback datagrams it sends
+static u64 thread_cpu_time(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// cpu time per datagram sent over loopback with a sendto per datagram, and
+// with the batch io with and without segmentation offload. Every client is
+// sent a snapshot of full sized parts on each tick, and consecutive clients
+// are on different ports, so only the parts of one client can be merged.
+// Nothing reads the datagrams, so the receive buffers fill and the kernel
+// drops them, which costs the same however they were sent
+void bench_segmentation_offload(void)
+{
+    const size_t part_counts[] = {1, 2, 4, 8};
+    const size_t clients       = 256;
+    const size_t ticks         = 100;
+    const size_t size =
+        offsetof(struct SnapshotPacket, data) + MAX_SNAPSHOT_DATA;
+
+    int sender = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    BatchIO *io = sender == -1 ? NULL : create_batch_io(sender, BATCH_IO_SOCKET);
+    struct sockaddr_in addrs[16];
+    int receivers[array_length(addrs)];
+    for (size_t i = 0; i < array_length(addrs); i++)
+    {
+        addrs[i] = (struct sockaddr_in){
+            .sin_family      = AF_INET,
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        socklen_t length = sizeof(addrs[i]);
+        receivers[i]     = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        bind(receivers[i], (struct sockaddr *)&addrs[i], sizeof(addrs[i]));
+        getsockname(receivers[i], (struct sockaddr *)&addrs[i], &length);
+    }
+    if (io == NULL)
+    {
+        printf("failed to create the sending socket\n");
+        return;
+    }
+    bool supported = batch_io_segmenting(io);
+    if (supported == false)
+        printf("segmentation offload is not supported, it is not measured\n");
+
+    static u8 part[sizeof(Packet)];
+    printf(
+        "%8s %14s %14s %14s\n",
+        "parts",
+        "sendto ns",
+        "batched ns",
+        "segmented ns");
+    for (size_t n = 0; n < array_length(part_counts); n++)
+    {
+        size_t datagrams = clients * part_counts[n] * ticks;
+
+        u64 start = thread_cpu_time();
+        for (size_t t = 0; t < ticks; t++)
+            for (size_t c = 0; c < clients; c++)
+                for (size_t p = 0; p < part_counts[n]; p++)
+                    sendto(
+                        sender,
+                        part,
+                        size,
+                        MSG_DONTWAIT,
+                        (struct sockaddr *)&addrs[c % array_length(addrs)],
+                        sizeof(addrs[0]));
+        f64 plain = (f64)(thread_cpu_time() - start) / datagrams;
+
+        f64 batched[2] = {0};
+        for (size_t segmenting = 0; segmenting <= supported; segmenting++)
+        {
+            batch_io_set_segmenting(io, segmenting);
+            start = thread_cpu_time();
+            for (size_t t = 0; t < ticks; t++)
+            {
+                for (size_t c = 0; c < clients; c++)
+                    for (size_t p = 0; p < part_counts[n]; p++)
+                        batch_io_send(
+                            io,
+                            part,
+                            size,
+                            (struct sockaddr *)&addrs[c % array_length(addrs)],
+                            sizeof(addrs[0]));
+                batch_io_flush(io);
+            }
+            batched[segmenting] = (f64)(thread_cpu_time() - start) / datagrams;
+        }
+        printf(
+            "%8zu %14.0f %14.0f %14.0f\n",
+            part_counts[n],
+            plain,
+            batched[0],
+            batched[1]);
+    }
+
+    destroy_batch_io(io);
+    close(sender);
+    for (size_t i = 0; i < array_length(receivers); i++)
+        close(receivers[i]);
+}
+
+int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
+{
+    BENCH(bench_aoi_bytes_per_client());
+    BENCH(bench_crowded_view());
+    BENCH(bench_plane_codec());
+    BENCH(bench_shard_scaling());
+    BENCH(bench_idle_timeouts());
+    BENCH(bench_hit_detection());
+    BENCH(bench_rewind());
+    BENCH(bench_segmentation_offload());
+
+    return 0;
+}
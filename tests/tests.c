@@ -1,9 +1,22 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <unistd.h>
 #include "../client/perlin_noise.h"
+#include "snapshot.h"
+#include "plane_codec.h"
+#include "plane_types.h"
+#include "shard_queue.h"
+#include "connection_table.h"
+#include "metrics.h"
+#include "hit_grid.h"
+#include "broadcast_pool.h"
+#include "capture.h"
+#include "shard.h"
+#include "token_bucket.h"
+#include <arpa/inet.h>
 
 #include <SDL2/SDL.h>
 
@@ -151,11 +164,704 @@ char *test_perlin_noise(void)
     return NULL;
 }
 
+bool compare_bullet(const Bullet *b1, const Bullet *b2)
+{
+    if (b1->used != b2->used)
+        return false;
+    if (b1->used == false)
+        return true; // contents of unused bullets do not matter
+    return b1->p[0] == b2->p[0] && b1->p[1] == b2->p[1] &&
+           b1->heading == b2->heading && b1->speed == b2->speed &&
+           b1->drag == b2->drag;
+}
+
+char *test_plane_codec(void)
+{
+    // positions in every quadrant, near and far from the origin
+    const f32 positions[][2] = {
+        {0, 0}, {0.26f, -0.24f}, {-13.37f, 4.2f}, {1000.5f, -2500.125f}};
+    const f32 headings[]     = {0, 1, -1, 7.5f, -20};
+
+    static u8 buffer[2048];
+    for (size_t i = 0; i < array_length(positions); i++)
+    {
+        PlaneState plane = {
+            .plane_type = i,
+            .position   = {positions[i][0], positions[i][1]},
+            .heading    = headings[i],
+            .velocity   = 0.05f + i,
+        };
+
+        // an empty baseline that is already quantized, like a real one
+        PlaneState empty = {0};
+        plane_quantize(&empty);
+        BitWriter w = create_bit_writer(buffer, sizeof(buffer));
+        plane_codec_write(&w, &plane, &empty);
+        bit_write_flush(&w);
+        TEST_ASSERT(w.overflow == false, "Plane did not fit in buffer");
+        TEST_ASSERT(
+            (size_t)(w.cursor - buffer) < sizeof(plane),
+            "Plane was not compressed");
+
+        PlaneState out;
+        BitReader r = create_bit_reader(buffer, w.cursor - buffer);
+        TEST_ASSERT(plane_codec_read(&r, &empty, &out), "Failed to read plane");
+
+        // the decoded plane is the quantized plane, which is close to it
+        PlaneState quantized = plane;
+        plane_quantize(&quantized);
+        TEST_ASSERT(
+            memcmp(&out.position, &quantized.position, sizeof(vec2)) == 0,
+            "Incorrect plane position");
+        TEST_ASSERT(
+            glm_vec2_distance(out.position, plane.position) < 1e-3f,
+            "Position not within quantization error");
+        TEST_ASSERT(out.heading == quantized.heading, "Incorrect heading");
+        TEST_ASSERT(
+            fabsf(cosf(out.heading) - cosf(plane.heading)) < 1e-2f,
+            "Heading not within quantization error");
+        TEST_ASSERT(out.velocity == quantized.velocity, "Incorrect speed");
+
+        // quantizing is stable, so a quantized plane is an exact baseline
+        PlaneState twice = quantized;
+        plane_quantize(&twice);
+        TEST_ASSERT(
+            memcmp(&twice, &quantized, sizeof(twice)) == 0,
+            "Quantizing changed a quantized plane");
+    }
+
+    return NULL;
+}
+
+char *test_snapshot_round_trip(void)
+{
+    static struct SnapshotPacket snapshot;
+    snapshot_begin(&snapshot, 12, 0, 3456);
+
+    PlaneState planes[3] = {0};
+    FireEvent fires[3];
+    for (size_t i = 0; i < array_length(planes); i++)
+    {
+        planes[i] = (PlaneState){
+            .plane_type = i,
+            .position   = {i * 1.5f, -0.25f},
+            .heading    = i * 0.1f,
+            .velocity   = 0.3f,
+        };
+        // only values the codec can represent come back unchanged
+        plane_quantize(&planes[i]);
+        TEST_ASSERT(
+            snapshot_write_plane(&snapshot, 100 + i, &planes[i], NULL),
+            "Plane did not fit in snapshot");
+
+        fires[i] = (FireEvent){
+            .tick    = 10 - i,
+            .slot    = i * 60,
+            .origin  = {i * -0.3f, 1e4f},
+            .heading = i * 2.1f,
+            .speed   = 1.75f + i,
+        };
+        TEST_ASSERT(
+            snapshot_write_fire(&snapshot, 100 + i, &fires[i]),
+            "Fire event did not fit in snapshot");
+    }
+    TEST_ASSERT(snapshot.plane_count == 3, "Incorrect plane count");
+
+    size_t offset = 0;
+    static SnapshotEntry entry;
+    for (size_t i = 0; i < array_length(planes); i++)
+    {
+        TEST_ASSERT(
+            snapshot_read_entry(&snapshot, &offset, NULL, &entry) ==
+                SNAPSHOT_READ_PLANE,
+            "Failed to read plane");
+        PlaneState *out = &entry.plane;
+        TEST_ASSERT(entry.id == (uid_t)(100 + i), "Incorrect plane id");
+        TEST_ASSERT(out->plane_type == planes[i].plane_type, "Incorrect type");
+        TEST_ASSERT(
+            compare_position(out->position, planes[i].position),
+            "Incorrect plane position");
+        TEST_ASSERT(out->heading == planes[i].heading, "Incorrect heading");
+        TEST_ASSERT(out->velocity == planes[i].velocity, "Incorrect speed");
+
+        // fire events are sent exactly
+        TEST_ASSERT(
+            snapshot_read_entry(&snapshot, &offset, NULL, &entry) ==
+                SNAPSHOT_READ_FIRE,
+            "Failed to read fire event");
+        TEST_ASSERT(entry.id == (uid_t)(100 + i), "Incorrect shooter id");
+        FireEvent *fire = &entry.fire;
+        TEST_ASSERT(
+            fire->tick == fires[i].tick && fire->slot == fires[i].slot &&
+                compare_position(fire->origin, fires[i].origin) &&
+                fire->heading == fires[i].heading &&
+                fire->speed == fires[i].speed,
+            "Incorrect fire event");
+    }
+
+    TEST_ASSERT(
+        snapshot_read_entry(&snapshot, &offset, NULL, &entry) ==
+            SNAPSHOT_READ_END,
+        "Read past the end of the snapshot");
+
+    // a datagram has to hold every byte the snapshot claims
+    const Packet *packet = (const Packet *)&snapshot;
+    size_t length        = snapshot_packet_size(&snapshot);
+    TEST_ASSERT(
+        packet_complete(packet, length) &&
+            packet_complete(packet, length - 1) == false,
+        "Incorrect snapshot length check");
+
+    return NULL;
+}
+
+char *test_snapshot_delta(void)
+{
+    static struct SnapshotPacket snapshot;
+    static SnapshotFrame baseline;
+
+    PlaneState old = {
+        .plane_type = 1,
+        .position   = {0.5f, 0.5f},
+        .heading    = 1.f,
+        .velocity   = 0.3f,
+    };
+    plane_quantize(&old);
+
+    snapshot_begin(&snapshot, 1, 0, 0);
+    snapshot_frame_reset(&baseline, &snapshot);
+    snapshot_frame_add(&baseline, 7, &old);
+    baseline.parts_received = 1;
+
+    // the plane moves and speeds up
+    PlaneState now = old;
+    now.position[0] = 0.75f;
+    now.velocity    = 0.4f;
+    plane_quantize(&now);
+
+    snapshot_begin(&snapshot, 2, 1, 0);
+    TEST_ASSERT(
+        snapshot_write_plane(&snapshot, 7, &now, &old),
+        "Delta did not fit in snapshot");
+
+    static struct SnapshotPacket full;
+    snapshot_begin(&full, 2, 0, 0);
+    snapshot_write_plane(&full, 7, &now, NULL);
+    TEST_ASSERT(snapshot.size < full.size, "Delta is not smaller");
+
+    size_t offset = 0;
+    static SnapshotEntry entry;
+    TEST_ASSERT(
+        snapshot_read_entry(&snapshot, &offset, &baseline, &entry) ==
+            SNAPSHOT_READ_PLANE,
+        "Failed to read delta");
+    TEST_ASSERT(entry.id == 7, "Incorrect plane id");
+    TEST_ASSERT(entry.plane.plane_type == now.plane_type, "Incorrect type");
+    TEST_ASSERT(
+        compare_position(entry.plane.position, now.position),
+        "Incorrect plane position");
+    TEST_ASSERT(entry.plane.heading == now.heading, "Incorrect heading");
+    TEST_ASSERT(entry.plane.velocity == now.velocity, "Incorrect speed");
+
+    // without the baseline the plane can not be rebuilt
+    offset = 0;
+    TEST_ASSERT(
+        snapshot_read_entry(&snapshot, &offset, NULL, &entry) ==
+            SNAPSHOT_READ_NO_BASELINE,
+        "Read a delta without its baseline");
+
+    return NULL;
+}
+
+char *test_fire_event_bullet(void)
+{
+    const f32 delta = 1.f / SERVER_TICK_RATE;
+
+    // fire the way the server does, recording the bullet after its first step
+    Plane plane = create_plane_type(PLANE_TYPE_F16);
+    plane.next_fire_time = 0;
+    size_t slot          = plane_fire_bullet(&plane);
+    TEST_ASSERT(slot < MAX_BULLET_COUNT, "Plane did not fire");
+    plane_update(&plane, delta);
+
+    const Bullet *fired = &plane.active_bullets[slot];
+    FireEvent event     = {
+            .tick    = 5,
+            .slot    = slot,
+            .origin  = {fired->p[0], fired->p[1]},
+            .heading = fired->heading,
+            .speed   = fired->speed,
+    };
+
+    // a receiver catching up lands exactly where the plane's bullet is
+    for (u32 tick = 6; tick < 5 + 10 * SERVER_TICK_RATE; tick++)
+    {
+        plane_update(&plane, delta);
+        Bullet replayed = fire_event_bullet(&event, tick, delta);
+        TEST_ASSERT(
+            compare_bullet(&replayed, fired),
+            "Replayed bullet does not match");
+    }
+
+    return NULL;
+}
+
+char *test_shard_queue(void)
+{
+    ShardQueue queue;
+    TEST_ASSERT(
+        create_shard_queue(&queue, 256) == RS_SUCCESS,
+        "Failed to create queue");
+
+    // messages of different sizes wrap around the end of the ring many
+    // times, and come out whole and in order
+    u32 written = 0, read = 0;
+    for (size_t round = 0; round < 100; round++)
+    {
+        for (size_t i = 0; i < 3; i++)
+        {
+            size_t size  = 4 + (written % 7) * 4;
+            u32 *message = shard_queue_reserve(&queue, size);
+            TEST_ASSERT(message != NULL, "Queue full too early");
+            for (size_t w = 0; w < size / 4; w++)
+                message[w] = written;
+            shard_queue_commit(&queue);
+            written++;
+        }
+
+        const u32 *message;
+        size_t size;
+        while ((message = shard_queue_peek(&queue, &size)) != NULL)
+        {
+            TEST_ASSERT(size == 4 + (read % 7) * 4, "Incorrect message size");
+            for (size_t w = 0; w < size / 4; w++)
+                TEST_ASSERT(message[w] == read, "Incorrect message");
+            shard_queue_pop(&queue);
+            read++;
+        }
+    }
+    TEST_ASSERT(read == written, "Messages lost");
+
+    // a full queue drops messages instead of overwriting unread ones
+    while (shard_queue_reserve(&queue, 32) != NULL)
+        shard_queue_commit(&queue);
+    TEST_ASSERT(queue.dropped == 1, "Full queue did not drop");
+
+    destroy_shard_queue(&queue);
+    return NULL;
+}
+
+char *test_connection_table(void)
+{
+    const size_t count = 64;
+    ConnectionTable table;
+    TEST_ASSERT(
+        create_connection_table(&table, count, 60, 1) == RS_SUCCESS,
+        "Failed to create table");
+
+    struct sockaddr_in addrs[count];
+    for (size_t i = 0; i < count; i++)
+    {
+        addrs[i] = (struct sockaddr_in){
+            .sin_family      = AF_INET,
+            .sin_port        = htons(5000 + i),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        struct sockaddr *addr = (struct sockaddr *)&addrs[i];
+        TEST_ASSERT(
+            connection_table_add(&table, 100 + i, addr, sizeof(addrs[i]), 0),
+            "Failed to add connection");
+    }
+    struct sockaddr *first = (struct sockaddr *)&addrs[0];
+    TEST_ASSERT(
+        connection_table_add(&table, 0, first, sizeof(addrs[0]), 0) == NULL,
+        "Added to a full table");
+
+    // remove every other connection, which moves others into their place
+    for (size_t i = 0; i < count; i += 2)
+        connection_table_remove(&table, 100 + i);
+    TEST_ASSERT(table.count == count / 2, "Incorrect connection count");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct sockaddr *addr      = (struct sockaddr *)&addrs[i];
+        struct Connection *by_id   = connection_table_find(&table, 100 + i);
+        struct Connection *by_addr = connection_table_find_addr(
+            &table, addr, sizeof(addrs[i]));
+        TEST_ASSERT(by_id == by_addr, "Indexes disagree");
+        TEST_ASSERT((by_id == NULL) == (i % 2 == 0), "Incorrect removal");
+        TEST_ASSERT(by_id == NULL || by_id->id == 100 + i, "Incorrect id");
+    }
+
+    // clients heard from are kept past the timeout, the rest time out once
+    for (size_t i = 1; i < count; i += 4)
+        connection_table_find(&table, 100 + i)->last_seen = 30;
+    size_t idle_count = 0;
+    for (u32 tick = 0; tick <= 60; tick++)
+    {
+        struct Connection *idle;
+        while ((idle = connection_table_next_idle(&table, tick)) != NULL)
+        {
+            TEST_ASSERT(tick == 60, "Client timed out early");
+            TEST_ASSERT(idle->last_seen == 0, "Active client timed out");
+            connection_table_remove(&table, idle->id);
+            idle_count++;
+        }
+    }
+    TEST_ASSERT(idle_count == count / 4, "Incorrect number of timeouts");
+    TEST_ASSERT(
+        connection_table_next_idle(&table, 89) == NULL,
+        "Client timed out early");
+    TEST_ASSERT(
+        connection_table_next_idle(&table, 90) != NULL,
+        "Client did not time out");
+
+    destroy_connection_table(&table);
+    return NULL;
+}
+
+char *test_metrics_histogram(void)
+{
+    static Histogram histogram;
+    for (u64 value = 1; value <= 10000; value++)
+        histogram_record(&histogram, value);
+    Metrics metrics = {0};
+    metrics.loop_latency = histogram;
+    MetricsTotals totals = {0};
+    metrics_add_to(&metrics, &totals);
+
+    // a bucket holds values within 1/16 of each other
+    u64 median = histogram_percentile(totals.loop_latency, 0.5);
+    u64 max    = histogram_percentile(totals.loop_latency, 1.0);
+    TEST_ASSERT(median >= 5000 && median <= 5000 + 5000 / 16, "Bad median");
+    TEST_ASSERT(max >= 10000 && max <= 10000 + 10000 / 16, "Bad maximum");
+    TEST_ASSERT(
+        histogram_percentile(totals.tick_duration, 0.5) == 0,
+        "Empty histogram has values");
+    for (size_t i = 1; i < HISTOGRAM_BUCKETS; i++)
+        TEST_ASSERT(
+            histogram_bucket_value(i) > histogram_bucket_value(i - 1),
+            "Buckets out of order");
+
+    // short datagrams and unknown types are counted last
+    const u32 unknown = 1000;
+    metrics_count(metrics.packets_in, &unknown, sizeof(unknown));
+    metrics_count(metrics.packets_in, &unknown, 1);
+    TEST_ASSERT(
+        metrics.packets_in[PACKET_TYPE_COUNT] == 2, "Unknown types lost");
+    return NULL;
+}
+
+char *test_hit_grid(void)
+{
+    World world;
+    HitGrid grid;
+    TEST_ASSERT(create_world(&world, 4) == RS_SUCCESS, "World not created");
+    TEST_ASSERT(create_hit_grid(&grid, 4) == RS_SUCCESS, "Grid not created");
+
+    WorldPlane *shooter = world_add_plane(&world, 1, PLANE_TYPE_FA18);
+    WorldPlane *victim  = world_add_plane(&world, 2, PLANE_TYPE_FA18);
+    WorldPlane *remote  = world_add_plane(&world, 3, PLANE_TYPE_FA18);
+    plane_set_position(&shooter->plane, (vec2){0.f, 0.f});
+    plane_set_position(&victim->plane, (vec2){1.f, 1.f});
+    plane_set_position(&remote->plane, (vec2){2.f, 2.f});
+    remote->remote = true;
+
+    // two bullets in range of the victim from a neighbouring cell, one on
+    // the plane that fired it and one on a plane another worker decides
+    Bullet *bullets = shooter->plane.active_bullets;
+    bullets[3]      = (Bullet){.used = true, .p = {1.02f, 1.f}};
+    bullets[4]      = (Bullet){.used = true, .p = {1.f, 0.99f}};
+    bullets[5]      = (Bullet){.used = true, .p = {0.f, 0.01f}};
+    bullets[6]      = (Bullet){.used = true, .p = {2.f, 2.f}};
+    victim->plane.active_bullets[0] = (Bullet){.used = true, .p = {0.5f, 0.f}};
+
+    world_record(&world, 1000);
+    hit_grid_resolve(&grid, &world, 1000);
+    TEST_ASSERT(grid.hit_count == 1, "Planes hit the wrong number of times");
+    TEST_ASSERT(
+        grid.hits[0].victim == 1 && grid.hits[0].shooter == 0 &&
+            grid.hits[0].slot == 3,
+        "Wrong hit found");
+
+    // the victim flies away, but the shooter still sees it where it was
+    memset(bullets, 0, MAX_BULLET_COUNT * sizeof(Bullet));
+    bullets[0] = (Bullet){.used = true, .p = {1.f, 1.f}};
+    plane_set_position(&victim->plane, (vec2){1.5f, 1.f});
+    world_record(&world, 2000);
+    hit_grid_resolve(&grid, &world, 2000);
+    TEST_ASSERT(grid.hit_count == 0, "Hit where the victim is not");
+    shooter->view_delay = 1000;
+    hit_grid_resolve(&grid, &world, 2000);
+    TEST_ASSERT(grid.hit_count == 1, "Hit not rewound");
+
+    destroy_hit_grid(&grid);
+    destroy_world(&world);
+    return NULL;
+}
+
+char *test_plane_history(void)
+{
+    PlaneHistory history;
+    TEST_ASSERT(
+        create_plane_history(&history, 2) == RS_SUCCESS,
+        "History not created");
+
+    vec2 position;
+    TEST_ASSERT(
+        plane_history_rewind(&history, 0, 0, position) == false,
+        "New plane has history");
+    for (u32 i = 1; i <= PLANE_HISTORY_TICKS + 2; i++)
+    {
+        plane_history_push(&history, i * 100);
+        plane_history_store(&history, 0, (vec2){i, 0.f});
+    }
+
+    // between records, before the oldest that is kept and after the newest
+    const u32 newest = PLANE_HISTORY_TICKS + 2;
+    plane_history_rewind(&history, 0, newest * 100 - 25, position);
+    TEST_ASSERT(fabsf(position[0] - (newest - 0.25f)) < 1e-4, "Bad lerp");
+    plane_history_rewind(&history, 0, 0, position);
+    TEST_ASSERT(position[0] == 3, "Bad oldest record");
+    plane_history_rewind(&history, 0, newest * 1000, position);
+    TEST_ASSERT(position[0] == newest, "Bad newest record");
+    TEST_ASSERT(
+        fabsf(plane_history_max_travel(&history, newest * 100 - 250) - 3) <
+            1e-4,
+        "Bad travel");
+
+    plane_history_move(&history, 0, 1);
+    plane_history_rewind(&history, 1, newest * 100 - 50, position);
+    TEST_ASSERT(fabsf(position[0] - (newest - 0.5f)) < 1e-4, "Bad move");
+    plane_history_clear(&history, 1);
+    TEST_ASSERT(
+        plane_history_rewind(&history, 1, 0, position) == false,
+        "Cleared plane has history");
+
+    destroy_plane_history(&history);
+    return NULL;
+}
+
+char *test_capture(void)
+{
+    char path[] = "/tmp/tinyplanes_capture_XXXXXX";
+    close(mkstemp(path));
+
+    CaptureFile file;
+    CaptureHeader header = {.workers = 2, .max_clients = 8};
+    TEST_ASSERT(
+        create_capture_file(&file, path, &header) == RS_SUCCESS,
+        "Capture not created");
+    CaptureBuffer first, second;
+    create_capture_buffer(&first, &file, 0);
+    create_capture_buffer(&second, &file, 1);
+
+    // the second worker's records are written first, but happen between
+    // those of the first
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(1234),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct EmptyPacket packet = {.type = PACKET_TYPE_EMPTY, .id = 7};
+    const struct sockaddr *a  = (const struct sockaddr *)&addr;
+    capture_datagram(&first, file.start + 10, a, sizeof(addr), &packet, 5);
+    capture_tick(&first, file.start + 30, 4, 2);
+    capture_datagram(&second, file.start + 20, a, sizeof(addr), &packet, 8);
+    destroy_capture_buffer(&second);
+    destroy_capture_buffer(&first);
+    destroy_capture_file(&file);
+
+    Capture capture;
+    TEST_ASSERT(load_capture(&capture, path) == RS_SUCCESS, "Not loaded");
+    unlink(path);
+    TEST_ASSERT(capture.event_count == 3, "Wrong record count");
+    TEST_ASSERT(capture.header.max_clients == 8, "Wrong header");
+
+    const CaptureEvent *e = capture.events;
+    TEST_ASSERT(
+        e[0].time == 10 && e[0].record->worker == 0 &&
+            e[0].record->datagram.length == 5 &&
+            e[0].record->datagram.port == htons(1234) &&
+            memcmp(e[0].record + 1, &packet, 5) == 0,
+        "Wrong first datagram");
+    TEST_ASSERT(
+        e[1].time == 20 && e[1].record->worker == 1 &&
+            e[1].record->datagram.length == 8,
+        "Records not sorted by time");
+    TEST_ASSERT(
+        e[2].time == 30 && e[2].record->type == CAPTURE_TICK &&
+            e[2].record->tick.first == 4 && e[2].record->tick.count == 2,
+        "Wrong tick");
+
+    destroy_capture(&capture);
+    return NULL;
+}
+
+char *test_token_bucket(void)
+{
+    // 10 a second, in bursts of up to 2
+    TokenBucket b = token_bucket_full(2, 1000);
+    TEST_ASSERT(
+        token_bucket_take(&b, 10, 2, 1000) &&
+            token_bucket_take(&b, 10, 2, 1000),
+        "Burst not allowed");
+    TEST_ASSERT(
+        token_bucket_take(&b, 10, 2, 1000) == false, "Empty bucket allowed");
+
+    // a token takes 100ms to earn, and a partly earned one is not lost
+    TEST_ASSERT(
+        token_bucket_take(&b, 10, 2, 60000) == false, "Token earned early");
+    TEST_ASSERT(token_bucket_take(&b, 10, 2, 101000), "Token not earned");
+    TEST_ASSERT(
+        token_bucket_take(&b, 10, 2, 101000) == false, "Token earned twice");
+
+    // a long silence only refills up to the burst
+    TEST_ASSERT(
+        token_bucket_take(&b, 10, 2, 10000000) &&
+            token_bucket_take(&b, 10, 2, 10000000) &&
+            token_bucket_take(&b, 10, 2, 10000000) == false,
+        "Bucket filled past its burst");
+    return NULL;
+}
+
+char *test_broadcast_pool(void)
+{
+    BroadcastPool pool;
+    TEST_ASSERT(
+        create_broadcast_pool(&pool, 2) == RS_SUCCESS, "Pool not created");
+
+    struct KillPacket kill = {.type = PACKET_TYPE_KILL, .victim = 5};
+    BroadcastBuffer *a     = broadcast_encode(&pool, &kill, sizeof(kill));
+    BroadcastBuffer *b     = broadcast_encode(&pool, &kill, sizeof(kill));
+    TEST_ASSERT(a != NULL && b != NULL && a != b, "Buffers not handed out");
+    TEST_ASSERT(
+        a->length == sizeof(kill) && a->packet.kill_packet.victim == 5,
+        "Packet not written");
+    TEST_ASSERT(
+        broadcast_encode(&pool, &kill, sizeof(kill)) == NULL &&
+            pool.exhausted == 1,
+        "Empty pool handed out a buffer");
+
+    // a buffer only comes back once every send has released it
+    broadcast_retain(a);
+    broadcast_release(a);
+    TEST_ASSERT(pool.free_count == 0, "Buffer in use returned");
+    broadcast_release(a);
+    TEST_ASSERT(
+        broadcast_encode(&pool, &kill, sizeof(kill)) == a,
+        "Released buffer not reused");
+
+    destroy_broadcast_pool(&pool);
+    return NULL;
+}
+
+// feed a connection request to a worker from the given port, returns the
+// uid it was given or 0 if it was turned away
+static uid_t test_join(Shard *s, u16 port, u32 room)
+{
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    Packet packet = {.connection_packet = {
+                         .type = PACKET_TYPE_CONNECITON,
+                         .room = room,
+                     }};
+    shard_feed(
+        s,
+        0,
+        &packet,
+        sizeof(packet.connection_packet),
+        (const struct sockaddr *)&addr,
+        sizeof(addr));
+    return packet.connection_packet.return_uid;
+}
+
+char *test_rooms(void)
+{
+    ShardConfig config = {
+        .workers      = 2,
+        .max_clients  = 8,
+        .max_rooms    = 2,
+        .room_size    = 2,
+        .idle_timeout = 60,
+        .offline      = true,
+    };
+    ShardGroup g;
+    TEST_ASSERT(
+        create_shard_group(&g, &config) == RS_SUCCESS, "Group not created");
+    Shard *first = &g.shards[0], *second = &g.shards[1];
+
+    uid_t a = test_join(first, 1000, 0);
+    uid_t b = test_join(second, 1001, 1);
+    uid_t c = test_join(first, 1002, 1);
+    TEST_ASSERT(a != 0 && b != 0 && c != 0, "Client not let in");
+    TEST_ASSERT(test_join(first, 1003, 1) == 0, "Full room let a client in");
+    TEST_ASSERT(test_join(first, 1004, 2) == 0, "Missing room let a client in");
+    TEST_ASSERT(second->rooms[0] == NULL, "Room opened without clients");
+
+    // a datagram cut short is dropped instead of read past its end
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(1005),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    Packet cut = {.connection_packet.type = PACKET_TYPE_CONNECITON};
+    shard_feed(
+        first,
+        0,
+        &cut,
+        sizeof(PacketType),
+        (const struct sockaddr *)&addr,
+        sizeof(addr));
+    TEST_ASSERT(
+        cut.connection_packet.return_uid == 0 &&
+            atomic_load(&first->metrics.rejected) == 1,
+        "Short datagram handled");
+
+    // planes only reach the other worker's copy of the same room
+    for (u64 tick = 1; tick <= 2; tick++)
+    {
+        shard_advance(first, 0, tick, 1);
+        shard_advance(second, 0, tick, 1);
+    }
+    World *lobby = &first->rooms[0]->world;
+    World *match = &first->rooms[1]->world;
+    TEST_ASSERT(
+        lobby->plane_count == 1 && world_find_plane(lobby, a) != NULL,
+        "Wrong planes in room 0");
+    TEST_ASSERT(
+        match->plane_count == 2 && world_find_plane(match, b) != NULL &&
+            world_find_plane(match, b)->remote,
+        "Remote plane not in its room");
+    TEST_ASSERT(
+        second->rooms[1]->world.plane_count == 2 && second->rooms[0] == NULL,
+        "Plane sent to a room without clients");
+
+    destroy_shard_group(&g);
+    return NULL;
+}
+
 int main([[maybe_unused]] int argc, [[maybe_unused]] char **argv)
 {
     TEST(test_plane_local());
     TEST(test_pos_to_screen());
     TEST(test_rotation_local());
+    TEST(test_plane_codec());
+    TEST(test_snapshot_round_trip());
+    TEST(test_snapshot_delta());
+    TEST(test_fire_event_bullet());
+    TEST(test_shard_queue());
+    TEST(test_connection_table());
+    TEST(test_metrics_histogram());
+    TEST(test_hit_grid());
+    TEST(test_plane_history());
+    TEST(test_capture());
+    TEST(test_rooms());
+    TEST(test_broadcast_pool());
+    TEST(test_token_bucket());
     TEST(test_perlin_noise());
 
     return 0;